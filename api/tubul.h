@@ -148,19 +148,60 @@ namespace TU {
      *                  will be written.
      * @param level A level from where this sink should be used.
      *              See TU::LogLevel.
+     * @param fileOptions Optional buffering and rotation of log files.
+     *              See TU::FileLogOptions
      * @param options Optional Options that can be added using "|",
      *              like adding colors, skipping timestamps, etc.
      *              See TU::LogOptions
+     * @return Index of the new logger, used by setLoggerBlockFilter.
      */
-	void addLoggerDefinition(std::string const &logfile, LogLevel level, LogOptions options=LogOptions::NONE);
-	void addLoggerDefinition(std::ostream &out, LogLevel level, LogOptions options=LogOptions::NONE);
-    void addLoggerDefinition(std::function<void(TU::LogLevel, const std::string&)> callback, TU::LogLevel level, TU::LogOptions options=LogOptions::NONE);
+	size_t addLoggerDefinition(std::string const &logfile, LogLevel level, LogOptions options=LogOptions::NONE);
+	size_t addLoggerDefinition(std::string const &logfile, LogLevel level, FileLogOptions fileOptions, LogOptions options=LogOptions::NONE);
+	size_t addLoggerDefinition(std::ostream &out, LogLevel level, LogOptions options=LogOptions::NONE);
+    size_t addLoggerDefinition(std::function<void(TU::LogLevel, const std::string&)> callback, TU::LogLevel level, TU::LogOptions options=LogOptions::NONE);
+
+    /** \brief Adds a logger writing to a log ring: a memory mapped file that keeps only the
+     * last ringOptions.capacity bytes of lines, overwriting the oldest ones. Lines reach the
+     * file without system calls or flushes and survive a crash of the process.
+     * dumpLogRing (or the logring_dump app) prints them.
+     * @return Index of the new logger, used by setLoggerBlockFilter.
+     */
+    size_t addLoggerDefinition(std::string const &ringFile, LogLevel level, RingLogOptions ringOptions, LogOptions options=LogOptions::NONE);
+
+    /** \brief Writes the lines of a log ring to out, from the oldest to the newest.
+     * @return The number of lines written.
+     */
+    size_t dumpLogRing(std::string const &ringFile, std::ostream &out);
+
+    /** \brief Makes a logger write only the messages logged inside blocks (TU::Block) whose
+     * location matches a pattern, like "main.loadData.*" ('*' matches anything, dots included,
+     * and several patterns can be separated by commas). Every block location is matched once,
+     * so the check while logging is just a bit test.
+     * @param logger Index returned by addLoggerDefinition.
+     * @param pattern The pattern. An empty one removes the filter.
+     */
+    void setLoggerBlockFilter(size_t logger, std::string const &pattern);
 
     /** \brief Clears logger definitions defined previously,
      * including the default std::cout definition.
      */
     void clearLoggerDefinitions();
 
+    /** \brief Switches logging to asynchronous mode: log* calls only queue the message and a
+     * background thread writes them in batches, flushing once per batch. Useful when many
+     * threads log, since nobody waits for the sinks. Everything queued is written before
+     * stopAsyncLogging() returns, at exit, or when the logger definitions change.
+     * @param options Size of the queue and what to do when it's full (block or drop).
+     *              See TU::AsyncLogOptions
+     */
+    void startAsyncLogging(AsyncLogOptions options = {});
+    void stopAsyncLogging();
+
+    /** \brief Waits until all the messages logged so far are written and flushed, including
+     * the lines log files keep in their buffers (see TU::FileLogOptions).
+     */
+    void flushLog();
+
     /** \brief log* functions, allow to send a message to all loggers that
      * participate on the corresponding level.
      * End-of-line is added atomatically.
@@ -174,8 +215,9 @@ namespace TU {
     void logStat(std::string const &msg);
 
     /** \brief log* functions, allow to send a message to all loggers that
-     * participate on the corresponding level Similar to normal log* versions
-     * but this version is thread safe.
+     * participate on the corresponding level. Same as the normal log* versions,
+     * which are also thread safe: lines are built per thread and only the
+     * sinks being written are locked, so they scale with the number of threads.
      * End-of-line is added atomatically.
      * @param The message to be sent
      */
@@ -312,8 +354,29 @@ namespace TU {
 	 *
 	 */
 	struct Block;
+	struct BlockStats;
+	struct ThreadBlockStats;
+	struct BlockTreeNode;
+	BlockTreeNode getBlockTree();
 	std::string getCurrentBlockLocation();
+	//Blocks work in any thread: the reports add up what all the threads measured
+	//The call tree of the blocks, as a table or as JSON
 	std::string reportBlocks();
+	std::string reportBlocksJson();
+	std::string reportBlocksByThread();
+	void enableBlockHistograms(const std::string& pattern);
+	bool enableBlockCounters();
+	void disableBlockCounters();
+	//Sampling profiler tagged with the current block, see tubul_profiler.h
+	void startSamplingProfiler(SamplingProfilerOptions options);
+	size_t stopSamplingProfiler();
+	size_t writeCollapsedStacks(std::ostream& out);
+	//Timeline of the blocks, as Chrome Trace Event JSON
+	void startBlockTrace(const std::string& file, size_t maxEventsPerThread);
+	void stopBlockTrace();
+	size_t writeBlockTrace(std::ostream& out);
+	BlockStats getAccumulatedStats(const std::string& name);
+	std::vector<ThreadBlockStats> getAccumulatedStatsByThread(const std::string& name);
 
     /////////////
     // Exceptions
@@ -407,6 +470,7 @@ namespace TU {
 	 */
 	size_t memAlive();
 	size_t memLifetime();
+	size_t memAllocations();
 
 	/** This structure provides an easy way to maintain a memory monitoring system.
 	 * It will create a thread that will wake up every 0.5s and write to a file the
@@ -418,6 +482,15 @@ namespace TU {
 	 */
 	struct MemoryMonitor;
 
+	/** Counters, gauges and histograms for the domain numbers of the program (rows parsed, nodes
+	 * visited...), cheap to update from any thread. MetricsReporter is the MemoryMonitor of the
+	 * metrics: a thread dumping them periodically to a file, in Prometheus text or CSV format.
+	 * See tubul_metrics.h.
+	 */
+	class MetricsRegistry;
+	MetricsRegistry& getMetrics();
+	struct MetricsReporter;
+
     /////////
     // File Utils
     /////////
@@ -0,0 +1,29 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include <iostream>
+
+#include "tubul.h"
+
+//Renders binary logs (written with TUBUL_BINARY_LOG / TUBUL_STAT_BINARY) as text.
+//The "<file>.fmt" file with the formats must be next to each log.
+int main(int argc, const char** argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " <binary log> [<binary log> ...]" << std::endl;
+		return 1;
+	}
+	try
+	{
+		for (int i = 1; i < argc; ++i)
+			TU::decodeBinaryLog(argv[i], std::cout);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,28 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include <iostream>
+
+#include "tubul.h"
+
+//Prints the lines kept in log rings (loggers defined with TU::RingLogOptions), oldest first.
+int main(int argc, const char** argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " <log ring> [<log ring> ...]" << std::endl;
+		return 1;
+	}
+	try
+	{
+		for (int i = 1; i < argc; ++i)
+			TU::dumpLogRing(argv[i], std::cout);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
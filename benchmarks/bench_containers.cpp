@@ -0,0 +1,141 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include <benchmark/benchmark.h>
+#include "tubul.h"
+#include "tubul_string_index.h"
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+struct Point
+{
+	double x;
+	double y;
+	int32_t id;
+};
+
+std::vector<int> shuffledKeys(size_t n)
+{
+	std::vector<int> keys(n);
+	for (size_t i = 0; i < n; ++i)
+		keys[i] = static_cast<int>(i * 7);
+	std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+	return keys;
+}
+
+std::vector<std::string> words(size_t n)
+{
+	std::vector<std::string> res;
+	res.reserve(n);
+	for (size_t i = 0; i < n; ++i)
+		res.push_back("node_" + std::to_string(i * 2654435761u % 1000003));
+	return res;
+}
+
+//Growing a vector of trivially copyable elements from empty
+template<typename Vector>
+void BM_PushBack(benchmark::State& state)
+{
+	const auto n = static_cast<size_t>(state.range(0));
+	for (auto _: state)
+	{
+		Vector v;
+		for (size_t i = 0; i < n; ++i)
+			v.push_back({static_cast<double>(i), 1.0, static_cast<int32_t>(i)});
+		benchmark::DoNotOptimize(v.data());
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * n));
+}
+BENCHMARK_TEMPLATE(BM_PushBack, std::vector<Point>)->Range(8, 1 << 16);
+BENCHMARK_TEMPLATE(BM_PushBack, TU::PODVector<Point>)->Range(8, 1 << 16);
+
+//Many short lived small vectors, where SmallVector avoids the allocation
+template<typename Vector>
+void BM_SmallVectors(benchmark::State& state)
+{
+	const auto n = static_cast<int>(state.range(0));
+	for (auto _: state)
+	{
+		Vector v;
+		for (int i = 0; i < n; ++i)
+			v.push_back(i);
+		benchmark::DoNotOptimize(v.data());
+	}
+}
+BENCHMARK_TEMPLATE(BM_SmallVectors, std::vector<int>)->Arg(4)->Arg(8)->Arg(32);
+BENCHMARK_TEMPLATE(BM_SmallVectors, TU::SmallVector<int, 8>)->Arg(4)->Arg(8)->Arg(32);
+
+template<typename Map>
+void BM_MapFind(benchmark::State& state)
+{
+	const auto keys = shuffledKeys(static_cast<size_t>(state.range(0)));
+	Map map;
+	for (auto k: keys)
+		map[k] = k;
+	size_t i = 0;
+	for (auto _: state)
+	{
+		auto it = map.find(keys[i]);
+		benchmark::DoNotOptimize(it);
+		if (++i == keys.size())
+			i = 0;
+	}
+}
+BENCHMARK_TEMPLATE(BM_MapFind, std::map<int, int>)->Range(16, 1 << 16);
+BENCHMARK_TEMPLATE(BM_MapFind, std::unordered_map<int, int>)->Range(16, 1 << 16);
+BENCHMARK_TEMPLATE(BM_MapFind, TU::FlatMap<int, int>)->Range(16, 1 << 16);
+
+template<typename Map>
+void BM_MapIterate(benchmark::State& state)
+{
+	Map map;
+	for (auto k: shuffledKeys(static_cast<size_t>(state.range(0))))
+		map[k] = k;
+	for (auto _: state)
+	{
+		int64_t sum = 0;
+		for (auto const& [k, v]: map)
+			sum += v;
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * map.size()));
+}
+BENCHMARK_TEMPLATE(BM_MapIterate, std::map<int, int>)->Range(16, 1 << 16);
+BENCHMARK_TEMPLATE(BM_MapIterate, TU::FlatMap<int, int>)->Range(16, 1 << 16);
+
+void BM_StringIdsStdMap(benchmark::State& state)
+{
+	const auto names = words(static_cast<size_t>(state.range(0)));
+	for (auto _: state)
+	{
+		std::unordered_map<std::string, size_t> ids;
+		for (auto const& name: names)
+			ids.try_emplace(name, ids.size());
+		benchmark::DoNotOptimize(ids.size());
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * names.size()));
+}
+BENCHMARK(BM_StringIdsStdMap)->Range(1 << 10, 1 << 16);
+
+void BM_StringIdsStringIndex(benchmark::State& state)
+{
+	const auto names = words(static_cast<size_t>(state.range(0)));
+	for (auto _: state)
+	{
+		TU::StringIndex ids(1 << 20);
+		for (auto const& name: names)
+			ids.tryGetId(name);
+		benchmark::DoNotOptimize(ids.size());
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * names.size()));
+}
+BENCHMARK(BM_StringIdsStringIndex)->Range(1 << 10, 1 << 16);
+}
@@ -0,0 +1,56 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include <benchmark/benchmark.h>
+#include "tubul.h"
+
+#include <filesystem>
+#include <random>
+#include <string>
+
+namespace
+{
+TU::Graph::SparseWeightDirected randomGraph(size_t nodes, size_t edgesPerNode)
+{
+	std::mt19937 rng(3);
+	std::uniform_int_distribution<TU::Graph::NodeId> node(0, static_cast<TU::Graph::NodeId>(nodes - 1));
+	std::uniform_int_distribution<TU::Graph::CostType> cost(0, 1000);
+	TU::Graph::SparseWeightDirected g;
+	g.adj_.resize(nodes);
+	for (auto& edges: g.adj_)
+		for (size_t e = 0; e < edgesPerNode; ++e)
+			edges.push_back({node(rng), cost(rng)});
+	return g;
+}
+
+std::string graphFile(const char* format)
+{
+	return (std::filesystem::temp_directory_path() / (std::string("tubul_bench_") + format + ".graph")).string();
+}
+
+using WriteFunction = void (*)(const TU::Graph::SparseWeightDirected&, const std::string&);
+using ReadFunction = TU::Graph::SparseWeightDirected (*)(const std::string&);
+
+//Writing and reading back the same graph in each of the formats. The text one is the reference.
+void BM_GraphIO(benchmark::State& state, const char* format, WriteFunction write, ReadFunction read)
+{
+	const auto g = randomGraph(static_cast<size_t>(state.range(0)), 8);
+	const auto file = graphFile(format);
+	for (auto _: state)
+	{
+		write(g, file);
+		auto copy = read(file);
+		benchmark::DoNotOptimize(copy.adj_.data());
+	}
+	state.counters["file_bytes"] = static_cast<double>(std::filesystem::file_size(file));
+	state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * g.nodeCount() * 8));
+	std::filesystem::remove(file);
+}
+BENCHMARK_CAPTURE(BM_GraphIO, Text, "text", TU::Graph::IO::Text::write, TU::Graph::IO::Text::read)
+	->Arg(1 << 10)->Arg(1 << 14)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_GraphIO, Binary, "binary", TU::Graph::IO::Binary::write, TU::Graph::IO::Binary::read)
+	->Arg(1 << 10)->Arg(1 << 14)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_GraphIO, Encoded, "encoded", TU::Graph::IO::Encoded::write, TU::Graph::IO::Encoded::read)
+	->Arg(1 << 10)->Arg(1 << 14)->Unit(benchmark::kMillisecond);
+}
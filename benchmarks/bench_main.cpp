@@ -0,0 +1,58 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include <benchmark/benchmark.h>
+#include "tubul.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace
+{
+//Reports the allocations of every benchmark (allocs_per_iter in the output) with tubul's own
+//new/delete counters, so the regression harness can catch benchmarks that allocate more.
+class TubulMemoryManager : public benchmark::MemoryManager
+{
+public:
+	void Start() override
+	{
+		allocations_ = TU::memAllocations();
+		lifetime_ = TU::memLifetime();
+		alive_ = TU::memAlive();
+	}
+
+	//Google Benchmark moved from the pointer to the reference version, this works with both.
+	void Stop(Result& result)
+	{
+		result.num_allocs = static_cast<int64_t>(TU::memAllocations() - allocations_);
+		result.total_allocated_bytes = static_cast<int64_t>(TU::memLifetime() - lifetime_);
+		result.net_heap_growth = static_cast<int64_t>(TU::memAlive()) - static_cast<int64_t>(alive_);
+		//Peak usage is not tracked, report the growth rather than leaving it unset.
+		result.max_bytes_used = std::max<int64_t>(result.net_heap_growth, 0);
+	}
+
+	void Stop(Result* result)
+	{
+		Stop(*result);
+	}
+
+private:
+	size_t allocations_ = 0;
+	size_t lifetime_ = 0;
+	size_t alive_ = 0;
+};
+}
+
+int main(int argc, char** argv)
+{
+	TubulMemoryManager memoryManager;
+	benchmark::RegisterMemoryManager(&memoryManager);
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	benchmark::RegisterMemoryManager(nullptr);
+	return 0;
+}
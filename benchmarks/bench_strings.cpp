@@ -0,0 +1,106 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include <benchmark/benchmark.h>
+#include "tubul.h"
+
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+std::string csvLine(size_t fields)
+{
+	std::string line;
+	for (size_t i = 0; i < fields; ++i)
+	{
+		if (i)
+			line += ',';
+		line += "field" + std::to_string(i * 31);
+	}
+	return line;
+}
+
+void BM_SplitStringstream(benchmark::State& state)
+{
+	const auto line = csvLine(static_cast<size_t>(state.range(0)));
+	for (auto _: state)
+	{
+		std::vector<std::string> fields;
+		std::istringstream in(line);
+		std::string field;
+		while (std::getline(in, field, ','))
+			fields.push_back(field);
+		benchmark::DoNotOptimize(fields.data());
+	}
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * line.size()));
+}
+BENCHMARK(BM_SplitStringstream)->Arg(8)->Arg(64)->Arg(512);
+
+void BM_SplitTubul(benchmark::State& state)
+{
+	const auto line = csvLine(static_cast<size_t>(state.range(0)));
+	const std::string delims(",");
+	for (auto _: state)
+	{
+		auto fields = TU::split(line, delims);
+		benchmark::DoNotOptimize(fields.data());
+	}
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * line.size()));
+}
+BENCHMARK(BM_SplitTubul)->Arg(8)->Arg(64)->Arg(512);
+
+//Values mostly small, as ids and costs usually are
+std::vector<uint64_t> varintValues()
+{
+	std::mt19937_64 rng(7);
+	std::vector<uint64_t> values(4096);
+	for (auto& v: values)
+		v = rng() >> (rng() % 64);
+	return values;
+}
+
+void BM_FixedWidthRoundTrip(benchmark::State& state)
+{
+	const auto values = varintValues();
+	std::vector<uint8_t> buffer(values.size() * sizeof(uint64_t));
+	for (auto _: state)
+	{
+		uint64_t sum = 0;
+		for (size_t i = 0; i < values.size(); ++i)
+			std::memcpy(buffer.data() + i * sizeof(uint64_t), &values[i], sizeof(uint64_t));
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			uint64_t v;
+			std::memcpy(&v, buffer.data() + i * sizeof(uint64_t), sizeof(uint64_t));
+			sum += v;
+		}
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * values.size()));
+	state.counters["bytes_per_value"] = sizeof(uint64_t);
+}
+BENCHMARK(BM_FixedWidthRoundTrip);
+
+void BM_VarintRoundTrip(benchmark::State& state)
+{
+	const auto values = varintValues();
+	size_t bytes = 0;
+	for (auto v: values)
+		bytes += TU::bytesAsVarint(v);
+	for (auto _: state)
+	{
+		uint64_t sum = 0;
+		for (auto v: values)
+			sum += TU::fromVarint(TU::toVarint(v));
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * values.size()));
+	state.counters["bytes_per_value"] = static_cast<double>(bytes) / static_cast<double>(values.size());
+}
+BENCHMARK(BM_VarintRoundTrip);
+}
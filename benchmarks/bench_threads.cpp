@@ -0,0 +1,119 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include <benchmark/benchmark.h>
+#include "tubul.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+//What MPMCQueue replaces in the thread pool
+class LockedQueue
+{
+public:
+	void push(size_t v)
+	{
+		std::scoped_lock lock(mutex_);
+		items_.push_back(v);
+	}
+
+	bool tryPop(size_t& v)
+	{
+		std::scoped_lock lock(mutex_);
+		if (items_.empty())
+			return false;
+		v = items_.front();
+		items_.pop_front();
+		return true;
+	}
+
+private:
+	std::mutex mutex_;
+	std::deque<size_t> items_;
+};
+
+//Every combination of 1, 2, 4... producers and consumers, up to half the hardware threads
+void producersAndConsumers(benchmark::internal::Benchmark* b)
+{
+	const int maxThreads = static_cast<int>(std::max(2U, std::thread::hardware_concurrency() / 2));
+	for (int producers = 1; producers <= maxThreads; producers *= 2)
+		for (int consumers = 1; consumers <= maxThreads; consumers *= 2)
+			b->ArgPair(producers, consumers);
+}
+
+//Items going from range(0) producer threads to range(1) consumer threads through the queue
+template<typename Queue>
+void BM_QueueThroughput(benchmark::State& state)
+{
+	static constexpr size_t ITEMS = 1 << 16;
+	const auto producers = static_cast<size_t>(state.range(0));
+	const auto consumers = static_cast<size_t>(state.range(1));
+	const size_t total = (ITEMS / producers) * producers;
+	for (auto _: state)
+	{
+		Queue queue;
+		std::atomic<size_t> received = 0;
+		std::vector<std::thread> threads;
+		for (size_t p = 0; p < producers; ++p)
+			threads.emplace_back([&] {
+				for (size_t i = 0; i < ITEMS / producers; ++i)
+					queue.push(i);
+			});
+		for (size_t c = 0; c < consumers; ++c)
+			threads.emplace_back([&] {
+				size_t v;
+				while (received.load(std::memory_order_relaxed) < total)
+					if (queue.tryPop(v))
+						received.fetch_add(1, std::memory_order_relaxed);
+			});
+		for (auto& t: threads)
+			t.join();
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * total));
+}
+
+struct BoundedQueue : TU::MPMCQueue<size_t>
+{
+	BoundedQueue() : TU::MPMCQueue<size_t>(1024) {}
+};
+
+BENCHMARK_TEMPLATE(BM_QueueThroughput, BoundedQueue)->Apply(producersAndConsumers)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_QueueThroughput, LockedQueue)->Apply(producersAndConsumers)->UseRealTime();
+
+//A memory bound kernel (every task first-touches its own buffer and then streams over it
+//several times) on a free pool and on a pool pinned to nodes with node local queues. The
+//difference only shows on multi-socket machines.
+void BM_MemoryBoundPlacement(benchmark::State& state, TU::ThreadPoolConfig config)
+{
+	static constexpr size_t BUFFER_BYTES = 16 * 1024 * 1024;
+	auto kernel = [] {
+		std::vector<double> buffer(BUFFER_BYTES / sizeof(double), 1.0);
+		double acc = 0;
+		for (size_t pass = 0; pass < 20; ++pass)
+			for (auto v: buffer)
+				acc += v;
+		benchmark::DoNotOptimize(acc);
+	};
+	TU::ThreadPool pool(config);
+	const size_t tasks = pool.threadCount() * 4;
+	for (auto _: state)
+	{
+		for (size_t i = 0; i < tasks; ++i)
+			pool.pushTaskOnNode(i, kernel);
+		pool.waitForTasks();
+	}
+	state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * tasks * BUFFER_BYTES * 20));
+}
+BENCHMARK_CAPTURE(BM_MemoryBoundPlacement, Unpinned, TU::ThreadPoolConfig{})
+	->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_MemoryBoundPlacement, NumaPinned,
+	TU::ThreadPoolConfig{.affinity = TU::ThreadAffinity::NUMA_NODE, .nodeLocalQueues = true})
+	->UseRealTime()->Unit(benchmark::kMillisecond);
+}
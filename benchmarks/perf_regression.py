@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+#
+# Created by Carlos Acosta on 18-10-26.
+#
+"""Performance regression harness for tubul.
+
+Runs the benchmark suite (benchtubul) several times and compares the results against a stored
+baseline, flagging benchmarks that got significantly slower or allocate more.
+
+    perf_regression.py run --bench bin/Release/benchtubul --out current.json
+    perf_regression.py compare benchmarks/baseline.json current.json
+
+"run" simply leaves the Google Benchmark JSON (with every repetition) in --out, so a baseline is
+just the output of a run on the reference version. "compare" uses Welch's t-test on the times of
+the repetitions: a benchmark regresses when it is slower by more than --threshold and the
+difference is significant at --alpha. Allocations (allocs_per_iter, counted with tubul's
+new/delete counters) regress whenever they grow by more than half an allocation per iteration.
+The exit code is 1 when something regressed.
+"""
+
+import argparse
+import json
+import math
+import statistics
+import subprocess
+import sys
+
+
+def run(args):
+    command = [args.bench,
+               f"--benchmark_repetitions={args.repetitions}",
+               f"--benchmark_out={args.out}",
+               "--benchmark_out_format=json",
+               "--benchmark_report_aggregates_only=false"]
+    if args.filter:
+        command.append(f"--benchmark_filter={args.filter}")
+    print("Running:", " ".join(command), file=sys.stderr)
+    return subprocess.run(command, check=False).returncode
+
+
+# Student's t distribution, without scipy
+
+def _beta_continued_fraction(a, b, x):
+    # Lentz's method, as in Numerical Recipes
+    tiny = 1e-300
+    c = 1.0
+    d = 1.0 - (a + b) * x / (a + 1.0)
+    d = 1.0 / (d if abs(d) > tiny else tiny)
+    h = d
+    for m in range(1, 300):
+        m2 = 2 * m
+        aa = m * (b - m) * x / ((a + m2 - 1.0) * (a + m2))
+        d = 1.0 + aa * d
+        d = 1.0 / (d if abs(d) > tiny else tiny)
+        c = 1.0 + aa / c
+        c = c if abs(c) > tiny else tiny
+        h *= d * c
+        aa = -(a + m) * (a + b + m) * x / ((a + m2) * (a + m2 + 1.0))
+        d = 1.0 + aa * d
+        d = 1.0 / (d if abs(d) > tiny else tiny)
+        c = 1.0 + aa / c
+        c = c if abs(c) > tiny else tiny
+        delta = d * c
+        h *= delta
+        if abs(delta - 1.0) < 1e-12:
+            break
+    return h
+
+
+def _regularized_beta(a, b, x):
+    if x <= 0.0:
+        return 0.0
+    if x >= 1.0:
+        return 1.0
+    front = math.exp(math.lgamma(a + b) - math.lgamma(a) - math.lgamma(b) + a * math.log(x) + b * math.log(1.0 - x))
+    if x < (a + 1.0) / (a + b + 2.0):
+        return front * _beta_continued_fraction(a, b, x) / a
+    return 1.0 - front * _beta_continued_fraction(b, a, 1.0 - x) / b
+
+
+def t_survival(t, df):
+    """P(T > t) for Student's t with df degrees of freedom."""
+    tail = 0.5 * _regularized_beta(df / 2.0, 0.5, df / (df + t * t))
+    return tail if t > 0 else 1.0 - tail
+
+
+def t_critical(confidence, df):
+    """t such that P(-t < T < t) = confidence."""
+    target = (1.0 - confidence) / 2.0
+    low, high = 0.0, 1000.0
+    for _ in range(200):
+        mid = (low + high) / 2.0
+        if t_survival(mid, df) > target:
+            low = mid
+        else:
+            high = mid
+    return (low + high) / 2.0
+
+
+class Samples:
+    def __init__(self, times, allocations):
+        self.times = times
+        self.allocations = allocations
+
+    @property
+    def mean(self):
+        return statistics.fmean(self.times)
+
+    @property
+    def variance(self):
+        return statistics.variance(self.times) if len(self.times) > 1 else 0.0
+
+    def confidence_interval(self, confidence):
+        n = len(self.times)
+        if n < 2:
+            return 0.0
+        return t_critical(confidence, n - 1) * math.sqrt(self.variance / n)
+
+
+def load(path):
+    """Repetitions of every benchmark in a Google Benchmark JSON file, times in ns."""
+    units = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+    with open(path) as f:
+        data = json.load(f)
+    res = {}
+    for bench in data.get("benchmarks", []):
+        if bench.get("run_type", "iteration") != "iteration" or "error_occurred" in bench:
+            continue
+        samples = res.setdefault(bench.get("run_name", bench["name"]), Samples([], []))
+        samples.times.append(bench["real_time"] * units[bench.get("time_unit", "ns")])
+        if "allocs_per_iter" in bench:
+            samples.allocations.append(bench["allocs_per_iter"])
+    return res
+
+
+def welch_p_value(baseline, current):
+    """One sided p-value of current being slower than baseline."""
+    n1, n2 = len(baseline.times), len(current.times)
+    if n1 < 2 or n2 < 2:
+        return None
+    se1, se2 = baseline.variance / n1, current.variance / n2
+    if se1 + se2 == 0.0:
+        return 0.0 if current.mean > baseline.mean else 1.0
+    t = (current.mean - baseline.mean) / math.sqrt(se1 + se2)
+    df = (se1 + se2) ** 2 / (se1 ** 2 / (n1 - 1) + se2 ** 2 / (n2 - 1)) if se1 > 0 and se2 > 0 else n1 + n2 - 2
+    return t_survival(t, df)
+
+
+def format_time(ns):
+    for unit, scale in (("s", 1e9), ("ms", 1e6), ("us", 1e3)):
+        if ns >= scale:
+            return f"{ns / scale:.3f}{unit}"
+    return f"{ns:.1f}ns"
+
+
+def compare(args):
+    baseline = load(args.baseline)
+    current = load(args.current)
+    regressions = 0
+    width = max((len(name) for name in current), default=10)
+    print(f"{'benchmark':<{width}} | {'baseline':>20} | {'current':>20} | {'change':>8} | {'p':>7} | allocs/iter")
+    for name, now in current.items():
+        before = baseline.get(name)
+        if before is None:
+            print(f"{name:<{width}} | {'(new)':>20} | {format_time(now.mean):>20} |")
+            continue
+        change = now.mean / before.mean - 1.0 if before.mean > 0 else 0.0
+        p = welch_p_value(before, now)
+        ci_before = before.confidence_interval(args.confidence)
+        ci_now = now.confidence_interval(args.confidence)
+        flags = []
+        if change > args.threshold and p is not None and p < args.alpha:
+            flags.append("SLOWER")
+        elif change < -args.threshold and p is not None and 1.0 - p < args.alpha:
+            flags.append("faster")
+        allocs = ""
+        if before.allocations and now.allocations:
+            allocs_before = statistics.fmean(before.allocations)
+            allocs_now = statistics.fmean(now.allocations)
+            allocs = f"{allocs_before:.1f} -> {allocs_now:.1f}"
+            if allocs_now > allocs_before + 0.5:
+                flags.append("MORE ALLOCATIONS")
+        if any(flag.isupper() for flag in flags):
+            regressions += 1
+        p_text = f"{p:.4f}" if p is not None else "-"
+        print(f"{name:<{width}} | {format_time(before.mean) + ' ±' + format_time(ci_before):>20} | "
+              f"{format_time(now.mean) + ' ±' + format_time(ci_now):>20} | {change:>+8.1%} | {p_text:>7} | "
+              f"{allocs} {' '.join(flags)}")
+    for name in baseline:
+        if name not in current:
+            print(f"{name:<{width}} | missing in the current run")
+    print(f"\n{regressions} regression(s) (threshold {args.threshold:.0%}, alpha {args.alpha}, "
+          f"intervals at {args.confidence:.0%})")
+    return 1 if regressions else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    run_parser = commands.add_parser("run", help="run the benchmarks several times")
+    run_parser.add_argument("--bench", required=True, help="path to benchtubul")
+    run_parser.add_argument("--out", required=True, help="JSON file for the results")
+    run_parser.add_argument("--repetitions", type=int, default=10)
+    run_parser.add_argument("--filter", help="regex of the benchmarks to run")
+    run_parser.set_defaults(function=run)
+
+    compare_parser = commands.add_parser("compare", help="compare a run against a baseline")
+    compare_parser.add_argument("baseline")
+    compare_parser.add_argument("current")
+    compare_parser.add_argument("--threshold", type=float, default=0.05,
+                                help="relative slowdown to report (default 0.05)")
+    compare_parser.add_argument("--alpha", type=float, default=0.01, help="significance level (default 0.01)")
+    compare_parser.add_argument("--confidence", type=float, default=0.95,
+                                help="confidence of the intervals shown (default 0.95)")
+    compare_parser.set_defaults(function=compare)
+
+    args = parser.parse_args()
+    return args.function(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,142 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include <gtest/gtest.h>
+#include "tubul.h"
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+std::vector<std::string> decodedLines(const std::string& path)
+{
+	std::stringstream out;
+	TU::decodeBinaryLog(path, out);
+	std::vector<std::string> lines;
+	std::string line;
+	while (std::getline(out, line))
+		lines.push_back(line);
+	return lines;
+}
+
+bool endsWith(const std::string& text, const std::string& suffix)
+{
+	return text.size() >= suffix.size() and text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+}
+
+TEST(TUBULBinaryLog, testMappedRing) {
+	auto path = (std::filesystem::temp_directory_path() / "tubul_test_ring.bin").string();
+	{
+		TU::MappedRing ring(path, 256);
+		EXPECT_EQ(ring.capacity(), 256);
+		//Records bigger than half the ring are rejected
+		std::vector<std::byte> big(200);
+		EXPECT_FALSE(ring.write(big));
+
+		//Many laps around the ring: only the newest records remain, in order.
+		for (uint32_t i = 0; i < 100; ++i)
+		{
+			std::vector<std::byte> record(1 + i % 13, std::byte(i));
+			EXPECT_TRUE(ring.write(record));
+		}
+		EXPECT_GT(ring.droppedRecords(), 0);
+		std::vector<uint32_t> seen;
+		ring.forEachRecord([&seen](std::span<const std::byte> record) {
+			ASSERT_FALSE(record.empty());
+			const auto value = static_cast<uint32_t>(record[0]);
+			EXPECT_EQ(record.size(), 1 + value % 13);
+			seen.push_back(value);
+		});
+		ASSERT_FALSE(seen.empty());
+		EXPECT_EQ(seen.back(), 99);
+		for (size_t i = 1; i < seen.size(); ++i)
+			EXPECT_EQ(seen[i], seen[i - 1] + 1);
+	}
+
+	//The file can be read again after the writer is gone, but not written.
+	TU::MappedRing reader(path);
+	size_t count = 0;
+	reader.forEachRecord([&count](std::span<const std::byte>) { ++count; });
+	EXPECT_GT(count, 0);
+	EXPECT_THROW(reader.write(std::vector<std::byte>(4)), TU::Exception);
+	std::filesystem::remove(path);
+}
+
+TEST(TUBULBinaryLog, testEncodeDecode) {
+	auto path = (std::filesystem::temp_directory_path() / "tubul_test.binlog").string();
+	TU::openBinaryLog(path, 1 << 16);
+	ASSERT_NE(TU::getBinaryLogger(), nullptr);
+	for (int i = 0; i < 3; ++i)
+		TUBUL_STAT_BINARY("iteration {} cost {:.2f} name {} ok {}", i, 1.5 * i, std::string("node") + std::to_string(i), i % 2 == 0);
+	TUBUL_BINARY_LOG(REPORT, "no arguments, {{braces}} kept");
+	TUBUL_STAT_BINARY("unsigned {:>5} char {} missing {}", 42u, 'x');
+	TU::closeBinaryLog();
+	EXPECT_EQ(TU::getBinaryLogger(), nullptr);
+	//Nothing happens without a log
+	TUBUL_STAT_BINARY("lost {}", 1);
+
+	auto lines = decodedLines(path);
+	ASSERT_EQ(lines.size(), 5);
+	EXPECT_TRUE(endsWith(lines[0], "iteration 0 cost 0.00 name node0 ok true"));
+	EXPECT_TRUE(endsWith(lines[1], "iteration 1 cost 1.50 name node1 ok false"));
+	EXPECT_TRUE(endsWith(lines[2], "iteration 2 cost 3.00 name node2 ok true"));
+	EXPECT_TRUE(endsWith(lines[3], "no arguments, {braces} kept"));
+	EXPECT_TRUE(endsWith(lines[4], "unsigned    42 char x missing {}"));
+
+	EXPECT_THROW(TU::decodeBinaryLog(path + ".missing", std::cout), TU::Exception);
+	std::filesystem::remove(path);
+	std::filesystem::remove(path + ".fmt");
+}
+
+TEST(TUBULBinaryLog, testThreads) {
+	auto path = (std::filesystem::temp_directory_path() / "tubul_test_threads.binlog").string();
+	TU::openBinaryLog(path, 1 << 20);
+	static constexpr int THREADS = 4;
+	static constexpr int MESSAGES = 1000;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < THREADS; ++t)
+		threads.emplace_back([t] {
+			for (int i = 0; i < MESSAGES; ++i)
+				TUBUL_STAT_BINARY("thread {} message {}", t, i);
+		});
+	for (auto& thread: threads)
+		thread.join();
+	TU::closeBinaryLog();
+
+	auto lines = decodedLines(path);
+	EXPECT_EQ(lines.size(), THREADS * MESSAGES);
+	std::filesystem::remove(path);
+	std::filesystem::remove(path + ".fmt");
+}
+
+TEST(TUBULBinaryLog, testSpeed) {
+	//Rough benchmark of a binary stat against a text one. Disabled by default: simply change
+	//the constant to run it.
+	static constexpr bool enabled = false;
+	if (not enabled)
+		return;
+
+	static constexpr int MESSAGES = 1000000;
+	auto dir = std::filesystem::temp_directory_path();
+	TU::openBinaryLog((dir / "tubul_speed.binlog").string());
+	auto start = TU::now();
+	for (int i = 0; i < MESSAGES; ++i)
+		TUBUL_STAT_BINARY("iteration {} cost {}", i, i * 0.5);
+	auto binaryTime = TU::elapsed(start);
+	TU::closeBinaryLog();
+
+	std::ostringstream text;
+	TU::addLoggerDefinition(text, TU::LogLevel::STATS, TU::LogOptions::EXCLUSIVE);
+	start = TU::now();
+	for (int i = 0; i < MESSAGES; ++i)
+		TU::logStat() << "iteration " << i << " cost " << i * 0.5;
+	auto textTime = TU::elapsed(start);
+	TU::clearLoggerDefinitions();
+	std::cout << "binary: " << binaryTime * 1e9 / MESSAGES << "ns/message, text: " << textTime * 1e9 / MESSAGES
+			  << "ns/message" << std::endl;
+}
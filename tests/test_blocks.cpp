@@ -0,0 +1,417 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include <gtest/gtest.h>
+#include "tubul.h"
+#include "json.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <latch>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	double spin(std::chrono::milliseconds cpuTime)
+	{
+		volatile double x = 0;
+		auto start = std::chrono::steady_clock::now();
+		while (std::chrono::steady_clock::now() - start < cpuTime)
+			for (int i = 0; i < 1000; ++i)
+				x = x + i * 0.5;
+		return x;
+	}
+}
+
+TEST(TUBULBlocks, testThreadLocations) {
+	static constexpr int THREADS = 4;
+	static constexpr int ITERATIONS = 200;
+	std::atomic_int wrongLocations = 0;
+	std::latch done(THREADS);
+	std::latch checked(1);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < THREADS; ++t)
+		threads.emplace_back([t, &wrongLocations, &done, &checked] {
+			const std::string outer = "threadBlock" + std::to_string(t);
+			for (int i = 0; i < ITERATIONS; ++i)
+			{
+				TU::Block block(outer, TU::Block::LogType::NONE);
+				TU::Block inner("threadBlockInner", TU::Block::LogType::NONE);
+				//Every thread only sees its own blocks
+				if (TU::getCurrentBlockLocation() != outer + ".threadBlockInner")
+					++wrongLocations;
+			}
+			if (not TU::getCurrentBlockLocation().empty())
+				++wrongLocations;
+			done.count_down();
+			checked.wait();
+		});
+	done.wait();
+	EXPECT_EQ(wrongLocations, 0);
+
+	//While the threads run, each one has its own stats
+	auto byThread = TU::getAccumulatedStatsByThread("threadBlockInner");
+	ASSERT_EQ(byThread.size(), THREADS);
+	std::set<size_t> indices;
+	for (auto const& stats: byThread)
+	{
+		EXPECT_EQ(stats.stats.count_, ITERATIONS);
+		indices.insert(stats.thread);
+	}
+	EXPECT_EQ(indices.size(), THREADS);
+	EXPECT_EQ(indices.count(TU::EXITED_BLOCK_THREADS), 0);
+	EXPECT_EQ(TU::getAccumulatedStatsByThread("threadBlock1").size(), 1);
+	auto threadReport = TU::reportBlocksByThread();
+	EXPECT_NE(threadReport.find("threadBlock3"), std::string::npos);
+
+	checked.count_down();
+	for (auto& thread: threads)
+		thread.join();
+
+	//The stats of finished threads are kept and added up
+	EXPECT_EQ(TU::getAccumulatedStats("threadBlockInner").count_, THREADS * ITERATIONS);
+	EXPECT_EQ(TU::getAccumulatedStats("threadBlock0").count_, ITERATIONS);
+	EXPECT_EQ(TU::getAccumulatedStats("neverOpened").count_, 0);
+	byThread = TU::getAccumulatedStatsByThread("threadBlockInner");
+	ASSERT_EQ(byThread.size(), 1);
+	EXPECT_EQ(byThread[0].thread, TU::EXITED_BLOCK_THREADS);
+	EXPECT_EQ(byThread[0].stats.count_, THREADS * ITERATIONS);
+
+	auto report = TU::reportBlocks();
+	EXPECT_NE(report.find("threadBlockInner"), std::string::npos);
+	threadReport = TU::reportBlocksByThread();
+	EXPECT_NE(threadReport.find("| exited | threadBlock3"), std::string::npos);
+}
+
+TEST(TUBULBlocks, testShortLivedThreads) {
+	//A thread per task: what each thread leaves behind is folded into the exited stats, so
+	//the reports stay the same size however many threads come and go.
+	static constexpr size_t TASKS = 200;
+	const auto before = TU::getAccumulatedStats("shortLivedTask").count_;
+	for (size_t i = 0; i < TASKS; ++i)
+		std::async(std::launch::async, [] {
+			TU::Block block("shortLivedTask", TU::Block::LogType::NONE);
+			TU::Block inner("shortLivedInner", TU::Block::LogType::NONE);
+		}).get();
+
+	EXPECT_EQ(TU::getAccumulatedStats("shortLivedTask").count_, before + TASKS);
+	auto byThread = TU::getAccumulatedStatsByThread("shortLivedInner");
+	ASSERT_EQ(byThread.size(), 1);
+	EXPECT_EQ(byThread[0].thread, TU::EXITED_BLOCK_THREADS);
+	EXPECT_EQ(byThread[0].stats.count_, TASKS);
+}
+
+TEST(TUBULBlocks, testBlocksClosedElsewhere) {
+	//Like a block kept open across a co_await that resumes in another thread: it's not measured,
+	//and both threads keep their right locations.
+	std::unique_ptr<TU::Block> moved;
+	std::thread([&] {
+		std::unique_ptr<TU::Block> closedLast;
+		{
+			TU::Block owner("ownerBlock", TU::Block::LogType::NONE);
+			moved = std::make_unique<TU::Block>("movedBlock", TU::Block::LogType::NONE);
+			closedLast = std::make_unique<TU::Block>("closedLastBlock", TU::Block::LogType::NONE);
+			std::thread([&] {
+				TU::Block other("otherThreadBlock", TU::Block::LogType::NONE);
+				moved.reset();
+				EXPECT_EQ(TU::getCurrentBlockLocation(), "otherThreadBlock");
+			}).join();
+			EXPECT_EQ(TU::getCurrentBlockLocation(), "ownerBlock.movedBlock.closedLastBlock");
+			TU::Block inner("ownerInner", TU::Block::LogType::NONE);
+			EXPECT_EQ(TU::getCurrentBlockLocation(), "ownerBlock.movedBlock.closedLastBlock.ownerInner");
+		}
+		//ownerBlock closed before closedLastBlock, opened inside it, so it was dropped too
+		closedLast.reset();
+		EXPECT_EQ(TU::getCurrentBlockLocation(), "");
+		TU::Block after("afterMovedBlock", TU::Block::LogType::NONE);
+		EXPECT_EQ(TU::getCurrentBlockLocation(), "afterMovedBlock");
+	}).join();
+
+	EXPECT_EQ(TU::getAccumulatedStats("movedBlock").count_, 0);
+	EXPECT_EQ(TU::getAccumulatedStats("ownerBlock").count_, 0);
+	EXPECT_EQ(TU::getAccumulatedStats("closedLastBlock").count_, 1);
+	EXPECT_EQ(TU::getAccumulatedStats("ownerInner").count_, 1);
+	EXPECT_EQ(TU::getAccumulatedStats("otherThreadBlock").count_, 1);
+	EXPECT_EQ(TU::getAccumulatedStats("afterMovedBlock").count_, 1);
+}
+
+TEST(TUBULBlocks, testPoolTasks) {
+	TU::ThreadPool pool(4);
+	static constexpr size_t TASKS = 100;
+	auto before = TU::getAccumulatedStats("poolTaskBlock").count_;
+	std::vector<std::future<size_t>> results;
+	for (size_t i = 0; i < TASKS; ++i)
+		results.push_back(pool.submit([i] {
+			TU::Block block("poolTaskBlock", TU::Block::LogType::NONE);
+			return i;
+		}));
+	for (auto& result: results)
+		result.get();
+	EXPECT_EQ(TU::getAccumulatedStats("poolTaskBlock").count_, before + TASKS);
+}
+
+TEST(TUBULBlocks, testCallTree) {
+	auto work = [] {
+		TU::Block load("treeLoad", TU::Block::LogType::NONE);
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	};
+	{
+		TU::Block main("treeMain", TU::Block::LogType::NONE);
+		{
+			TU::Block parse("treeParse", TU::Block::LogType::NONE);
+			work();
+			std::vector<char> data(100000);
+			EXPECT_EQ(data.size(), 100000);
+		}
+		{
+			TU::Block solve("treeSolve", TU::Block::LogType::NONE);
+			work();
+			work();
+		}
+	}
+
+	auto tree = TU::getBlockTree();
+	auto child = [](const TU::BlockTreeNode& node, const std::string& name) -> const TU::BlockTreeNode* {
+		for (auto const& c: node.children)
+			if (c.name == name)
+				return &c;
+		return nullptr;
+	};
+	auto const* main = child(tree, "treeMain");
+	ASSERT_NE(main, nullptr);
+	EXPECT_EQ(main->count, 1);
+	auto const* parse = child(*main, "treeParse");
+	auto const* solve = child(*main, "treeSolve");
+	ASSERT_NE(parse, nullptr);
+	ASSERT_NE(solve, nullptr);
+	//The same block under two parents is kept apart
+	auto const* parseLoad = child(*parse, "treeLoad");
+	auto const* solveLoad = child(*solve, "treeLoad");
+	ASSERT_NE(parseLoad, nullptr);
+	ASSERT_NE(solveLoad, nullptr);
+	EXPECT_EQ(parseLoad->count, 1);
+	EXPECT_EQ(solveLoad->count, 2);
+	EXPECT_EQ(solveLoad->location, "treeMain.treeSolve.treeLoad");
+	EXPECT_EQ(TU::getAccumulatedStats("treeLoad").count_, 3);
+
+	//Inclusive time contains the children, exclusive doesn't
+	EXPECT_GE(solve->inclusive, solveLoad->inclusive);
+	EXPECT_NEAR(solve->exclusive.count(), (solve->inclusive - solveLoad->inclusive).count(), 1e-9);
+	EXPECT_GE(main->inclusive, parse->inclusive + solve->inclusive);
+	//Slowest first
+	EXPECT_EQ(main->children.front().name, "treeSolve");
+	EXPECT_GE(parse->allocated, 100000);
+
+	auto report = TU::reportBlocks();
+	EXPECT_NE(report.find("\n| treeMain"), std::string::npos);
+	EXPECT_NE(report.find("\n|     treeLoad"), std::string::npos);
+	auto json = TU::reportBlocksJson();
+	EXPECT_NE(json.find("\"location\": \"treeMain.treeSolve.treeLoad\""), std::string::npos);
+}
+
+TEST(TUBULBlocks, testTrace) {
+	auto path = (std::filesystem::temp_directory_path() / "tubul_test_trace.json").string();
+	//Not recorded: tracing is off
+	{
+		TU::Block before("traceBefore", TU::Block::LogType::NONE);
+	}
+	TU::startBlockTrace(path, 5);
+	EXPECT_THROW(TU::startBlockTrace(path, 5), TU::Exception);
+	std::thread worker([] {
+		TU::Block outer("traceWorker", TU::Block::LogType::NONE);
+		TU::Block inner("trace\"Quoted\"", TU::Block::LogType::NONE);
+	});
+	worker.join();
+	for (int i = 0; i < 10; ++i)
+		TU::Block block("traceMain", TU::Block::LogType::NONE);
+	TU::stopBlockTrace();
+	{
+		TU::Block after("traceAfter", TU::Block::LogType::NONE);
+	}
+
+	auto json = nlohmann::json::parse(std::ifstream(path));
+	size_t mainEvents = 0;
+	std::set<std::string> names;
+	std::set<int> threads;
+	for (auto const& event: json["traceEvents"])
+	{
+		if (event["ph"] != "X")
+			continue;
+		names.insert(event["name"].get<std::string>());
+		threads.insert(event["tid"].get<int>());
+		EXPECT_GE(event["dur"].get<double>(), 0);
+		if (event["name"] == "traceMain")
+			++mainEvents;
+	}
+	//The main thread keeps 5 events, and drops the rest
+	EXPECT_EQ(mainEvents, 5);
+	EXPECT_EQ(json["otherData"]["droppedEvents"], 5);
+	EXPECT_EQ(threads.size(), 2);
+	EXPECT_TRUE(names.contains("traceWorker"));
+	EXPECT_TRUE(names.contains("trace\"Quoted\""));
+	EXPECT_FALSE(names.contains("traceBefore"));
+	EXPECT_FALSE(names.contains("traceAfter"));
+	std::filesystem::remove(path);
+}
+
+TEST(TUBULBlocks, testReusedNames) {
+	//The same buffer holding different names must not mix their blocks
+	std::string name;
+	name.reserve(32);
+	for (int i = 0; i < 10; ++i)
+	{
+		name = i % 2 == 0 ? "reusedEven" : "reusedOdd";
+		TU::Block block(name, TU::Block::LogType::NONE);
+		EXPECT_EQ(TU::getCurrentBlockLocation(), name);
+	}
+	EXPECT_EQ(TU::getAccumulatedStats("reusedEven").count_, 5);
+	EXPECT_EQ(TU::getAccumulatedStats("reusedOdd").count_, 5);
+}
+
+TEST(TUBULBlocks, testHistograms) {
+	TU::enableBlockHistograms("histMain.histTimed");
+	{
+		TU::Block main("histMain", TU::Block::LogType::NONE);
+		for (int i = 0; i < 20; ++i)
+		{
+			TU::Block timed("histTimed", TU::Block::LogType::NONE);
+			if (i == 19)
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+		TU::Block untimed("histUntimed", TU::Block::LogType::NONE);
+	}
+
+	auto tree = TU::getBlockTree();
+	auto main = std::find_if(tree.children.begin(), tree.children.end(), [](auto const& n) { return n.name == "histMain"; });
+	ASSERT_NE(main, tree.children.end());
+	EXPECT_FALSE(main->durations.has_value());
+	ASSERT_EQ(main->children.size(), 2);
+	for (auto const& child: main->children)
+	{
+		EXPECT_EQ(child.durations.has_value(), child.name == "histTimed");
+		if (child.durations)
+		{
+			EXPECT_EQ(child.durations->count(), 20);
+			//One slow block doesn't move the median, only the max
+			EXPECT_GE(child.durations->max(), 5000000);
+			EXPECT_LT(child.durations->percentile(0.5), 5000000);
+		}
+	}
+	auto report = TU::reportBlocks();
+	EXPECT_NE(report.find("p99 (us)"), std::string::npos);
+	EXPECT_NE(TU::reportBlocksJson().find("\"p90\""), std::string::npos);
+}
+
+TEST(TUBULBlocks, testCounters) {
+	//Counters may not be available (containers, VMs, perf_event_paranoid), then blocks just
+	//don't have them.
+	const bool available = TU::enableBlockCounters();
+	EXPECT_EQ(available, TU::PerfCounterGroup::supported());
+	{
+		TU::Block block("countedBlock", TU::Block::LogType::NONE);
+		spin(std::chrono::milliseconds(5));
+	}
+	TU::disableBlockCounters();
+	{
+		TU::Block block("uncountedBlock", TU::Block::LogType::NONE);
+	}
+
+	auto tree = TU::getBlockTree();
+	auto find = [&tree](const std::string& name) {
+		return std::find_if(tree.children.begin(), tree.children.end(), [&name](auto const& n) { return n.name == name; });
+	};
+	ASSERT_NE(find("countedBlock"), tree.children.end());
+	ASSERT_NE(find("uncountedBlock"), tree.children.end());
+	EXPECT_FALSE(find("uncountedBlock")->counters.has_value());
+	EXPECT_EQ(find("countedBlock")->counters.has_value(), available);
+	if (available)
+	{
+		auto const& counters = *find("countedBlock")->counters;
+		EXPECT_EQ(counters.calls, 1);
+		EXPECT_GT(counters.instructions, 0);
+		EXPECT_GT(counters.ipc(), 0);
+		EXPECT_NE(TU::reportBlocks().find("IPC"), std::string::npos);
+	}
+}
+
+TEST(TUBULBlocks, testSpeed) {
+	//Rough measure of the cost of a block. Disabled by default: simply change the constant to
+	//run it.
+	static constexpr bool enabled = false;
+	if (not enabled)
+		return;
+
+	static constexpr int BLOCKS = 10000000;
+	TU::Block outer("speedOuter", TU::Block::LogType::NONE);
+	auto start = TU::now();
+	for (int i = 0; i < BLOCKS; ++i)
+		TU::Block block("speedInner", TU::Block::LogType::NONE);
+	auto blockTime = TU::elapsed(start);
+	std::cout << "block: " << blockTime * 1e9 / BLOCKS << "ns/block" << std::endl;
+}
+
+
+#ifndef TUBUL_WINDOWS
+namespace
+{
+	void checkSamplingProfiler(TU::SamplingProfilerOptions options)
+	{
+		TU::startSamplingProfiler(options);
+		EXPECT_THROW(TU::startSamplingProfiler(), TU::Exception);
+		{
+			TU::Block outer("profiledOuter", TU::Block::LogType::NONE);
+			TU::Block inner("profiledInner", TU::Block::LogType::NONE);
+			spin(std::chrono::milliseconds(300));
+		}
+		spin(std::chrono::milliseconds(50));
+		auto samples = TU::stopSamplingProfiler();
+		EXPECT_GT(samples, 0);
+		EXPECT_EQ(TU::droppedProfilerSamples(), 0);
+
+		std::stringstream out;
+		EXPECT_GT(TU::writeCollapsedStacks(out), 0);
+		size_t inBlock = 0;
+		size_t total = 0;
+		std::string line;
+		while (std::getline(out, line))
+		{
+			auto countAt = line.rfind(' ');
+			ASSERT_NE(countAt, std::string::npos);
+			auto count = std::stoul(line.substr(countAt + 1));
+			total += count;
+			if (line.starts_with("[profiledOuter.profiledInner];"))
+				inBlock += count;
+		}
+		EXPECT_EQ(total, samples);
+		//Most of the CPU time was spent in the block
+		EXPECT_GT(inBlock, total / 2);
+	}
+}
+#endif
+
+TEST(TUBULBlocks, testSamplingProfiler) {
+#ifdef TUBUL_WINDOWS
+	EXPECT_THROW(TU::startSamplingProfiler(), TU::Exception);
+#else
+	checkSamplingProfiler({.frequency = 1000, .maxSamples = 100000});
+#endif
+}
+
+TEST(TUBULBlocks, testFramePointerProfiler) {
+#if defined(TUBUL_LINUX) and (defined(__x86_64__) or defined(__aarch64__))
+	//The tests may be built without frame pointers, so the stacks can be short, but the walk
+	//must stop cleanly wherever the chain breaks
+	checkSamplingProfiler({.frequency = 1000, .maxSamples = 100000, .framePointers = true});
+#else
+	EXPECT_THROW(TU::startSamplingProfiler({.framePointers = true}), TU::Exception);
+#endif
+}
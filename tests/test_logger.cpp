@@ -4,6 +4,18 @@
 
 #include "tubul.h"
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iomanip>
+#include <semaphore>
+#include <thread>
+#ifndef TUBUL_WINDOWS
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 TEST(TUBULLogger, testLogError)
 {
@@ -110,3 +122,507 @@ TEST(TUBULLogger, testLogCallback)
 	EXPECT_EQ(ossDevel.str(), msgDevel);
 
 }
+
+TEST(TUBULLogger, testLogThreads)
+{
+    //Two streams (one of them shared by two loggers) and a callback, written from several
+    //threads: every line must arrive whole.
+    std::ostringstream ossAll;
+    std::ostringstream ossReport;
+    size_t callbackLines = 0;
+    TU::clearLoggerDefinitions();
+    TU::addLoggerDefinition(ossAll, TU::LogLevel::INFO, TU::LogOptions::NOTIMESTAMP);
+    TU::addLoggerDefinition(ossAll, TU::LogLevel::REPORT, TU::LogOptions::NOTIMESTAMP | TU::LogOptions::EXCLUSIVE);
+    TU::addLoggerDefinition(ossReport, TU::LogLevel::REPORT, TU::LogOptions::NOTIMESTAMP);
+    TU::addLoggerDefinition([&callbackLines](TU::LogLevel, const std::string&) { ++callbackLines; }, TU::LogLevel::INFO);
+
+    static constexpr int THREADS = 4;
+    static constexpr int MESSAGES = 500;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t)
+        threads.emplace_back([t] {
+            for (int i = 0; i < MESSAGES; ++i) {
+                TU::logInfo() << "info " << t << " " << i;
+                TU::safelogReport("report " + std::to_string(t) + " " + std::to_string(i));
+            }
+        });
+    for (auto& thread: threads)
+        thread.join();
+    TU::clearLoggerDefinitions();
+
+    auto checkLines = [](const std::string& text, size_t expected) {
+        std::istringstream in(text);
+        std::string line;
+        size_t count = 0;
+        while (std::getline(in, line)) {
+            EXPECT_TRUE(line.starts_with("info ") or line.starts_with("report ")) << line;
+            ++count;
+        }
+        EXPECT_EQ(count, expected);
+    };
+    checkLines(ossAll.str(), 3 * THREADS * MESSAGES);
+    checkLines(ossReport.str(), THREADS * MESSAGES);
+    EXPECT_EQ(callbackLines, 2 * THREADS * MESSAGES);
+}
+
+TEST(TUBULLogger, testLogFileBuffering)
+{
+    auto path = (std::filesystem::temp_directory_path() / "tubul_test_buffered.log").string();
+    {
+        TU::FileLogOptions options;
+        options.flushInterval = std::chrono::hours(1);
+        TU::LogFileSink sink(path, options);
+        sink.write("info line\n", TU::LogLevel::INFO);
+        EXPECT_EQ(std::filesystem::file_size(path), 0);
+        EXPECT_EQ(sink.fileSize(), 10);
+        //Errors are written right away, with everything before them
+        sink.write("error line\n", TU::LogLevel::ERROR);
+        EXPECT_EQ(std::filesystem::file_size(path), 21);
+        sink.write("last line\n", TU::LogLevel::INFO);
+    }
+    //The rest is written when the sink goes away
+    EXPECT_EQ(std::filesystem::file_size(path), 31);
+
+    //Through the loggers, flushLog writes the buffer
+    TU::clearLoggerDefinitions();
+    TU::FileLogOptions options;
+    options.flushInterval = std::chrono::hours(1);
+    TU::addLoggerDefinition(path, TU::LogLevel::INFO, options, TU::LogOptions::NOTIMESTAMP);
+    TU::logInfo("buffered");
+    EXPECT_EQ(std::filesystem::file_size(path), 0);
+    TU::flushLog();
+    EXPECT_EQ(std::filesystem::file_size(path), 9);
+
+    //Lines reach the file after flushInterval even if nothing else is logged
+    TU::clearLoggerDefinitions();
+    options.flushInterval = std::chrono::milliseconds(50);
+    TU::addLoggerDefinition(path, TU::LogLevel::INFO, options, TU::LogOptions::NOTIMESTAMP);
+    TU::logInfo("timed");
+    EXPECT_EQ(std::filesystem::file_size(path), 0);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (std::filesystem::file_size(path) == 0 and std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(std::filesystem::file_size(path), 6);
+    TU::clearLoggerDefinitions();
+    std::filesystem::remove(path);
+}
+
+TEST(TUBULLogger, testLogFileRotation)
+{
+    auto dir = std::filesystem::temp_directory_path() / "tubul_test_rotation";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    auto path = (dir / "run.log").string();
+    {
+        TU::FileLogOptions options;
+        options.maxFileSize = 100;
+        options.maxFiles = 2;
+        TU::LogFileSink sink(path, options);
+        //10 bytes per line, 10 lines per file
+        for (int i = 0; i < 45; ++i)
+            sink.write(std::format("line {:04}\n", i), TU::LogLevel::INFO);
+        EXPECT_EQ(sink.fileSize(), 50);
+    }
+    auto readFile = [](const std::filesystem::path& file) {
+        std::ifstream in(file);
+        return std::string(std::istreambuf_iterator<char>(in), {});
+    };
+    EXPECT_TRUE(readFile(path).starts_with("line 0040\n"));
+    EXPECT_TRUE(readFile(path + ".1").starts_with("line 0030\n"));
+    EXPECT_EQ(std::filesystem::file_size(path + ".1"), 100);
+    EXPECT_TRUE(readFile(path + ".2").starts_with("line 0020\n"));
+    EXPECT_FALSE(std::filesystem::exists(path + ".3"));
+
+    if (TU::LogFileSink::compressionSupported())
+    {
+        TU::FileLogOptions options;
+        options.maxFileSize = 100;
+        options.compressRotated = true;
+        {
+            TU::LogFileSink sink(path, options);
+            for (int i = 0; i < 25; ++i)
+                sink.write(std::format("line {:04}\n", i), TU::LogLevel::INFO);
+        }
+        EXPECT_TRUE(std::filesystem::exists(path + ".1.gz"));
+        EXPECT_TRUE(std::filesystem::exists(path + ".2.gz"));
+        EXPECT_FALSE(std::filesystem::exists(path + ".1"));
+    }
+    std::filesystem::remove_all(dir);
+}
+
+TEST(TUBULLogger, testAsyncLog)
+{
+    std::ostringstream oss;
+    TU::clearLoggerDefinitions();
+    TU::addLoggerDefinition(oss, TU::LogLevel::INFO, TU::LogOptions::NOTIMESTAMP);
+    TU::startAsyncLogging();
+    EXPECT_TRUE(TU::getLogEngineInstance().isAsync());
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+        threads.emplace_back([t] {
+            for (int i = 0; i < 1000; ++i)
+                TU::logInfo() << "thread " << t << " message " << i;
+        });
+    for (auto& thread: threads)
+        thread.join();
+    TU::logDevel() << "Not for this logger";
+    TU::flushLog();
+
+    //Every message is written whole, in order for each thread.
+    std::istringstream lines(oss.str());
+    std::string line;
+    std::array<int, 4> next = {};
+    size_t count = 0;
+    while (std::getline(lines, line)) {
+        int t = line[7] - '0';
+        ASSERT_EQ(line, "thread " + std::to_string(t) + " message " + std::to_string(next[t]));
+        ++next[t];
+        ++count;
+    }
+    EXPECT_EQ(count, 4000);
+
+    //Changing the loggers writes whatever was pending to the old ones.
+    TU::logInfo() << "Last one";
+    TU::clearLoggerDefinitions();
+    EXPECT_TRUE(oss.str().ends_with("Last one\n"));
+
+    //Stopping writes everything too.
+    std::ostringstream other;
+    TU::addLoggerDefinition(other, TU::LogLevel::INFO, TU::LogOptions::NOTIMESTAMP);
+    TU::logWarning() << "Before stop";
+    TU::stopAsyncLogging();
+    EXPECT_FALSE(TU::getLogEngineInstance().isAsync());
+    EXPECT_EQ(other.str(), "Before stop\n");
+    TU::clearLoggerDefinitions();
+}
+
+TEST(TUBULLogger, testAsyncLogDrop)
+{
+    //A callback that blocks the writer thread lets us fill the queue on purpose.
+    std::binary_semaphore release(0);
+    std::vector<std::string> received;
+    TU::clearLoggerDefinitions();
+    TU::addLoggerDefinition([&](TU::LogLevel, const std::string& msg) {
+        if (msg == "block")
+            release.acquire();
+        received.push_back(msg);
+    }, TU::LogLevel::INFO, TU::LogOptions::NOTIMESTAMP);
+
+    TU::AsyncLogOptions options;
+    options.queueCapacity = 4;
+    options.maxBatch = 1;
+    options.overflow = TU::LogOverflowPolicy::DROP;
+    TU::startAsyncLogging(options);
+    TU::logInfo("block");
+    //Whether or not the writer already took the first message, the queue can't take all of these.
+    for (int i = 0; i < 20; ++i)
+        TU::logInfo("extra");
+    EXPECT_GE(TU::getLogEngineInstance().droppedMessages(), 15);
+    release.release();
+    TU::flushLog();
+
+    ASSERT_FALSE(received.empty());
+    EXPECT_EQ(received.front(), "block");
+    EXPECT_EQ(received.size() + TU::getLogEngineInstance().droppedMessages(), 22);
+    auto warning = "WARNING: " + std::to_string(TU::getLogEngineInstance().droppedMessages()) +
+                   " log messages were dropped (async log queue full)";
+    EXPECT_NE(std::find(received.begin(), received.end(), warning), received.end());
+    TU::stopAsyncLogging();
+    TU::clearLoggerDefinitions();
+}
+
+TEST(TUBULLogger, testAsyncLogFromCallback)
+{
+    //The writer thread runs the callback: logging and flushing from there must not wait for it,
+    //even with the BLOCK policy and a queue that is always full.
+    static constexpr int MESSAGES = 50;
+    std::vector<std::string> received;
+    bool addThrew = false;
+    TU::clearLoggerDefinitions();
+    TU::addLoggerDefinition([&](TU::LogLevel, const std::string& msg) {
+        received.push_back(msg);
+        if (not msg.starts_with("request"))
+            return;
+        TU::logInfo("reply");
+        TU::flushLog();
+        try {
+            TU::addLoggerDefinition([](TU::LogLevel, const std::string&) {}, TU::LogLevel::INFO);
+        } catch (TU::Exception&) {
+            addThrew = true;
+        }
+    }, TU::LogLevel::INFO, TU::LogOptions::NOTIMESTAMP);
+
+    TU::AsyncLogOptions options;
+    options.queueCapacity = 2;
+    options.maxBatch = 1;
+    options.overflow = TU::LogOverflowPolicy::BLOCK;
+    TU::startAsyncLogging(options);
+    for (int i = 0; i < MESSAGES; ++i)
+        TU::logInfo("request");
+    TU::flushLog();
+    const auto dropped = static_cast<long>(TU::getLogEngineInstance().droppedMessages());
+    TU::stopAsyncLogging();
+
+    auto count = [&](const std::string& text) { return std::ranges::count(received, text); };
+    //The requests are never dropped: they come from another thread.
+    EXPECT_EQ(count("request"), MESSAGES);
+    EXPECT_EQ(count("reply") + dropped, MESSAGES);
+    EXPECT_TRUE(addThrew);
+    TU::clearLoggerDefinitions();
+}
+
+TEST(TUBULLogger, testTimestampCache)
+{
+    //The cached formatter must match a full formatting for every second, also when crossing
+    //minutes, hours and days.
+    using namespace std::chrono;
+    auto reference = [](system_clock::time_point time) {
+        auto t = system_clock::to_time_t(floor<seconds>(time));
+        std::tm buf;
+#ifdef TUBUL_WINDOWS
+        localtime_s(&buf, &t);
+#else
+        localtime_r(&t, &buf);
+#endif
+        std::ostringstream oss;
+        oss << std::put_time(&buf, "%Y-%m-%d %H:%M:%S - ");
+        return oss.str();
+    };
+    auto start = floor<days>(system_clock::now()) - seconds(150);
+    for (int i = 0; i < 300; ++i) {
+        auto time = start + seconds(i) + milliseconds(i % 1000);
+        auto expected = reference(time);
+        ASSERT_EQ(TU::formatLogTimestamp(time), expected);
+        auto millis = std::string(TU::formatLogTimestamp(time, true));
+        auto ms = std::to_string(1000 + i % 1000).substr(1);
+        ASSERT_EQ(millis, expected.substr(0, 19) + "." + ms + " - ");
+    }
+    //Going back in time works too
+    ASSERT_EQ(TU::formatLogTimestamp(start), reference(start));
+
+    std::ostringstream oss;
+    TU::clearLoggerDefinitions();
+    TU::addLoggerDefinition(oss, TU::LogLevel::INFO, TU::LogOptions::MILLISECONDS);
+    TU::logInfo() << "With millis";
+    EXPECT_EQ(oss.str().size(), 26 + 12);
+    EXPECT_EQ(oss.str()[19], '.');
+    EXPECT_EQ(oss.str().substr(26), "With millis\n");
+    TU::clearLoggerDefinitions();
+}
+
+namespace
+{
+struct FormatSpy
+{
+    bool* called;
+};
+
+std::ostream& operator<<(std::ostream& out, const FormatSpy& spy)
+{
+    *spy.called = true;
+    return out << "spy";
+}
+}
+
+TEST(TUBULLogger, testLogStreamFormatting)
+{
+    std::ostringstream oss;
+    TU::clearLoggerDefinitions();
+    TU::addLoggerDefinition(oss, TU::LogLevel::INFO, TU::LogOptions::NOTIMESTAMP);
+
+    //Numbers look the same as with a default ostream
+    std::ostringstream expected;
+    const double values[] = {0.1, 1.0 / 3.0, 1e20, 123456789.0, -0.0, 2.5e-7};
+    for (auto v: values) {
+        TU::logInfo() << v << ' ' << static_cast<float>(v);
+        expected << v << ' ' << static_cast<float>(v) << '\n';
+    }
+    TU::logInfo() << -42 << " " << 42u << " " << int64_t{-9000000000} << " " << true << " " << 'x';
+    expected << -42 << " " << 42u << " " << int64_t{-9000000000} << " " << true << " " << 'x' << '\n';
+    std::string text = "string";
+    std::string_view view = "view";
+    TU::logInfo() << text << view << "literal" << std::filesystem::path("a/b");
+    expected << text << view << "literal" << std::filesystem::path("a/b") << '\n';
+    TU::logInfo() << 255 << std::hex << " " << 255;
+    expected << 255 << " ff\n";
+    EXPECT_EQ(oss.str(), expected.str());
+
+    //Manipulators with arguments apply to what follows them too
+    oss.str("");
+    TU::logInfo() << "pi " << std::setprecision(3) << 3.14159 << " " << 2.0 / 3.0;
+    TU::logInfo() << "[" << std::setw(5) << 42 << "][" << std::setfill('0') << std::setw(4) << 7 << "]";
+    EXPECT_EQ(oss.str(), "pi 3.14 0.667\n[   42][0007]\n");
+
+    //Long messages move to the heap
+    oss.str("");
+    std::string longText(1000, 'a');
+    TU::logInfo() << "start " << longText << " end " << 7;
+    EXPECT_EQ(oss.str(), "start " + longText + " end 7\n");
+
+    //Filtered levels don't format at all
+    oss.str("");
+    bool called = false;
+    TU::logDevel() << FormatSpy{&called};
+    EXPECT_FALSE(called);
+    TU::logInfo() << FormatSpy{&called};
+    EXPECT_TRUE(called);
+    EXPECT_EQ(oss.str(), "spy\n");
+    EXPECT_TRUE(TU::getLogEngineInstance().accepts(TU::LogLevel::WARNING));
+    EXPECT_FALSE(TU::getLogEngineInstance().accepts(TU::LogLevel::DEVEL));
+
+    TU::clearLoggerDefinitions();
+    TU::addLoggerDefinition(oss, TU::LogLevel::DEVEL, TU::LogOptions::EXCLUSIVE);
+    EXPECT_FALSE(TU::getLogEngineInstance().accepts(TU::LogLevel::WARNING));
+    EXPECT_TRUE(TU::getLogEngineInstance().accepts(TU::LogLevel::DEVEL));
+    TU::clearLoggerDefinitions();
+    EXPECT_FALSE(TU::getLogEngineInstance().accepts(TU::LogLevel::ERROR));
+}
+
+TEST(TUBULLogger, testLazyLog)
+{
+    std::ostringstream oss;
+    TU::clearLoggerDefinitions();
+    TU::addLoggerDefinition(oss, TU::LogLevel::INFO, TU::LogOptions::NOTIMESTAMP);
+
+    int built = 0;
+    auto message = [&built] { ++built; return std::string("expensive"); };
+    TU::logDevel(message);
+    TUBUL_LOG(DEVEL) << "never " << message();
+    EXPECT_EQ(built, 0);
+    EXPECT_FALSE(TU::logEnabled(TU::LogLevel::DEVEL));
+
+    TU::logInfo(message);
+    TUBUL_LOG(WARNING) << "stream " << message();
+    EXPECT_EQ(built, 2);
+    EXPECT_EQ(oss.str(), "expensive\nstream expensive\n");
+
+    //The macro behaves as a single statement
+    oss.str("");
+    if (built == 0)
+        TUBUL_LOG(INFO) << "wrong branch";
+    else
+        TU::logInfo() << "right branch";
+    EXPECT_EQ(oss.str(), "right branch\n");
+
+    static_assert(TU::logCompiledIn(TU::LogLevel::ERROR));
+    TU::clearLoggerDefinitions();
+}
+
+TEST(TUBULLogger, testRateLimitedLog)
+{
+    std::ostringstream oss;
+    TU::clearLoggerDefinitions();
+    TU::addLoggerDefinition(oss, TU::LogLevel::INFO, TU::LogOptions::NOTIMESTAMP);
+
+    auto countLines = [&oss]() {
+        return static_cast<size_t>(std::count(oss.view().begin(), oss.view().end(), '\n'));
+    };
+    for (int i = 0; i < 1000; ++i)
+        TUBUL_LOG_RATE_LIMITED(WARNING, 3, std::chrono::milliseconds(50)) << "Too many " << i;
+    EXPECT_EQ(oss.str(), "Too many 0\nToo many 1\nToo many 2\n");
+
+    //After the period, the next one goes through with the count of the suppressed ones
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    auto logRepeated = [](int i) { TUBUL_LOG_RATE_LIMITED(WARNING, 3, std::chrono::milliseconds(50)) << "Repeated " << i; };
+    for (int i = 0; i < 10; ++i)
+        logRepeated(i);
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    logRepeated(10);
+    EXPECT_EQ(countLines(), 7);
+    EXPECT_TRUE(oss.str().ends_with("Repeated 10 (7 similar messages suppressed)\n"));
+
+    //Disabled levels don't count
+    for (int i = 0; i < 5; ++i)
+        TUBUL_LOG_RATE_LIMITED(DEVEL, 1, std::chrono::hours(1)) << "hidden";
+    EXPECT_EQ(countLines(), 7);
+
+    oss.str("");
+    for (int i = 0; i < 5; ++i) {
+        TUBUL_LOG_ONCE(INFO) << "Once " << i;
+        TU::logOnce(TU::LogLevel::INFO, "Function once " + std::to_string(i));
+    }
+    EXPECT_EQ(oss.str(), "Once 0\nFunction once 0\n");
+    TU::clearLoggerDefinitions();
+}
+
+TEST(TUBULLogger, testBlockFilter)
+{
+    EXPECT_TRUE(TU::matchesBlockPattern("main.loadData.*", "main.loadData.read"));
+    EXPECT_TRUE(TU::matchesBlockPattern("main.loadData.*", "main.loadData.read.parse"));
+    EXPECT_FALSE(TU::matchesBlockPattern("main.loadData.*", "main.loadData"));
+    EXPECT_TRUE(TU::matchesBlockPattern("main.solve,main.loadData*", "main.loadData"));
+    EXPECT_TRUE(TU::matchesBlockPattern("*.s?lve", "main.solve"));
+    EXPECT_FALSE(TU::matchesBlockPattern("main", "main.solve"));
+
+    std::ostringstream all;
+    std::ostringstream loading;
+    TU::clearLoggerDefinitions();
+    TU::addLoggerDefinition(all, TU::LogLevel::INFO, TU::LogOptions::NOTIMESTAMP);
+    auto logger = TU::addLoggerDefinition(loading, TU::LogLevel::INFO, TU::LogOptions::NOTIMESTAMP);
+    TU::setLoggerBlockFilter(logger, "testMain.loadData*");
+
+    auto logInBlocks = [] {
+        TU::Block main("testMain", TU::Block::LogType::NONE);
+        TU::logInfo("in main");
+        {
+            TU::Block load("loadData", TU::Block::LogType::NONE);
+            TU::logInfo("loading");
+            TU::Block read("read", TU::Block::LogType::NONE);
+            TU::logInfo("reading");
+        }
+        TU::Block solve("solve", TU::Block::LogType::NONE);
+        TU::logInfo("solving");
+    };
+    logInBlocks();
+    TU::logInfo("outside");
+    EXPECT_EQ(all.str(), "in main\nloading\nreading\nsolving\noutside\n");
+    EXPECT_EQ(loading.str(), "loading\nreading\n");
+
+    //Async messages are filtered by the block where they were logged
+    TU::startAsyncLogging();
+    logInBlocks();
+    TU::stopAsyncLogging();
+    EXPECT_EQ(loading.str(), "loading\nreading\nloading\nreading\n");
+
+    TU::setLoggerBlockFilter(logger, "");
+    TU::logInfo("no filter");
+    EXPECT_TRUE(loading.str().ends_with("no filter\n"));
+    EXPECT_THROW(TU::setLoggerBlockFilter(10, "*"), TU::Exception);
+    TU::clearLoggerDefinitions();
+}
+
+TEST(TUBULLogger, testLogRing)
+{
+    auto path = (std::filesystem::temp_directory_path() / "tubul_test_log.ring").string();
+    TU::RingLogOptions ringOptions;
+    ringOptions.capacity = 4096;
+#ifndef TUBUL_WINDOWS
+    //The child dies without running any destructor or flushing anything, like in a crash.
+    auto child = fork();
+    ASSERT_NE(child, -1);
+    if (child == 0) {
+        TU::clearLoggerDefinitions();
+        TU::addLoggerDefinition(path, TU::LogLevel::INFO, ringOptions, TU::LogOptions::NOTIMESTAMP);
+        for (int i = 0; i < 1000; ++i)
+            TU::logInfo() << "line " << i;
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+#else
+    TU::clearLoggerDefinitions();
+    TU::addLoggerDefinition(path, TU::LogLevel::INFO, ringOptions, TU::LogOptions::NOTIMESTAMP);
+    for (int i = 0; i < 1000; ++i)
+        TU::logInfo() << "line " << i;
+    TU::clearLoggerDefinitions();
+#endif
+    std::ostringstream out;
+    auto lines = TU::dumpLogRing(path, out);
+    //Only the latest lines fit, in order, ending with the last one.
+    EXPECT_GT(lines, 100);
+    EXPECT_LT(lines, 1000);
+    EXPECT_TRUE(out.str().starts_with("line " + std::to_string(1000 - lines) + "\n"));
+    EXPECT_TRUE(out.str().ends_with("line 998\nline 999\n"));
+    std::filesystem::remove(path);
+}
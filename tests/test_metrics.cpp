@@ -0,0 +1,105 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include <gtest/gtest.h>
+#include "tubul.h"
+#include <chrono>
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(TUBULMetrics, testCountersFromThreads) {
+	static constexpr int THREADS = 8;
+	static constexpr int ITERATIONS = 100000;
+	TU::MetricsRegistry registry;
+	auto& rows = registry.counter("rows_parsed_total", "Rows parsed");
+	auto& active = registry.gauge("active_parsers");
+	std::vector<std::thread> threads;
+	for (int t = 0; t < THREADS; ++t)
+		threads.emplace_back([&] {
+			active.add(1);
+			for (int i = 0; i < ITERATIONS; ++i)
+				rows.add();
+			active.add(-1);
+		});
+	for (auto& t: threads)
+		t.join();
+
+	EXPECT_EQ(rows.value(), uint64_t{THREADS} * ITERATIONS);
+	EXPECT_EQ(active.value(), 0.0);
+	//Same name, same metric
+	EXPECT_EQ(&registry.counter("rows_parsed_total"), &rows);
+}
+
+TEST(TUBULMetrics, testWrongMetrics) {
+	TU::MetricsRegistry registry;
+	registry.counter("nodes_visited");
+	EXPECT_THROW(registry.gauge("nodes_visited"), TU::Exception);
+	EXPECT_THROW(registry.counter("nodes visited"), TU::Exception);
+	EXPECT_THROW(registry.counter("2nodes"), TU::Exception);
+	EXPECT_THROW(registry.histogram(""), TU::Exception);
+}
+
+TEST(TUBULMetrics, testFormats) {
+	TU::MetricsRegistry registry;
+	registry.counter("nodes_visited_total", "Nodes visited\nby the search").add(42);
+	registry.gauge("queue_length").set(2.5);
+	auto& latency = registry.histogram("latency_ns");
+	for (uint64_t v = 1; v <= 100; ++v)
+		latency.record(v);
+
+	std::ostringstream prometheus;
+	registry.writePrometheus(prometheus);
+	const auto text = prometheus.str();
+	EXPECT_NE(text.find("# HELP nodes_visited_total Nodes visited\\nby the search\n"), std::string::npos);
+	EXPECT_NE(text.find("# TYPE nodes_visited_total counter\nnodes_visited_total 42\n"), std::string::npos);
+	EXPECT_NE(text.find("# TYPE queue_length gauge\nqueue_length 2.5\n"), std::string::npos);
+	EXPECT_NE(text.find("# TYPE latency_ns summary\n"), std::string::npos);
+	EXPECT_NE(text.find("latency_ns{quantile=\"0.5\"} "), std::string::npos);
+	EXPECT_NE(text.find("latency_ns_sum 5050\nlatency_ns_count 100\n"), std::string::npos);
+
+	std::ostringstream csv;
+	registry.writeCsv(csv);
+	const auto csvText = csv.str();
+	const auto lines = TU::split(csvText, "\n");
+	//Eight lines and the empty token after the last newline
+	ASSERT_EQ(lines.size(), 9u);
+	EXPECT_EQ(lines[0], "timestamp_ms,name,value");
+	EXPECT_TRUE(lines[1].ends_with(",latency_ns_count,100"));
+	EXPECT_TRUE(lines[2].ends_with(",latency_ns_sum,5050"));
+	EXPECT_NE(lines[3].find(",latency_ns_p50,"), std::string::npos);
+	EXPECT_TRUE(lines[6].ends_with(",nodes_visited_total,42"));
+	EXPECT_TRUE(lines[7].ends_with(",queue_length,2.5"));
+}
+
+TEST(TUBULMetrics, testReporter) {
+	using namespace std::chrono_literals;
+	const auto dir = std::filesystem::temp_directory_path();
+	const auto prometheusFile = (dir / "tubul_test_metrics.prom").string();
+	const auto csvFile = (dir / "tubul_test_metrics.csv").string();
+	std::filesystem::remove(prometheusFile);
+	std::filesystem::remove(csvFile);
+
+	TU::MetricsRegistry registry;
+	auto& counter = registry.counter("reported_total");
+	{
+		TU::MetricsReporter prometheus(prometheusFile, TU::MetricsFormat::PROMETHEUS, 10ms, registry);
+		TU::MetricsReporter csv(csvFile, TU::MetricsFormat::CSV, 10ms, registry);
+		counter.add(3);
+		std::this_thread::sleep_for(50ms);
+		counter.add(4);
+	}
+
+	//The last dump happens when the reporter is destroyed
+	EXPECT_NE(TU::readToString(prometheusFile).find("reported_total 7\n"), std::string::npos);
+	const auto csv = TU::readToString(csvFile);
+	EXPECT_TRUE(csv.starts_with("timestamp_ms,name,value\n"));
+	EXPECT_EQ(csv.find("timestamp_ms", 1), std::string::npos);
+	EXPECT_TRUE(csv.ends_with(",reported_total,7\n"));
+	EXPECT_FALSE(std::filesystem::exists(prometheusFile + ".tmp"));
+	std::filesystem::remove(prometheusFile);
+	std::filesystem::remove(csvFile);
+}
@@ -0,0 +1,113 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include <gtest/gtest.h>
+#include "tubul.h"
+#include <memory>
+#include <numeric>
+#include <string>
+#include <thread>
+
+TEST(TUBULMPMCQueue, testBasic) {
+    TU::MPMCQueue<int> queue(5);
+    EXPECT_EQ(queue.capacity(), 8);
+    EXPECT_TRUE(queue.emptyApprox());
+
+    int value = 0;
+    EXPECT_FALSE(queue.tryPop(value));
+    for (int i = 0; i < 8; ++i)
+        EXPECT_TRUE(queue.tryPush(i));
+    EXPECT_EQ(queue.sizeApprox(), 8);
+    EXPECT_FALSE(queue.tryPush(8));
+
+    for (int i = 0; i < 8; ++i) {
+        ASSERT_TRUE(queue.tryPop(value));
+        EXPECT_EQ(value, i);
+    }
+    EXPECT_FALSE(queue.tryPop(value));
+    EXPECT_TRUE(queue.emptyApprox());
+}
+
+TEST(TUBULMPMCQueue, testWrapAround) {
+    TU::MPMCQueue<std::string> queue(4);
+    std::string value;
+    //Many laps around the ring, keeping it half full.
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_TRUE(queue.tryEmplace(std::to_string(i)));
+        EXPECT_TRUE(queue.tryPush(std::to_string(i) + "b"));
+        ASSERT_TRUE(queue.tryPop(value));
+        EXPECT_EQ(value, std::to_string(i));
+        ASSERT_TRUE(queue.tryPop(value));
+        EXPECT_EQ(value, std::to_string(i) + "b");
+    }
+
+    //A failed push leaves the value alone.
+    auto item = std::make_unique<int>(3);
+    TU::MPMCQueue<std::unique_ptr<int>> full(2);
+    EXPECT_TRUE(full.tryPush(std::make_unique<int>(1)));
+    EXPECT_TRUE(full.tryPush(std::make_unique<int>(2)));
+    EXPECT_FALSE(full.tryPush(std::move(item)));
+    ASSERT_TRUE(item);
+    EXPECT_EQ(*full.pop(), 1);
+    //The remaining element is released by the queue's destructor.
+}
+
+TEST(TUBULMPMCQueue, testProducersConsumers) {
+    //Small capacity so the blocking paths on both sides get exercised.
+    TU::MPMCQueue<size_t> queue(16);
+    static constexpr size_t PRODUCERS = 4;
+    static constexpr size_t CONSUMERS = 3;
+    static constexpr size_t ITEMS = 20000;
+
+    std::atomic<size_t> sum = 0;
+    std::atomic<size_t> received = 0;
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < PRODUCERS; ++p) {
+        threads.emplace_back([&queue, p] {
+            for (size_t i = 0; i < ITEMS; ++i)
+                queue.push(p * ITEMS + i + 1);
+        });
+    }
+    for (size_t c = 0; c < CONSUMERS; ++c) {
+        threads.emplace_back([&] {
+            //A zero marks the end of the stream.
+            for (;;) {
+                auto value = queue.pop();
+                if (value == 0)
+                    return;
+                sum += value;
+                ++received;
+            }
+        });
+    }
+    for (size_t p = 0; p < PRODUCERS; ++p)
+        threads[p].join();
+    for (size_t c = 0; c < CONSUMERS; ++c)
+        queue.push(0);
+    for (size_t c = 0; c < CONSUMERS; ++c)
+        threads[PRODUCERS + c].join();
+
+    const size_t total = PRODUCERS * ITEMS;
+    EXPECT_EQ(received.load(), total);
+    EXPECT_EQ(sum.load(), total * (total + 1) / 2);
+    EXPECT_TRUE(queue.emptyApprox());
+}
+
+TEST(TUBULMPMCQueue, testPoolOverflow) {
+    //Pushing way more tasks than the ring holds must not block, even from inside a task.
+    TU::ThreadPoolConfig config;
+    config.threadCount = 2;
+    config.queueCapacity = 4;
+    TU::ThreadPool pool(config);
+    std::atomic<size_t> counter = 0;
+    for (int i = 0; i < 100; ++i) {
+        pool.pushTask([&pool, &counter] {
+            for (int j = 0; j < 10; ++j)
+                pool.pushTask([&counter] { ++counter; });
+            ++counter;
+        });
+    }
+    pool.waitForTasks();
+    EXPECT_EQ(counter.load(), 1100);
+}
@@ -0,0 +1,195 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include <gtest/gtest.h>
+#include "tubul.h"
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+template <typename T>
+std::vector<T> randomValues(size_t count, T low, T high, unsigned seed = 42)
+{
+	std::mt19937_64 gen(seed);
+	std::vector<T> res(count);
+	if constexpr (std::is_floating_point_v<T>)
+	{
+		std::uniform_real_distribution<T> dist(low, high);
+		for (auto& v: res)
+			v = dist(gen);
+	}
+	else
+	{
+		std::uniform_int_distribution<T> dist(low, high);
+		for (auto& v: res)
+			v = dist(gen);
+	}
+	return res;
+}
+}
+
+TEST(TUBULSort, testRadixIntegers) {
+	auto values = randomValues<int64_t>(100000, std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+	auto expected = values;
+	std::sort(expected.begin(), expected.end());
+	TU::radixSort(values);
+	EXPECT_EQ(values, expected);
+
+	//Small keys in a wide type skip most passes, and must still sort correctly.
+	auto small = randomValues<uint32_t>(5000, 0, 1000);
+	auto expectedSmall = small;
+	std::sort(expectedSmall.begin(), expectedSmall.end());
+	TU::radixSort(small.begin(), small.end());
+	EXPECT_EQ(small, expectedSmall);
+
+	//Below the minimum size it falls back to a comparison sort.
+	std::vector<int8_t> tiny = {5, -3, 127, -128, 0, 2};
+	TU::radixSort(tiny);
+	EXPECT_EQ(tiny, (std::vector<int8_t>{-128, -3, 0, 2, 5, 127}));
+}
+
+TEST(TUBULSort, testRadixFloats) {
+	auto values = randomValues<double>(20000, -1e6, 1e6);
+	values.push_back(0.0);
+	values.push_back(std::numeric_limits<double>::infinity());
+	values.push_back(-std::numeric_limits<double>::infinity());
+	auto expected = values;
+	std::sort(expected.begin(), expected.end());
+	TU::radixSort(values);
+	EXPECT_EQ(values, expected);
+
+	auto floats = randomValues<float>(3000, -10.0f, 10.0f);
+	auto expectedFloats = floats;
+	std::sort(expectedFloats.begin(), expectedFloats.end());
+	TU::PODVector<float> pod;
+	for (auto f: floats)
+		pod.push_back(f);
+	TU::radixSort(pod);
+	EXPECT_TRUE(std::equal(pod.begin(), pod.end(), expectedFloats.begin(), expectedFloats.end()));
+}
+
+TEST(TUBULSort, testRadixPairs) {
+	//Radix sort is stable: pairs with the same key keep their original order.
+	auto keys = randomValues<int32_t>(10000, -50, 50);
+	std::vector<std::pair<int32_t, size_t>> pairs;
+	for (size_t i = 0; i < keys.size(); ++i)
+		pairs.emplace_back(keys[i], i);
+	auto expected = pairs;
+	std::stable_sort(expected.begin(), expected.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+	TU::radixSort(pairs);
+	EXPECT_EQ(pairs, expected);
+
+	//Any struct can be sorted giving the key.
+	struct Edge
+	{
+		uint32_t from;
+		uint32_t to;
+	};
+	std::vector<Edge> edges;
+	for (uint32_t i = 0; i < 1000; ++i)
+		edges.push_back({(i * 7919) % 1000, i});
+	TU::radixSortBy(edges, [](const Edge& e) { return e.from; });
+	for (uint32_t i = 0; i < edges.size(); ++i)
+		EXPECT_EQ(edges[i].from, i);
+}
+
+TEST(TUBULSort, testParallelSort) {
+	TU::ThreadPool pool(4);
+	auto values = randomValues<int>(200000, -1000000, 1000000);
+	auto expected = values;
+	std::sort(expected.begin(), expected.end());
+	TU::parallelSort(pool, values);
+	EXPECT_EQ(values, expected);
+
+	//Custom comparison, on a PODVector
+	TU::PODVector<int> pod;
+	for (auto v: expected)
+		pod.push_back(v);
+	std::shuffle(pod.begin(), pod.end(), std::mt19937(7));
+	TU::parallelSort(pool, pod, std::greater<>());
+	EXPECT_TRUE(std::equal(pod.begin(), pod.end(), expected.rbegin(), expected.rend()));
+
+	//Types that are not trivial to copy, and sizes that don't split evenly
+	std::vector<std::string> words;
+	for (auto v: randomValues<int>(30001, 0, 1000000, 3))
+		words.push_back("w" + std::to_string(v));
+	auto expectedWords = words;
+	std::sort(expectedWords.begin(), expectedWords.end());
+	TU::parallelSort(pool, words.begin(), words.end());
+	EXPECT_EQ(words, expectedWords);
+
+	//Small inputs are just sorted in the calling thread
+	std::vector<int> few = {3, 1, 2};
+	TU::parallelSort(pool, few);
+	EXPECT_EQ(few, (std::vector<int>{1, 2, 3}));
+}
+
+TEST(TUBULSort, testParallelSortInsideTask) {
+	//Every worker sorts from inside a task. With the workers busy, each one has to do the
+	//work by itself instead of waiting forever for the others.
+	TU::ThreadPool pool(2);
+	std::vector<std::vector<int>> inputs;
+	for (unsigned i = 0; i < 4; ++i)
+		inputs.push_back(randomValues<int>(50000, 0, 1000000, i));
+	for (auto& input: inputs)
+		pool.pushTask([&pool, &input] { TU::parallelSort(pool, input); });
+	pool.waitForTasks();
+	for (const auto& input: inputs)
+		EXPECT_TRUE(std::is_sorted(input.begin(), input.end()));
+}
+
+TEST(TUBULSort, testFlatContainersBulk) {
+	auto keys = randomValues<int>(10000, -5000, 5000);
+	std::vector<std::pair<int, int>> pairs;
+	for (auto k: keys)
+		pairs.emplace_back(k, k * 2);
+
+	TU::FlatMap<int, int> map(pairs.begin(), pairs.end());
+	EXPECT_EQ(map.size(), pairs.size());
+	EXPECT_TRUE(std::is_sorted(map.begin(), map.end()));
+	EXPECT_EQ(map.find(keys[10])->second, keys[10] * 2);
+
+	TU::FlatSet<int> set(keys.begin(), keys.end());
+	auto unique = keys;
+	std::sort(unique.begin(), unique.end());
+	unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+	EXPECT_TRUE(std::equal(set.begin(), set.end(), unique.begin(), unique.end()));
+
+	//A custom comparison still uses it
+	TU::FlatSet<int, std::greater<int>> reversed(keys.begin(), keys.end());
+	EXPECT_TRUE(std::equal(reversed.begin(), reversed.end(), unique.rbegin(), unique.rend()));
+
+	TU::ThreadPool pool(2);
+	TU::FlatSet<int> parallelSet(pool, keys.begin(), keys.end());
+	EXPECT_TRUE(std::equal(parallelSet.begin(), parallelSet.end(), unique.begin(), unique.end()));
+	TU::FlatMap<int, int> parallelMap(pool, pairs.begin(), pairs.end());
+	EXPECT_EQ(parallelMap.size(), pairs.size());
+	EXPECT_TRUE(std::is_sorted(parallelMap.begin(), parallelMap.end()));
+}
+
+TEST(TUBULSort, testSortSpeed) {
+	//Rough benchmark of std::sort against radixSort and parallelSort. Disabled by default:
+	//simply change the constant to run it.
+	static constexpr bool enabled = false;
+	if (not enabled)
+		return;
+
+	TU::ThreadPool pool;
+	auto values = randomValues<uint64_t>(10000000, 0, std::numeric_limits<uint64_t>::max());
+	auto run = [&values](auto&& sorter) {
+		auto copy = values;
+		auto start = TU::now();
+		sorter(copy);
+		return TU::elapsed(start);
+	};
+	auto stdTime = run([](auto& v) { std::sort(v.begin(), v.end()); });
+	auto radixTime = run([](auto& v) { TU::radixSort(v); });
+	auto parallelTime = run([&pool](auto& v) { TU::parallelSort(pool, v); });
+	std::cout << "std::sort: " << stdTime << "s, radixSort: " << radixTime << "s, parallelSort (" << pool.threadCount()
+			  << " threads): " << parallelTime << "s" << std::endl;
+}
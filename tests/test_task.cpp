@@ -0,0 +1,117 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include <gtest/gtest.h>
+#include "tubul.h"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+TU::Task<int> answer()
+{
+	co_return 42;
+}
+
+TU::Task<int> addToAnswer(int x)
+{
+	auto a = co_await answer();
+	co_return a + x;
+}
+
+TU::Task<std::thread::id> idOnPool(TU::ThreadPool& pool)
+{
+	co_await pool.schedule();
+	co_return std::this_thread::get_id();
+}
+
+TU::Task<size_t> sumOnPool(TU::ThreadPool& pool, size_t from, size_t to)
+{
+	co_await pool.schedule();
+	size_t acc = 0;
+	for (auto i: TU::irange(from, to))
+		acc += i;
+	co_return acc;
+}
+
+TU::Task<void> failOnPool(TU::ThreadPool& pool)
+{
+	co_await pool.schedule();
+	throw std::runtime_error("failed in the pool");
+}
+
+//Simulates the read->parse->index pipeline of a loader.
+TU::Task<std::string> readStage(TU::ThreadPool& pool)
+{
+	co_await pool.schedule();
+	co_return std::string("c b a b");
+}
+
+TU::Task<std::vector<std::string>> parseStage(TU::ThreadPool& pool)
+{
+	auto contents = co_await readStage(pool);
+	co_await pool.schedule();
+	std::vector<std::string> tokens;
+	for (auto token: TU::split(contents))
+		tokens.emplace_back(token);
+	co_return tokens;
+}
+
+TU::Task<TU::FlatSet<std::string>> indexStage(TU::ThreadPool& pool)
+{
+	auto tokens = co_await parseStage(pool);
+	co_return TU::FlatSet<std::string>(tokens.begin(), tokens.end());
+}
+}
+
+TEST(TUBULTask, testSyncChain)
+{
+	EXPECT_EQ(TU::syncWait(answer()), 42);
+	EXPECT_EQ(TU::syncWait(addToAnswer(8)), 50);
+}
+
+TEST(TUBULTask, testScheduleOnPool)
+{
+	TU::ThreadPool pool(2);
+	auto workers = pool.getPoolWorkerIds();
+	auto runner = TU::syncWait(idOnPool(pool));
+	EXPECT_NE(std::find(workers.begin(), workers.end(), runner), workers.end());
+	EXPECT_NE(runner, std::this_thread::get_id());
+}
+
+TEST(TUBULTask, testExceptions)
+{
+	TU::ThreadPool pool(2);
+	EXPECT_THROW(TU::syncWait(failOnPool(pool)), std::runtime_error);
+}
+
+TEST(TUBULTask, testWhenAll)
+{
+	TU::ThreadPool pool(4);
+	std::vector<TU::Task<size_t>> tasks;
+	for (auto i: TU::irange(10))
+		tasks.push_back(sumOnPool(pool, i * 1000, (i + 1) * 1000));
+	auto partials = TU::syncWait(TU::whenAll(std::move(tasks)));
+	ASSERT_EQ(partials.size(), 10);
+	EXPECT_EQ(partials[0], 499500);
+	EXPECT_EQ(std::accumulate(partials.begin(), partials.end(), size_t{0}), 49995000);
+
+	std::vector<TU::Task<void>> failing;
+	failing.push_back(failOnPool(pool));
+	failing.push_back(failOnPool(pool));
+	EXPECT_THROW(TU::syncWait(TU::whenAll(std::move(failing))), std::runtime_error);
+
+	EXPECT_TRUE(TU::syncWait(TU::whenAll(std::vector<TU::Task<int>>{})).empty());
+}
+
+TEST(TUBULTask, testPipeline)
+{
+	TU::ThreadPool pool(2);
+	auto index = TU::syncWait(indexStage(pool));
+	ASSERT_EQ(index.size(), 3);
+	EXPECT_EQ(index.item(0), "a");
+	EXPECT_EQ(index.item(2), "c");
+}
@@ -5,6 +5,8 @@
 #include <gtest/gtest.h>
 #include "tubul.h"
 #include <array>
+#include <filesystem>
+#include <fstream>
 #include <thread>
 
 std::atomic_size_t g_counter;
@@ -214,3 +216,185 @@ TEST(TUBULThread, testWorkerId) {
 
 
 }
+
+TEST(TUBULThread, testParseCpuList) {
+    EXPECT_EQ(TU::parseCpuList("0"), std::vector<size_t>({0}));
+    EXPECT_EQ(TU::parseCpuList("0-3,8,10-11\n"), std::vector<size_t>({0, 1, 2, 3, 8, 10, 11}));
+    EXPECT_TRUE(TU::parseCpuList("").empty());
+}
+
+TEST(TUBULThread, testReadTopology) {
+    //Build a fake sysfs tree with 2 nodes, the second one with hyperthreads.
+    namespace fs = std::filesystem;
+    auto root = fs::temp_directory_path() / "tubul_fake_sys_node";
+    fs::remove_all(root);
+    fs::create_directories(root / "node0");
+    fs::create_directories(root / "node1" / "cpu2" / "topology");
+    fs::create_directories(root / "node1" / "cpu3" / "topology");
+    fs::create_directories(root / "node2");
+    std::ofstream(root / "node0" / "cpulist") << "0-1\n";
+    std::ofstream(root / "node1" / "cpulist") << "2-3\n";
+    std::ofstream(root / "node1" / "cpu2" / "topology" / "thread_siblings_list") << "2-3\n";
+    std::ofstream(root / "node1" / "cpu3" / "topology" / "thread_siblings_list") << "2-3\n";
+    //A memory only node, that should be ignored.
+    std::ofstream(root / "node2" / "cpulist") << "\n";
+
+    auto topology = TU::readCpuTopology(root.string());
+    ASSERT_EQ(topology.nodeCount(), 2);
+    EXPECT_EQ(topology.cpuCount(), 4);
+    EXPECT_EQ(topology.nodes[0].cores.size(), 2);
+    ASSERT_EQ(topology.nodes[1].cores.size(), 1);
+    EXPECT_EQ(topology.nodes[1].cores[0], std::vector<size_t>({2, 3}));
+    fs::remove_all(root);
+
+    //A missing tree falls back to a single node.
+    auto fallback = TU::readCpuTopology((root / "missing").string());
+    EXPECT_EQ(fallback.nodeCount(), 1);
+    EXPECT_GE(fallback.cpuCount(), 1);
+}
+
+TEST(TUBULThread, testNodeLocalPool) {
+    TU::CpuTopology topology;
+    topology.nodes.push_back({0, {0, 1}, {{0}, {1}}});
+    topology.nodes.push_back({1, {2, 3}, {{2, 3}}});
+
+    TU::ThreadPoolConfig config;
+    config.threadCount = 4;
+    config.affinity = TU::ThreadAffinity::CPU;
+    config.nodeLocalQueues = true;
+    config.topology = topology;
+    TU::ThreadPool pool(config);
+
+    EXPECT_EQ(pool.threadCount(), 4);
+    EXPECT_EQ(pool.nodeCount(), 2);
+    //Workers alternate between nodes. The topology is made up, so pinning to a cpu the
+    //machine doesn't have fails, and then the worker reports no cpus.
+    auto cpus = pool.getPoolWorkerCpus();
+    ASSERT_EQ(cpus.size(), 4);
+    const std::vector<std::vector<size_t>> expectedCpus = {{0}, {2}, {1}, {3}};
+    const auto machineCpus = std::thread::hardware_concurrency();
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        if (expectedCpus[i][0] < machineCpus)
+            EXPECT_TRUE(cpus[i].empty() or cpus[i] == expectedCpus[i]);
+        else
+            EXPECT_TRUE(cpus[i].empty());
+    }
+
+    std::atomic_size_t done = 0;
+    for (std::integral auto i: TU::irange(1000))
+        pool.pushTaskOnNode(i % 2, [&done] { ++done; });
+    for (std::integral auto i: TU::irange(1000))
+        pool.pushTask([&done, i] { done += (i >= 0); });
+    pool.waitForTasks();
+    EXPECT_EQ(done.load(), 2000);
+
+    auto myfib = pool.submit(fib, 20);
+    EXPECT_EQ(myfib.get(), fib(20));
+}
+
+TEST(TUBULThread, testStealFromBusyNode) {
+    TU::CpuTopology topology;
+    topology.nodes.push_back({0, {0}, {{0}}});
+    topology.nodes.push_back({1, {1}, {{1}}});
+
+    TU::ThreadPoolConfig config;
+    config.threadCount = 2;
+    config.nodeLocalQueues = true;
+    config.collectStats = true;
+    config.topology = topology;
+    TU::ThreadPool pool(config);
+    ASSERT_EQ(pool.nodeCount(), 2);
+
+    //Both workers go to sleep, then node 0 gets more tasks than it has workers: the idle
+    //worker of node 1 must wake up and help.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    for (std::integral auto i: TU::irange(20))
+        pool.pushTaskOnNode(0, [i] { std::this_thread::sleep_for(std::chrono::milliseconds(2 + i % 2)); });
+    pool.waitForTasks();
+
+    auto stats = pool.getWorkerStats();
+    ASSERT_EQ(stats.size(), 2);
+    EXPECT_EQ(stats[0].tasksExecuted + stats[1].tasksExecuted, 20);
+    EXPECT_GT(stats[1].steals, 0);
+}
+
+TEST(TUBULThread, testCorePinnedPool) {
+    TU::ThreadPoolConfig config;
+    config.threadCount = 3;
+    config.affinity = TU::ThreadAffinity::CORE;
+    TU::ThreadPool pool(config);
+    EXPECT_EQ(pool.nodeCount(), 1);
+    for (const auto& workerCpus: pool.getPoolWorkerCpus())
+        EXPECT_FALSE(workerCpus.empty());
+
+    std::atomic_size_t done = 0;
+    for (std::integral auto i: TU::irange(100))
+        pool.pushTask([&done, i] { done += (i >= 0); });
+    pool.waitForTasks();
+    EXPECT_EQ(done.load(), 100);
+}
+
+TEST(TUBULThread, testPoolStats) {
+    TU::ThreadPool noStats(1);
+    EXPECT_FALSE(noStats.collectsStats());
+    EXPECT_TRUE(noStats.getWorkerStats().empty());
+
+    TU::ThreadPoolConfig config;
+    config.threadCount = 2;
+    config.collectStats = true;
+    TU::ThreadPool pool(config);
+    EXPECT_TRUE(pool.collectsStats());
+
+    for (std::integral auto i: TU::irange(50))
+        pool.pushTask([i] { std::this_thread::sleep_for(std::chrono::microseconds(100 + i)); });
+    pool.waitForTasks();
+
+    auto stats = pool.getWorkerStats();
+    ASSERT_EQ(stats.size(), 2);
+    uint64_t executed = 0;
+    uint64_t waits = 0;
+    for (const auto& s: stats) {
+        executed += s.tasksExecuted;
+        waits += s.queueWaitNs.count();
+        EXPECT_EQ(s.steals, 0);
+        if (s.tasksExecuted)
+            EXPECT_GE(s.busyNs, s.tasksExecuted * 100000);
+    }
+    EXPECT_EQ(executed, 50);
+    EXPECT_EQ(waits, 50);
+    EXPECT_GE(stats[0].peakQueueDepth, 1);
+
+    auto report = pool.reportStats();
+    EXPECT_NE(report.find("| worker"), std::string::npos);
+    EXPECT_NE(report.find("Total tasks executed: 50"), std::string::npos);
+}
+
+TEST(TUBULThread, testHistogram) {
+    TU::Histogram h;
+    EXPECT_EQ(h.count(), 0);
+    EXPECT_EQ(h.percentile(0.5), 0);
+    for (uint64_t v = 1; v <= 1000; ++v)
+        h.record(v);
+    EXPECT_EQ(h.count(), 1000);
+    EXPECT_EQ(h.min(), 1);
+    EXPECT_EQ(h.max(), 1000);
+    EXPECT_DOUBLE_EQ(h.mean(), 500.5);
+    //Buckets guarantee a relative error below 12.5%
+    EXPECT_NEAR(static_cast<double>(h.percentile(0.5)), 500.0, 500 * 0.125);
+    EXPECT_NEAR(static_cast<double>(h.percentile(0.99)), 990.0, 990 * 0.125);
+    EXPECT_EQ(h.percentile(1.0), 1000);
+
+    TU::Histogram copy(h);
+    copy.record(1'000'000'000'000ULL);
+    EXPECT_EQ(copy.count(), 1001);
+    EXPECT_EQ(h.count(), 1000);
+    EXPECT_EQ(copy.max(), 1'000'000'000'000ULL);
+    //Every value falls inside the limits of its bucket.
+    for (uint64_t v: {0ULL, 7ULL, 8ULL, 9ULL, 1023ULL, 1024ULL, 123456789ULL, ~0ULL}) {
+        auto idx = TU::Histogram::bucketIndex(v);
+        ASSERT_LT(idx, TU::Histogram::BUCKET_COUNT);
+        EXPECT_GE(TU::Histogram::bucketUpperBound(idx), v);
+        if (idx > 0)
+            EXPECT_LT(TU::Histogram::bucketUpperBound(idx - 1), v);
+    }
+}
@@ -0,0 +1,273 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include "tubul_binary_log.h"
+#include "tubul_exception.h"
+#include "tubul_log_engine.h"
+
+#include <deque>
+#include <format>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace TU {
+
+    namespace {
+        struct BinaryLogFormat {
+            LogLevel level;
+            std::string format;
+        };
+
+        std::mutex formatsRegistryMutex;
+        std::deque<BinaryLogFormat> formatsRegistry;
+
+        std::mutex binaryLogMutex;
+        std::unique_ptr<BinaryLogger> binaryLog;
+        std::atomic<BinaryLogger*> binaryLogPtr = nullptr;
+
+        std::string formatsPath(const std::string& path) {
+            return path + ".fmt";
+        }
+
+        //Formats are stored one per line, so tabs, new lines and backslashes are escaped.
+        std::string escapeFormat(std::string_view format) {
+            std::string res;
+            res.reserve(format.size());
+            for (char c: format) {
+                switch (c) {
+                    case '\\': res += "\\\\"; break;
+                    case '\t': res += "\\t"; break;
+                    case '\n': res += "\\n"; break;
+                    case '\r': res += "\\r"; break;
+                    default: res += c;
+                }
+            }
+            return res;
+        }
+
+        std::string unescapeFormat(std::string_view format) {
+            std::string res;
+            res.reserve(format.size());
+            for (size_t i = 0; i < format.size(); ++i) {
+                if (format[i] != '\\' or i + 1 == format.size()) {
+                    res += format[i];
+                    continue;
+                }
+                switch (format[++i]) {
+                    case 't': res += '\t'; break;
+                    case 'n': res += '\n'; break;
+                    case 'r': res += '\r'; break;
+                    default: res += format[i];
+                }
+            }
+            return res;
+        }
+
+        class RecordReader {
+        public:
+            explicit RecordReader(std::span<const std::byte> data) : data_(data) {}
+
+            template<typename T>
+            bool read(T& value) {
+                if (pos_ + sizeof(T) > data_.size())
+                    return false;
+                std::memcpy(&value, data_.data() + pos_, sizeof(T));
+                pos_ += sizeof(T);
+                return true;
+            }
+
+            bool read(std::string& text, size_t length) {
+                if (pos_ + length > data_.size())
+                    return false;
+                text.assign(reinterpret_cast<const char*>(data_.data() + pos_), length);
+                pos_ += length;
+                return true;
+            }
+
+        private:
+            std::span<const std::byte> data_;
+            size_t pos_ = 0;
+        };
+
+        //Formats one argument with the spec of its placeholder (what goes after the ':').
+        bool formatArgument(RecordReader& reader, std::string_view spec, std::string& out) {
+            BinaryArgType type;
+            if (not reader.read(type))
+                return false;
+            const std::string fmt = spec.empty() ? std::string("{}") : "{:" + std::string(spec) + "}";
+            auto render = [&](const auto& value) {
+                try {
+                    out += std::vformat(fmt, std::make_format_args(value));
+                } catch (const std::exception&) {
+                    //A spec that doesn't suit the value, fall back to the default one
+                    out += std::format("{}", value);
+                }
+            };
+            switch (type) {
+                case BinaryArgType::INT: {
+                    int64_t value;
+                    if (not reader.read(value))
+                        return false;
+                    render(value);
+                    return true;
+                }
+                case BinaryArgType::UINT: {
+                    uint64_t value;
+                    if (not reader.read(value))
+                        return false;
+                    render(value);
+                    return true;
+                }
+                case BinaryArgType::DOUBLE: {
+                    double value;
+                    if (not reader.read(value))
+                        return false;
+                    render(value);
+                    return true;
+                }
+                case BinaryArgType::BOOL: {
+                    uint8_t value;
+                    if (not reader.read(value))
+                        return false;
+                    const bool flag = value != 0;
+                    render(flag);
+                    return true;
+                }
+                case BinaryArgType::STRING: {
+                    uint32_t length;
+                    std::string value;
+                    if (not reader.read(length) or not reader.read(value, length))
+                        return false;
+                    render(value);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        //Replaces every placeholder of format with the next argument of the record. Placeholders
+        //without an argument are left as they are.
+        std::string renderRecord(std::string_view format, RecordReader& reader) {
+            std::string res;
+            res.reserve(format.size() + 32);
+            bool argsLeft = true;
+            for (size_t i = 0; i < format.size(); ++i) {
+                const char c = format[i];
+                if ((c == '{' or c == '}') and i + 1 < format.size() and format[i + 1] == c) {
+                    res += c;
+                    ++i;
+                    continue;
+                }
+                const auto close = (c == '{') ? format.find('}', i) : std::string_view::npos;
+                if (close == std::string_view::npos) {
+                    res += c;
+                    continue;
+                }
+                auto placeholder = format.substr(i, close - i + 1);
+                auto colon = placeholder.find(':');
+                auto spec = (colon == std::string_view::npos) ? std::string_view() : placeholder.substr(colon + 1, placeholder.size() - colon - 2);
+                if (not argsLeft or not formatArgument(reader, spec, res)) {
+                    argsLeft = false;
+                    res += placeholder;
+                }
+                i = close;
+            }
+            return res;
+        }
+    }
+
+    uint32_t registerBinaryLogFormat(LogLevel level, std::string_view format) {
+        const std::scoped_lock lock(formatsRegistryMutex);
+        formatsRegistry.push_back({level, std::string(format)});
+        return static_cast<uint32_t>(formatsRegistry.size() - 1);
+    }
+
+    BinaryLogger::BinaryLogger(const std::string& path, size_t capacity) :
+        ring_(path, capacity),
+        formats_(formatsPath(path), std::ios::trunc) {
+        if (not formats_)
+            throw TU::Exception(std::string("Could not open file:") + formatsPath(path));
+    }
+
+    void BinaryLogger::writeFormats(uint32_t formatId) {
+        const std::scoped_lock lock(formatsMutex_);
+        uint32_t written = formatsWritten_.load(std::memory_order_relaxed);
+        if (formatId < written)
+            return;
+        const std::scoped_lock registryLock(formatsRegistryMutex);
+        for (; written < formatsRegistry.size(); ++written) {
+            const auto& entry = formatsRegistry[written];
+            formats_ << written << '\t' << static_cast<unsigned>(entry.level) << '\t' << escapeFormat(entry.format) << '\n';
+        }
+        //The format must be on disk before any record using it.
+        formats_.flush();
+        formatsWritten_.store(written, std::memory_order_release);
+    }
+
+    void BinaryLogger::flush() {
+        ring_.flush();
+        const std::scoped_lock lock(formatsMutex_);
+        formats_.flush();
+    }
+
+    void openBinaryLog(const std::string& path, size_t capacity) {
+        const std::scoped_lock lock(binaryLogMutex);
+        binaryLogPtr.store(nullptr);
+        binaryLog = std::make_unique<BinaryLogger>(path, capacity);
+        binaryLogPtr.store(binaryLog.get());
+    }
+
+    void closeBinaryLog() {
+        const std::scoped_lock lock(binaryLogMutex);
+        binaryLogPtr.store(nullptr);
+        if (binaryLog)
+            binaryLog->flush();
+        binaryLog.reset();
+    }
+
+    BinaryLogger* getBinaryLogger() {
+        return binaryLogPtr.load(std::memory_order_acquire);
+    }
+
+    size_t decodeBinaryLog(const std::string& path, std::ostream& out) {
+        std::vector<std::string> formats;
+        std::ifstream formatsFile(formatsPath(path));
+        if (not formatsFile)
+            throw TU::Exception(std::string("Could not open file:") + formatsPath(path));
+        std::string line;
+        while (std::getline(formatsFile, line)) {
+            auto firstTab = line.find('\t');
+            auto secondTab = line.find('\t', firstTab + 1);
+            if (firstTab == std::string::npos or secondTab == std::string::npos)
+                continue;
+            const auto id = std::stoul(line.substr(0, firstTab));
+            if (formats.size() <= id)
+                formats.resize(id + 1);
+            formats[id] = unescapeFormat(std::string_view(line).substr(secondTab + 1));
+        }
+
+        const MappedRing ring(path);
+        size_t count = 0;
+        ring.forEachRecord([&](std::span<const std::byte> record) {
+            RecordReader reader(record);
+            uint32_t formatId;
+            int64_t nanos;
+            if (not reader.read(formatId) or not reader.read(nanos))
+                return;
+            const std::chrono::system_clock::time_point time(
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(nanos)));
+            out << formatLogTimestamp(time, true);
+            if (formatId < formats.size())
+                out << renderRecord(formats[formatId], reader);
+            else
+                out << "<unknown format " << formatId << ">";
+            out << '\n';
+            ++count;
+        });
+        if (ring.droppedRecords())
+            out << ring.droppedRecords() << " older records were overwritten\n";
+        return count;
+    }
+}
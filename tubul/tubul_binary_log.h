@@ -0,0 +1,189 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iosfwd>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include "tubul_log_types.h"
+#include "tubul_mapped_ring.h"
+
+namespace TU {
+
+/** Binary logging, for very high rate messages (typically STATS). Instead of formatting text, a
+ * record keeps the id of its format string, a timestamp and the raw arguments, and it's appended
+ * to a memory mapped ring file (see TU::MappedRing). The format strings are written once, to a
+ * "<path>.fmt" file next to the log. decodeBinaryLog (or the binlog_decode app) renders the
+ * records as text later, using std::format placeholders: "{}", "{:.3f}", etc.
+ *
+ *     TU::openBinaryLog("run.binlog");
+ *     TUBUL_STAT_BINARY("iteration {} cost {:.4f} moves {}", it, cost, moves);
+ *
+ * Arguments can be integers, floating point numbers, bools and strings. Long strings are cut to
+ * fit in BinaryLogger::MAX_RECORD_SIZE.
+ */
+
+    enum class BinaryArgType : uint8_t {
+        INT,
+        UINT,
+        DOUBLE,
+        BOOL,
+        STRING
+    };
+
+/** Returns the id of a format string for binary logs. Every call registers a new format, so
+ * call it once per call site (TUBUL_BINARY_LOG does that).
+ */
+    uint32_t registerBinaryLogFormat(LogLevel level, std::string_view format);
+
+    namespace detail {
+        //Serializes the arguments of a record into a stack buffer.
+        template<size_t CAPACITY>
+        class BinaryRecordBuilder {
+        public:
+            void addRaw(const void* data, size_t size) {
+                std::memcpy(buffer_.data() + size_, data, size);
+                size_ += size;
+            }
+
+            template<typename Arg>
+            void add(const Arg& arg) {
+                using T = std::remove_cvref_t<Arg>;
+                if constexpr (std::is_same_v<T, bool>) {
+                    addScalar(BinaryArgType::BOOL, static_cast<uint8_t>(arg));
+                } else if constexpr (std::is_same_v<T, char>) {
+                    addString(std::string_view(&arg, 1));
+                } else if constexpr (std::is_integral_v<T> and std::is_signed_v<T>) {
+                    addScalar(BinaryArgType::INT, static_cast<int64_t>(arg));
+                } else if constexpr (std::is_integral_v<T>) {
+                    addScalar(BinaryArgType::UINT, static_cast<uint64_t>(arg));
+                } else if constexpr (std::is_floating_point_v<T>) {
+                    addScalar(BinaryArgType::DOUBLE, static_cast<double>(arg));
+                } else if constexpr (std::is_enum_v<T>) {
+                    add(static_cast<std::underlying_type_t<T>>(arg));
+                } else {
+                    static_assert(std::is_convertible_v<const T&, std::string_view>,
+                                  "Binary logs only take numbers, bools and strings");
+                    addString(std::string_view(arg));
+                }
+            }
+
+            [[nodiscard]] std::span<const std::byte> view() const { return {buffer_.data(), size_}; }
+
+        private:
+            template<typename Scalar>
+            void addScalar(BinaryArgType type, Scalar value) {
+                //Arguments that don't fit are left out (the decoder leaves their placeholder)
+                if (size_ + 1 + sizeof(Scalar) > CAPACITY)
+                    return;
+                addRaw(&type, 1);
+                addRaw(&value, sizeof(Scalar));
+            }
+
+            void addString(std::string_view text) {
+                if (size_ + 1 + sizeof(uint32_t) > CAPACITY)
+                    return;
+                const auto type = BinaryArgType::STRING;
+                const auto length = static_cast<uint32_t>(std::min(text.size(), CAPACITY - size_ - 1 - sizeof(uint32_t)));
+                addRaw(&type, 1);
+                addRaw(&length, sizeof(length));
+                addRaw(text.data(), length);
+            }
+
+            std::array<std::byte, CAPACITY> buffer_;
+            size_t size_ = 0;
+        };
+    }
+
+    class BinaryLogger {
+    public:
+        static constexpr size_t MAX_RECORD_SIZE = 1024;
+
+        /** Creates (or truncates) the ring file at path, keeping the latest capacity bytes of
+         * records, and the formats file at path + ".fmt".
+         */
+        BinaryLogger(const std::string& path, size_t capacity);
+
+        BinaryLogger(const BinaryLogger&) = delete;
+        BinaryLogger& operator=(const BinaryLogger&) = delete;
+
+        /** Appends a record. Thread safe. */
+        template<typename... Args>
+        void log(uint32_t formatId, const Args&... args) {
+            if (formatId >= formatsWritten_.load(std::memory_order_acquire))
+                writeFormats(formatId);
+            detail::BinaryRecordBuilder<MAX_RECORD_SIZE> record;
+            const int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            record.addRaw(&formatId, sizeof(formatId));
+            record.addRaw(&time, sizeof(time));
+            (record.add(args), ...);
+            ring_.write(record.view());
+        }
+
+        /** Asks the OS to write the ring to disk and flushes the formats file. */
+        void flush();
+
+        [[nodiscard]] uint64_t droppedRecords() const { return ring_.droppedRecords(); }
+        [[nodiscard]] const std::string& path() const { return ring_.path(); }
+
+    private:
+        //Writes every format registered so far, up to (at least) formatId.
+        void writeFormats(uint32_t formatId);
+
+        MappedRing ring_;
+        std::mutex formatsMutex_;
+        std::ofstream formats_;
+        std::atomic<uint32_t> formatsWritten_ = 0;
+    };
+
+/** Opens the binary log used by TUBUL_BINARY_LOG, replacing the previous one. The default
+ * capacity is 64MB.
+ * The previous log is destroyed right away, and a thread in the middle of TUBUL_BINARY_LOG may
+ * still be writing to it: like the logger definitions, call it while no other thread logs
+ * (typically at startup). Keeping the old log alive instead is not an option, since a new log
+ * at the same path would share its file with the old mapping.
+ */
+    void openBinaryLog(const std::string& path, size_t capacity = 64 * 1024 * 1024);
+
+/** Flushes and closes the binary log. Like openBinaryLog, it must be called while no other
+ * thread logs: one in the middle of TUBUL_BINARY_LOG would write to a destroyed logger.
+ */
+    void closeBinaryLog();
+
+/** The binary log opened with openBinaryLog, or nullptr. */
+    BinaryLogger* getBinaryLogger();
+
+/** Renders the records of a binary log (and its ".fmt" file) as text lines, from the oldest to
+ * the newest, prefixing each one with its timestamp. Returns the number of records written.
+ */
+    size_t decodeBinaryLog(const std::string& path, std::ostream& out);
+
+/** Logs to the binary log, if one is open. The format is registered the first time this line runs.
+ * Like the rest of the log macros, levels below TUBUL_LOG_MIN_LEVEL are compiled out.
+ */
+#define TUBUL_BINARY_LOG(LEVEL, FORMAT, ...) \
+    do { \
+        if constexpr (TU::logCompiledIn(TU::LogLevel::LEVEL)) { \
+            if (auto* tubulBinaryLogger_ = TU::getBinaryLogger()) { \
+                static const uint32_t tubulFormatId_ = TU::registerBinaryLogFormat(TU::LogLevel::LEVEL, FORMAT); \
+                tubulBinaryLogger_->log(tubulFormatId_ __VA_OPT__(,) __VA_ARGS__); \
+            } \
+        } \
+    } while (false)
+
+#define TUBUL_STAT_BINARY(FORMAT, ...) TUBUL_BINARY_LOG(STATS, FORMAT __VA_OPT__(,) __VA_ARGS__)
+}
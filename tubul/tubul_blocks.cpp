@@ -2,8 +2,16 @@
 // Created by Carlos Acosta on 27-01-23.
 //
 
+#include <array>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <variant>
 #include <string>
 #include <chrono>
@@ -18,7 +26,14 @@
 #include "tubul_time.h"
 #include "tubul_mem_utils.h"
 #include "tubul_logger.h"
+#include "tubul_exception.h"
+#include "tubul_perf_counters.h"
+#include <cstdlib>
 #include <format>
+#include <fstream>
+#include <optional>
+#include <utility>
+#include "json.hpp"
 
 
 namespace TU
@@ -56,48 +71,362 @@ struct StringKeyEqual {
 	bool operator()(const StringKey& k, const std::string& s) const noexcept { return k.view() == s; }
 };
 
+//Every distinct location (chain of block names) gets one BlockPath, created the first time a
+//block opens there. It keeps the location already joined, and which block filters match it,
+//so nothing has to be built or matched again while logging.
+struct BlockPath
+{
+	size_t id = 0;
+	const BlockPath* parent = nullptr;
+	std::string_view name;
+	std::string location;
+	std::atomic<uint64_t> filterMask = 0;
+	std::vector<BlockPath*> children;
+};
+
+//Blocks measure durations, so they use a clock that never jumps (and is cheap to read).
+using BlockClock = std::chrono::steady_clock;
+
 struct BlockDescription
 {
-	explicit BlockDescription(const std::string_view n) :
+	BlockDescription(const std::string_view n, BlockPath* p) :
 		name(n),
+		path(p),
 		allocAtStart(memLifetime()),
-		start_time(now())
+		start_time(BlockClock::now())
 	{}
 
 	std::string_view name;
+	BlockPath* path;
 	size_t    allocAtStart;
-	TimePoint start_time;
+	BlockClock::time_point start_time;
+	//Time spent in the blocks opened inside this one, to get its exclusive time.
+	TimeDuration childTime = TimeDuration::zero();
+	//Hardware counters when the block opened, when enableBlockCounters worked.
+	bool counted = false;
+	PerfCounterGroup::Values countersAtStart;
+};
+
+//What the closed blocks of a location measured.
+struct PathStats
+{
+	size_t count = 0;
+	TimeDuration inclusive = TimeDuration::zero();
+	TimeDuration exclusive = TimeDuration::zero();
+	size_t allocated = 0;
+	//Inclusive durations in nanoseconds, only for the paths matching enableBlockHistograms.
+	std::unique_ptr<Histogram> durations;
+	//Hardware counters added up over the countedCalls blocks that could read them.
+	size_t countedCalls = 0;
+	PerfCounterGroup::Values counters{};
+
+	PathStats& operator+=(const PathStats& other)
+	{
+		count += other.count;
+		countedCalls += other.countedCalls;
+		for (size_t i = 0; i < counters.size(); ++i)
+			counters[i] += other.counters[i];
+		inclusive += other.inclusive;
+		exclusive += other.exclusive;
+		allocated += other.allocated;
+		if (other.durations)
+		{
+			if (not durations)
+				durations = std::make_unique<Histogram>();
+			durations->merge(*other.durations);
+		}
+		return *this;
+	}
+};
+
+//A block that ran while tracing, in nanoseconds since the trace started.
+struct TraceEvent
+{
+	int64_t start;
+	int64_t duration;
+	size_t pathId;
 };
 
-std::vector<BlockDescription>& getBlockContainer()
+//The blocks of a thread: the stack of the open ones, and the stats of the closed ones, indexed by
+//the id of their path. Only its thread touches the stack. The stats are also read when reporting,
+//so they are behind a mutex (that nobody else takes while the thread runs).
+struct ThreadBlocks
 {
-	// Lambda trick to reserve size for a static vector.
-	static std::vector<BlockDescription> block_container = []{
+	ThreadBlocks(size_t idx, std::thread::id tid) :
+		index(idx),
+		threadId(tid)
+	{
 		// We don't think we are reaching more than 20 blocks deep
-		// (remember block_container is a stack of active blocks)
+		// (remember stack is a stack of active blocks)
 		const size_t BLOCKS_DEPTH = 20;
-		std::vector<BlockDescription> v;
-		v.reserve(BLOCKS_DEPTH);
-		return v;
-	}();
-	return block_container;
+		stack.reserve(BLOCKS_DEPTH);
+	}
+
+	//Path opened last time under parent with a name at that address. The content of the name is
+	//checked too, the address alone could be reused by another string.
+	BlockPath* cachedPath(const BlockPath* parent, std::string_view name) const
+	{
+		auto const& entry = pathCache[cacheSlot(parent, name.data())];
+		if (entry.parent == parent and entry.name == name.data() and entry.path->name == name)
+			return entry.path;
+		return nullptr;
+	}
+
+	void cachePath(const BlockPath* parent, std::string_view name, BlockPath* path)
+	{
+		pathCache[cacheSlot(parent, name.data())] = {parent, name.data(), path};
+	}
+
+	static size_t cacheSlot(const BlockPath* parent, const char* name)
+	{
+		const auto key = reinterpret_cast<uintptr_t>(parent) ^ (reinterpret_cast<uintptr_t>(name) << 1);
+		return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 58);
+	}
+
+	struct CachedPath
+	{
+		const BlockPath* parent = nullptr;
+		const char* name = nullptr;
+		BlockPath* path = nullptr;
+	};
+
+	const size_t index;
+	const std::thread::id threadId;
+	std::vector<BlockDescription> stack;
+	//Opening a block is mostly finding the path again, which takes the registry lock. Blocks
+	//usually open in the same few places, so each thread remembers the last ones.
+	std::array<CachedPath, 64> pathCache{};
+	//Opened the first time a block of the thread wants them (they only count this thread). They
+	//hold a few file descriptors, closed when the thread exits (see BlockRegistry::retire).
+	std::unique_ptr<PerfCounterGroup> counters;
+
+	const PerfCounterGroup& perfCounters()
+	{
+		if (not counters)
+			counters = std::make_unique<PerfCounterGroup>();
+		return *counters;
+	}
+
+	std::mutex statsMutex;
+	std::vector<PathStats> stats;
+	//Blocks closed while tracing, in the order they closed.
+	std::vector<TraceEvent> trace;
+	size_t droppedEvents = 0;
+	//Depths of the blocks of the stack closed from another thread or out of order, guarded by
+	//statsMutex. The thread removes them once they reach the top of its stack.
+	std::vector<size_t> abandoned;
+	std::atomic<bool> hasAbandoned = false;
+};
+
+//Trace events of a thread that already exited.
+struct RetiredTrace
+{
+	size_t index;
+	std::vector<TraceEvent> events;
+	size_t droppedEvents;
+};
+
+//What the blocks of all threads share: block names, paths, filters, the data of every running
+//thread that used a block, and what the threads that exited left behind.
+struct BlockRegistry
+{
+	static constexpr size_t MAX_FILTERS = 64;
+
+	BlockRegistry()
+	{
+		paths.emplace_back();
+	}
+
+	BlockPath& root() { return paths.front(); }
+
+	uint64_t maskFor(std::string_view location) const
+	{
+		uint64_t mask = 0;
+		for (size_t i = 0; i < filters.size(); ++i)
+			if (matchesBlockPattern(filters[i], location))
+				mask |= uint64_t{1} << i;
+		return mask;
+	}
+
+	//Path of a block opening inside parent. Names are interned, so the same name always has the
+	//same address. Names given as a string are copied, views are kept as they are.
+	BlockPath* enter(BlockPath* parent, std::string_view name, bool copyName)
+	{
+		const std::scoped_lock lock(mutex);
+		auto nameIt = names.find(name);
+		if (nameIt == names.end())
+			nameIt = copyName ? names.emplace(std::string(name)).first : names.emplace(name).first;
+		const auto interned = nameIt->view();
+
+		auto& siblings = parent->children;
+		for (auto* path: siblings)
+			if (path->name.data() == interned.data())
+				return path;
+		auto& path = paths.emplace_back();
+		path.id = paths.size() - 1;
+		path.parent = parent;
+		path.name = interned;
+		path.location = parent->location.empty() ? std::string(interned) : parent->location + "." + std::string(interned);
+		path.filterMask = maskFor(path.location);
+		siblings.push_back(&path);
+		return &path;
+	}
+
+	//Called when a thread exits: its stats are added to exitedStats and its trace moves here,
+	//so the reports don't change, and the rest of its data (and its counters) goes away. Programs
+	//starting a thread per task don't grow without limit.
+	void retire(const ThreadBlocks* thread)
+	{
+		const std::scoped_lock lock(mutex);
+		auto it = std::find_if(threads.begin(), threads.end(), [thread](auto const& t) { return t.get() == thread; });
+		if (it == threads.end())
+			return;
+		{
+			const std::scoped_lock threadLock((*it)->statsMutex);
+			if (exitedStats.size() < (*it)->stats.size())
+				exitedStats.resize((*it)->stats.size());
+			for (size_t id = 0; id < (*it)->stats.size(); ++id)
+				exitedStats[id] += (*it)->stats[id];
+			if (not (*it)->trace.empty() or (*it)->droppedEvents > 0)
+				retiredTraces.push_back({(*it)->index, std::move((*it)->trace), (*it)->droppedEvents});
+		}
+		threads.erase(it);
+	}
+
+	std::mutex mutex;
+	std::unordered_set<StringKey, StringKeyHash, StringKeyEqual> names;
+	std::deque<BlockPath> paths;
+	std::vector<std::string> filters;
+	std::vector<std::shared_ptr<ThreadBlocks>> threads;
+	//Threads are numbered in the order they open their first block
+	size_t nextThreadIndex = 0;
+	std::vector<PathStats> exitedStats;
+	std::vector<RetiredTrace> retiredTraces;
+
+	//Tracing. The options are only written while tracing is off.
+	std::atomic<bool> tracing = false;
+	BlockClock::time_point traceStart;
+	size_t traceCapacity = 0;
+	std::string traceFile;
+	bool traceAtExit = false;
+
+	//Filter bits (see registerBlockFilter) of the paths that keep a histogram of durations.
+	std::atomic<uint64_t> histogramMask = 0;
+	std::atomic<bool> countersEnabled = false;
+};
+
+static BlockRegistry& getBlockRegistry()
+{
+	static BlockRegistry registry;
+	return registry;
+}
+
+//Id of the path of the innermost open block of the thread (0 when there's none). It's kept apart
+//so a signal handler can read it while the thread is in the middle of opening a block.
+thread_local volatile size_t t_currentPathId = 0;
+
+//The registry keeps the data of the thread alive, the plain pointer avoids the initialization
+//check of a thread_local object on every block.
+thread_local ThreadBlocks* t_threadBlocks = nullptr;
+
+//Retires the data of the thread when it exits. It's only created along with that data, so
+//blocks don't pay for it.
+struct ThreadBlocksExit
+{
+	~ThreadBlocksExit()
+	{
+		getBlockRegistry().retire(std::exchange(t_threadBlocks, nullptr));
+	}
+};
+
+static ThreadBlocks& getThreadBlocks()
+{
+	if (t_threadBlocks == nullptr)
+	{
+		auto& registry = getBlockRegistry();
+		{
+			const std::scoped_lock lock(registry.mutex);
+			auto res = std::make_shared<ThreadBlocks>(registry.nextThreadIndex++, std::this_thread::get_id());
+			registry.threads.push_back(res);
+			t_threadBlocks = res.get();
+		}
+		//A block opened by a destructor running after the exit hook keeps its data until the end.
+		thread_local ThreadBlocksExit exitHook;
+	}
+	return *t_threadBlocks;
 }
 
-std::unordered_map<StringKey, BlockStats, StringKeyHash, StringKeyEqual>& getBlockStatsContainer()
+//Pops the abandoned blocks (see abandonBlock) from the top of the stack of the thread.
+static void popAbandonedBlocks(ThreadBlocks& thread)
 {
-	static std::unordered_map<StringKey, BlockStats, StringKeyHash, StringKeyEqual> stat_container;
-	return stat_container;
+	if (not thread.hasAbandoned.load(std::memory_order_acquire))
+		return;
+	const std::scoped_lock lock(thread.statsMutex);
+	auto& blocks = thread.stack;
+	while (not blocks.empty())
+	{
+		auto it = std::find(thread.abandoned.begin(), thread.abandoned.end(), blocks.size() - 1);
+		if (it == thread.abandoned.end())
+			break;
+		thread.abandoned.erase(it);
+		blocks.pop_back();
+	}
+	thread.hasAbandoned.store(not thread.abandoned.empty(), std::memory_order_relaxed);
+	t_currentPathId = blocks.empty() ? 0 : blocks.back().path->id;
+}
+
+//A block closing in another thread than its own, or before the blocks opened inside it. The
+//stack of its thread can't be touched from here, so it's only marked, and its thread pops it
+//later. The owner may have exited already, the registry says whether it's still there.
+static void abandonBlock(ThreadBlocks* owner, size_t index)
+{
+	auto& registry = getBlockRegistry();
+	{
+		const std::scoped_lock lock(registry.mutex);
+		if (std::ranges::any_of(registry.threads, [owner](auto const& t) { return t.get() == owner; }))
+		{
+			const std::scoped_lock threadLock(owner->statsMutex);
+			owner->abandoned.push_back(index);
+			owner->hasAbandoned.store(true, std::memory_order_release);
+		}
+	}
+	TUBUL_LOG_ONCE(WARNING) << "[Blocks] A block closed in another thread than the one that opened it, or "
+							   "before the blocks opened inside it. It's not measured";
 }
 
+//Calls fn(threadIndex, threadId, path, stats) for every path with stats in every running
+//thread, and then for the threads that exited (as EXITED_BLOCK_THREADS). The registry stays
+//locked, so fn can't open blocks.
+template<typename Fn>
+static void forEachBlockStats(Fn&& fn)
+{
+	auto& registry = getBlockRegistry();
+	const std::scoped_lock lock(registry.mutex);
+	for (auto& thread: registry.threads)
+	{
+		const std::scoped_lock threadLock(thread->statsMutex);
+		for (size_t id = 0; id < thread->stats.size(); ++id)
+			if (thread->stats[id].count > 0)
+				fn(thread->index, thread->threadId, registry.paths[id], thread->stats[id]);
+	}
+	for (size_t id = 0; id < registry.exitedStats.size(); ++id)
+		if (registry.exitedStats[id].count > 0)
+			fn(EXITED_BLOCK_THREADS, std::thread::id{}, registry.paths[id], registry.exitedStats[id]);
+}
+
+//The block logs read /proc and format several numbers, so we only do that work when
+//somebody is going to read it.
 void logBlockOnOpen(const BlockDescription& ) {
+	if (not logEnabled(LogLevel::DEVEL))
+		return;
 	logDevel(std::format("Starting {} |  mem rss/peak/alive: [{}/{}/{}]",
 		getCurrentBlockLocation(), bytesToStr(memCurrentRSS()), bytesToStr(memPeakRSS()),
 		bytesToStr(memAlive())));
 }
 
-void logBlockOnClose( const BlockDescription& b, TimeDuration block_duration, TimeDuration accum_duration) {
-	//To store the amount of seconds as a double.
-	auto allocations = memLifetime() - b.allocAtStart;
+void logBlockOnClose( size_t allocations, TimeDuration block_duration, TimeDuration accum_duration) {
+	if (not logEnabled(LogLevel::DEVEL))
+		return;
 	logDevel(std::format("Closing {} |  rss/peak/alive/allocated: [{}/{}/{}/{}] e: {:g}s  accum:{:g}s",
 		getCurrentBlockLocation(), bytesToStr(memCurrentRSS()), bytesToStr(memPeakRSS()),
 		bytesToStr(memAlive()), bytesToStr(allocations), block_duration.count(), accum_duration.count()));
@@ -106,98 +435,232 @@ void logBlockOnClose( const BlockDescription& b, TimeDuration block_duration, Ti
 Block::Block(const std::string &name, LogType l):
 	whenToLog_(l)
 {
-	auto& blocks = getBlockContainer();
-	auto& blockStats = getBlockStatsContainer();
-	auto it = blockStats.find(name);
-	if(it == blockStats.end())
-		it = blockStats.emplace(std::string{name}, BlockStats{}).first;
-	index_ = blocks.size();
-	blocks.emplace_back( it->first.view() );
-	if ( l == LogType::ALL or l == LogType::ON_START)
-		logBlockOnOpen(blocks.back());
+	open(name, true);
 }
 
 Block::Block(std::string_view name, LogType l) :
 	whenToLog_(l)
 {
-	auto& blocks = getBlockContainer();
-	auto& blockStats = getBlockStatsContainer();
-	auto it = blockStats.find(name);
-	if (it == blockStats.end())
-		it = blockStats.emplace(name, BlockStats{}).first;
+	open(name, false);
+}
+
+void Block::open(std::string_view name, bool copyName)
+{
+	auto& thread = getThreadBlocks();
+	popAbandonedBlocks(thread);
+	auto& blocks = thread.stack;
+	owner_ = &thread;
 	index_ = blocks.size();
-	blocks.emplace_back( it->first.view() );
-	if ( l == LogType::ALL or l == LogType::ON_START)
+	BlockPath* parent = blocks.empty() ? &getBlockRegistry().root() : blocks.back().path;
+	BlockPath* path = thread.cachedPath(parent, name);
+	if (path == nullptr)
+	{
+		path = getBlockRegistry().enter(parent, name, copyName);
+		thread.cachePath(parent, name, path);
+	}
+	blocks.emplace_back( path->name, path );
+	t_currentPathId = path->id;
+	if (getBlockRegistry().countersEnabled.load(std::memory_order_relaxed))
+		blocks.back().counted = thread.perfCounters().read(blocks.back().countersAtStart);
+	if ( whenToLog_ == LogType::ALL or whenToLog_ == LogType::ON_START)
 		logBlockOnOpen(blocks.back());
 }
 
 Block::~Block()
 {
-	auto& blocks = getBlockContainer();
-	//If somehow the blocks are empty and we got here, that means somethign really
-	//weird happened.
-	assert(not blocks.empty());
+	//A coroutine can resume in another thread, with the block still open.
+	if (t_threadBlocks != owner_)
+	{
+		abandonBlock(owner_, index_);
+		return;
+	}
+	auto& thread = *owner_;
+	popAbandonedBlocks(thread);
+	auto& blocks = thread.stack;
+	if (blocks.size() != index_ + 1)
+	{
+		abandonBlock(owner_, index_);
+		return;
+	}
 	//We always just drop the last block in the stack given the way blocks
 	//are supposed to be created.
 	auto& closingBlock = blocks.back();
 	//We calculate how much time has passed since the creation of this block.
-	TimeDuration block_duration =  now() - closingBlock.start_time ;
-	//Add info to the mapped data of this particular block
-	auto& [ n, accum ] = getBlockStatsContainer().find(closingBlock.name)->second;
-	++n;
-	accum += block_duration;
+	TimeDuration block_duration =  BlockClock::now() - closingBlock.start_time ;
+	auto allocations = memLifetime() - closingBlock.allocAtStart;
+	PerfCounterGroup::Values countersAtEnd;
+	const bool counted = closingBlock.counted and thread.perfCounters().read(countersAtEnd);
+	//Add info to the stats of this thread for this location.
+	TimeDuration accum;
+	{
+		const std::scoped_lock lock(thread.statsMutex);
+		const auto id = closingBlock.path->id;
+		if (thread.stats.size() <= id)
+			thread.stats.resize(id + 1);
+		auto& stats = thread.stats[id];
+		++stats.count;
+		stats.inclusive += block_duration;
+		stats.exclusive += block_duration - closingBlock.childTime;
+		stats.allocated += allocations;
+		accum = stats.inclusive;
+		if (counted)
+		{
+			++stats.countedCalls;
+			for (size_t i = 0; i < countersAtEnd.size(); ++i)
+				stats.counters[i] += countersAtEnd[i] - closingBlock.countersAtStart[i];
+		}
+
+		auto& registry = getBlockRegistry();
+		if (closingBlock.path->filterMask.load(std::memory_order_relaxed) & registry.histogramMask.load(std::memory_order_relaxed))
+		{
+			if (not stats.durations)
+				stats.durations = std::make_unique<Histogram>();
+			stats.durations->record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(block_duration).count()));
+		}
+		if (registry.tracing.load(std::memory_order_acquire))
+		{
+			if (thread.trace.size() < registry.traceCapacity)
+				thread.trace.push_back({
+					std::chrono::duration_cast<std::chrono::nanoseconds>(closingBlock.start_time - registry.traceStart).count(),
+					std::chrono::duration_cast<std::chrono::nanoseconds>(block_duration).count(),
+					id});
+			else
+				++thread.droppedEvents;
+		}
+	}
+	if (blocks.size() > 1)
+		blocks[blocks.size() - 2].childTime += block_duration;
 
 	if ( whenToLog_ == LogType::ALL or whenToLog_ == LogType::ON_END)
-		logBlockOnClose( closingBlock, block_duration, accum);
+		logBlockOnClose( allocations, block_duration, accum);
 
 	blocks.pop_back();
-	//Just to be safe, let's check the number of blocks is the.
-	assert(index_ == blocks.size());
+	t_currentPathId = blocks.empty() ? 0 : blocks.back().path->id;
+	popAbandonedBlocks(thread);
 }
 
 std::string getCurrentBlockLocation()
 {
-	//I'd really like to use join here...
-	//The string i will use as a joiner can be defined just once.
-	static const std::string joiner(".");
-
-	//Get the current blocks, but if we don't have anything, we can't do
-	//anything else.
-	auto const& blocks = getBlockContainer();
+	auto const& blocks = getThreadBlocks().stack;
 	if (blocks.empty())
 		return {};
+	return blocks.back().path->location;
+}
 
-	//Simple lambda to accumulate length of a bunch of strings.
-	auto sizeAcc = [](size_t current, const BlockDescription& b) {
-		return current + b.name.size();
-	};
-	//Get the length of all names
-	constexpr size_t zero = 0UL;
-	const size_t final_length = std::accumulate(blocks.begin(), blocks.end(), zero, sizeAcc);
-
-	//We will start with an empty string that will hold the final concatenated location.
-	//This strings needs a total space of the sum of all block name's length plus the number
-	//of join charaters required. After getting the space, we store the first name. After
-	//getting the space for the final string, we store the first name.
-	std::string res;
-	res.reserve(final_length + ( joiner.size() * (blocks.size() -1) ) );
-	res.append(blocks.front().name);
-	//Then we add all the rest appending the joiner and the name
-	auto it = blocks.begin()+1;
-	auto end = blocks.end();
-	for (;it != end; ++it) {
-		res.append( joiner );
-		res.append( it->name );
+bool matchesBlockPattern(std::string_view pattern, std::string_view location)
+{
+	//Alternatives separated by commas
+	for (size_t start = 0; start <= pattern.size();)
+	{
+		auto end = std::min(pattern.find(',', start), pattern.size());
+		auto glob = pattern.substr(start, end - start);
+		//Classic glob matching, going back to the last '*' when something doesn't match.
+		size_t p = 0, l = 0, starP = std::string_view::npos, starL = 0;
+		bool matched = true;
+		while (l < location.size())
+		{
+			if (p < glob.size() and (glob[p] == '?' or glob[p] == location[l]))
+			{
+				++p;
+				++l;
+			}
+			else if (p < glob.size() and glob[p] == '*')
+			{
+				starP = p++;
+				starL = l;
+			}
+			else if (starP != std::string_view::npos)
+			{
+				p = starP + 1;
+				l = ++starL;
+			}
+			else
+			{
+				matched = false;
+				break;
+			}
+		}
+		while (matched and p < glob.size() and glob[p] == '*')
+			++p;
+		if (matched and p == glob.size())
+			return true;
+		start = end + 1;
 	}
-	return res;
+	return false;
 }
+
+uint64_t registerBlockFilter(const std::string& pattern)
+{
+	auto& registry = getBlockRegistry();
+	const std::scoped_lock lock(registry.mutex);
+	auto& filters = registry.filters;
+	auto it = std::find(filters.begin(), filters.end(), pattern);
+	if (it != filters.end())
+		return uint64_t{1} << (it - filters.begin());
+	if (filters.size() == BlockRegistry::MAX_FILTERS)
+		throw TU::Exception("[Blocks] Too many block filters (the maximum is 64)");
+	const uint64_t bit = uint64_t{1} << filters.size();
+	filters.push_back(pattern);
+	//Paths already known are checked now, the rest when they are created.
+	for (auto& path: registry.paths)
+		if (matchesBlockPattern(pattern, path.location))
+			path.filterMask.fetch_or(bit, std::memory_order_relaxed);
+	return bit;
+}
+
+void enableBlockHistograms(const std::string& pattern)
+{
+	const auto bit = registerBlockFilter(pattern);
+	getBlockRegistry().histogramMask.fetch_or(bit, std::memory_order_relaxed);
+}
+
+size_t getCurrentBlockPathId() noexcept
+{
+	return t_currentPathId;
+}
+
+std::string getBlockPathLocation(size_t pathId)
+{
+	auto& registry = getBlockRegistry();
+	const std::scoped_lock lock(registry.mutex);
+	if (pathId >= registry.paths.size())
+		throw TU::Exception("[Blocks] Unknown block path: " + std::to_string(pathId));
+	return registry.paths[pathId].location;
+}
+
+bool enableBlockCounters()
+{
+	static const bool supported = PerfCounterGroup::supported();
+	if (not supported)
+	{
+		TUBUL_LOG_ONCE(WARNING) << "[Blocks] Hardware performance counters are not available, blocks only measure time";
+		return false;
+	}
+	getBlockRegistry().countersEnabled.store(true, std::memory_order_relaxed);
+	return true;
+}
+
+void disableBlockCounters()
+{
+	getBlockRegistry().countersEnabled.store(false, std::memory_order_relaxed);
+}
+
+uint64_t getCurrentBlockFilterMask()
+{
+	auto const& blocks = getThreadBlocks().stack;
+	const BlockPath& path = blocks.empty() ? getBlockRegistry().root() : *blocks.back().path;
+	return path.filterMask.load(std::memory_order_relaxed);
+}
+
 void Block::report(){
-	auto& blocks = getBlockContainer();
+	if (not logEnabled(LogLevel::REPORT))
+		return;
+	auto& blocks = getThreadBlocks().stack;
 	auto& reportingBlock = blocks[index_];
 	//We calculate how much time has passed since the creation of this block.
-	TimeDuration block_duration =  now() - reportingBlock.start_time ;
+	TimeDuration block_duration =  BlockClock::now() - reportingBlock.start_time ;
 	//Current info
-	auto& [ n, accum ] = getBlockStatsContainer().find(reportingBlock.name)->second;
+	auto accum = getAccumulatedStats(std::string(reportingBlock.name)).t_;
 
 	auto allocations = memLifetime() - reportingBlock.allocAtStart;
 
@@ -206,43 +669,362 @@ void Block::report(){
 		bytesToStr(memAlive()), bytesToStr(allocations), block_duration.count(), accum.count()));
 
 }
-// generates table with a list of blocks, shows name and stats
-std::string reportBlocks()
+
+namespace
 {
-	auto &blocks = getBlockStatsContainer();
+	//Node of path with the stats of every thread added up, or nothing when no block closed there
+	//or below it. The registry must be locked.
+	std::optional<BlockTreeNode> treeNode(const BlockPath& path, const std::vector<PathStats>& stats)
+	{
+		BlockTreeNode node;
+		node.name = path.name;
+		node.location = path.location;
+		if (path.id < stats.size())
+		{
+			node.count = stats[path.id].count;
+			node.inclusive = stats[path.id].inclusive;
+			node.exclusive = stats[path.id].exclusive;
+			node.allocated = stats[path.id].allocated;
+			if (stats[path.id].durations)
+				node.durations = *stats[path.id].durations;
+			if (stats[path.id].countedCalls > 0)
+			{
+				auto const& counters = stats[path.id].counters;
+				node.counters = BlockCounters{stats[path.id].countedCalls, counters[PerfCounterGroup::CYCLES],
+					counters[PerfCounterGroup::INSTRUCTIONS], counters[PerfCounterGroup::CACHE_MISSES],
+					counters[PerfCounterGroup::BRANCH_MISSES]};
+			}
+		}
+		for (auto const* child: path.children)
+			if (auto childNode = treeNode(*child, stats))
+				node.children.push_back(std::move(*childNode));
+		if (node.count == 0 and node.children.empty())
+			return std::nullopt;
+		//Slowest first
+		std::stable_sort(node.children.begin(), node.children.end(), [](auto const& a, auto const& b) {
+			return a.inclusive > b.inclusive;
+		});
+		return node;
+	}
 
-	size_t maxWidth = 0;
-	for (const auto &[key, val] : blocks)
+	double micros(uint64_t nanoseconds)
 	{
-		maxWidth = std::max(maxWidth, key.view().size());
+		return static_cast<double>(nanoseconds) / 1e3;
 	}
 
-	std::ostringstream report;
+	//Optional columns of the report, shown when some block has their data.
+	struct TreeColumns
+	{
+		size_t width;
+		bool distributions;
+		bool counters;
+	};
 
-	// header
-	report << std::format("| {:<{}} | times created | accumulated time |\n", "name", maxWidth);
+	void treeToText(const BlockTreeNode& node, size_t depth, const TreeColumns& columns, std::ostringstream& out)
+	{
+		const size_t width = columns.width;
+		const std::string name = std::string(2 * depth, ' ') + node.name;
+		const double mean = node.count ? node.inclusive.count() * 1e6 / static_cast<double>(node.count) : 0.0;
+		out << std::format("| {:<{}} | {:>10} | {:>14.6f} | {:>14.6f} | {:>10} | {:>10.4g} |", name, width, node.count,
+			node.inclusive.count(), node.exclusive.count(), bytesToStr(node.allocated), mean);
+		if (columns.distributions and node.durations)
+		{
+			auto const& h = *node.durations;
+			out << std::format(" {:>10.4g} | {:>10.4g} | {:>10.4g} | {:>10.4g} | {:>10.4g} |", micros(h.min()),
+				micros(h.percentile(0.5)), micros(h.percentile(0.9)), micros(h.percentile(0.99)), micros(h.max()));
+		}
+		else if (columns.distributions)
+		{
+			out << std::format(" {0:>10} | {0:>10} | {0:>10} | {0:>10} | {0:>10} |", "-");
+		}
+		if (columns.counters and node.counters)
+		{
+			auto const& c = *node.counters;
+			out << std::format(" {:>6.2f} | {:>11.3f} | {:>12.3f} |", c.ipc(), c.cacheMissesPerKiloInstruction(),
+				c.branchMissesPerKiloInstruction());
+		}
+		else if (columns.counters)
+		{
+			out << std::format(" {:>6} | {:>11} | {:>12} |", "-", "-", "-");
+		}
+		out << "\n";
+		for (auto const& child: node.children)
+			treeToText(child, depth + 1, columns, out);
+	}
+
+	template<typename Predicate>
+	bool anyNode(const BlockTreeNode& node, Predicate&& predicate)
+	{
+		return predicate(node) or std::any_of(node.children.begin(), node.children.end(), [&](auto const& child) {
+			return anyNode(child, predicate);
+		});
+	}
+
+	size_t treeWidth(const BlockTreeNode& node, size_t depth)
+	{
+		size_t width = 2 * depth + node.name.size();
+		for (auto const& child: node.children)
+			width = std::max(width, treeWidth(child, depth + 1));
+		return width;
+	}
 
-	for (const auto &[name, stats] : blocks)
+	nlohmann::json treeToJson(const BlockTreeNode& node)
 	{
-		auto n         = stats.count_;
-		auto accum     = stats.t_;
-		auto accumTime = std::to_string(accum.count());
+		nlohmann::json res = {
+			{"name", node.name},
+			{"location", node.location},
+			{"count", node.count},
+			{"inclusive", node.inclusive.count()},
+			{"exclusive", node.exclusive.count()},
+			{"allocated", node.allocated},
+			{"children", nlohmann::json::array()}
+		};
+		if (node.durations)
+		{
+			auto const& h = *node.durations;
+			res["durations"] = {
+				{"min", static_cast<double>(h.min()) / 1e9},
+				{"mean", h.mean() / 1e9},
+				{"p50", static_cast<double>(h.percentile(0.5)) / 1e9},
+				{"p90", static_cast<double>(h.percentile(0.9)) / 1e9},
+				{"p99", static_cast<double>(h.percentile(0.99)) / 1e9},
+				{"max", static_cast<double>(h.max()) / 1e9}
+			};
+		}
+		if (node.counters)
+		{
+			auto const& c = *node.counters;
+			res["counters"] = {
+				{"calls", c.calls},
+				{"cycles", c.cycles},
+				{"instructions", c.instructions},
+				{"cacheMisses", c.cacheMisses},
+				{"branchMisses", c.branchMisses},
+				{"ipc", c.ipc()}
+			};
+		}
+		for (auto const& child: node.children)
+			res["children"].push_back(treeToJson(child));
+		return res;
+	}
+}
 
-		// I am assuming that there is not gonna be a gigantic number here
-		report << std::format("| {:<{}} | {:<14}| {:<17}|\n", name.view(), maxWidth, n, accumTime);
+BlockTreeNode getBlockTree()
+{
+	auto& registry = getBlockRegistry();
+	const std::scoped_lock lock(registry.mutex);
+	std::vector<PathStats> stats(registry.paths.size());
+	for (auto& thread: registry.threads)
+	{
+		const std::scoped_lock threadLock(thread->statsMutex);
+		for (size_t id = 0; id < thread->stats.size(); ++id)
+			stats[id] += thread->stats[id];
+	}
+	for (size_t id = 0; id < registry.exitedStats.size(); ++id)
+		stats[id] += registry.exitedStats[id];
+	return treeNode(registry.root(), stats).value_or(BlockTreeNode{});
+}
+
+// generates the call tree of the blocks as an indented table
+std::string reportBlocks()
+{
+	const auto tree = getBlockTree();
+	size_t width = 4;
+	for (auto const& child: tree.children)
+		width = std::max(width, treeWidth(child, 0));
+
+	const TreeColumns columns{width, anyNode(tree, [](auto const& node) { return node.durations.has_value(); }),
+		anyNode(tree, [](auto const& node) { return node.counters.has_value(); })};
+
+	std::ostringstream report;
+	// header
+	report << std::format("| {:<{}} | {:>10} | {:>14} | {:>14} | {:>10} | {:>10} |", "name", width, "calls",
+		"inclusive (s)", "exclusive (s)", "allocated", "mean (us)");
+	if (columns.distributions)
+		report << std::format(" {:>10} | {:>10} | {:>10} | {:>10} | {:>10} |", "min (us)", "p50 (us)", "p90 (us)",
+			"p99 (us)", "max (us)");
+	if (columns.counters)
+		report << std::format(" {:>6} | {:>11} | {:>12} |", "IPC", "cache MPKI", "branch MPKI");
+	report << "\n";
+	for (auto const& child: tree.children)
+		treeToText(child, 0, columns, report);
+	return report.str();
+}
+
+std::string reportBlocksJson()
+{
+	return treeToJson(getBlockTree()).dump(2);
+}
+
+// table with a row per thread and block name
+std::string reportBlocksByThread()
+{
+	std::map<std::pair<size_t, std::string_view>, BlockStats> blocks;
+	forEachBlockStats([&blocks](size_t thread, std::thread::id, const BlockPath& path, const PathStats& stats) {
+		auto& total = blocks[{thread, path.name}];
+		total.count_ += stats.count;
+		total.t_ += stats.inclusive;
+	});
+
+	size_t maxWidth = 4;
+	for (const auto &[key, val] : blocks)
+		maxWidth = std::max(maxWidth, key.second.size());
+
+	std::ostringstream report;
+	report << std::format("| thread | {:<{}} | times created | accumulated time |\n", "name", maxWidth);
+	for (const auto &[key, stats] : blocks)
+	{
+		auto accumTime = std::to_string(stats.t_.count());
+		auto thread = key.first == EXITED_BLOCK_THREADS ? std::string("exited") : std::to_string(key.first);
+		report << std::format("| {:<6} | {:<{}} | {:<14}| {:<17}|\n", thread, key.second, maxWidth, stats.count_, accumTime);
 	}
 	return report.str();
 }
 
 // Returns the accumulated stats for a given block name (across all closed
-// instances of the block name), or zeroed stats if the block was never recorded.
+// instances of the block name, in all threads), or zeroed stats if the block was never recorded.
 BlockStats getAccumulatedStats(const std::string& name)
 {
-	const auto &blocks = getBlockStatsContainer();
-	auto it = blocks.find(name);
-	if (it == blocks.end())
-		return {};
-	return it->second;
+	BlockStats res;
+	forEachBlockStats([&res, &name](size_t, std::thread::id, const BlockPath& path, const PathStats& stats) {
+		if (path.name != name)
+			return;
+		res.count_ += stats.count;
+		res.t_ += stats.inclusive;
+	});
+	return res;
+}
+
+std::vector<ThreadBlockStats> getAccumulatedStatsByThread(const std::string& name)
+{
+	std::vector<ThreadBlockStats> res;
+	forEachBlockStats([&res, &name](size_t thread, std::thread::id threadId, const BlockPath& path, const PathStats& stats) {
+		if (path.name != name)
+			return;
+		if (res.empty() or res.back().thread != thread)
+			res.push_back({thread, threadId, {}});
+		res.back().stats.count_ += stats.count;
+		res.back().stats.t_ += stats.inclusive;
+	});
+	return res;
+}
+
+size_t getBlockThreadIndex()
+{
+	return getThreadBlocks().index;
+}
+
+namespace
+{
+	void writeJsonString(std::ostream& out, std::string_view text)
+	{
+		out << '"';
+		for (char c: text)
+		{
+			if (c == '"' or c == '\\')
+				out << '\\' << c;
+			else if (static_cast<unsigned char>(c) < 0x20)
+				out << std::format("\\u{:04x}", static_cast<int>(c));
+			else
+				out << c;
+		}
+		out << '"';
+	}
+
+	void stopBlockTraceAtExit()
+	{
+		//Nobody could catch it at this point
+		try
+		{
+			if (getBlockRegistry().tracing.load())
+				stopBlockTrace();
+		}
+		catch (const TU::Exception&)
+		{
+		}
+	}
+}
+
+void startBlockTrace(const std::string& file, size_t maxEventsPerThread)
+{
+	auto& registry = getBlockRegistry();
+	const std::scoped_lock lock(registry.mutex);
+	if (registry.tracing.load())
+		throw TU::Exception("[Blocks] Block tracing already started");
+	for (auto& thread: registry.threads)
+	{
+		const std::scoped_lock threadLock(thread->statsMutex);
+		thread->trace.clear();
+		thread->droppedEvents = 0;
+	}
+	registry.retiredTraces.clear();
+	registry.traceStart = BlockClock::now();
+	registry.traceCapacity = maxEventsPerThread;
+	registry.traceFile = file;
+	if (not file.empty() and not registry.traceAtExit)
+	{
+		registry.traceAtExit = true;
+		std::atexit(stopBlockTraceAtExit);
+	}
+	registry.tracing.store(true, std::memory_order_release);
+}
+
+void stopBlockTrace()
+{
+	auto& registry = getBlockRegistry();
+	std::string file;
+	{
+		const std::scoped_lock lock(registry.mutex);
+		registry.tracing.store(false);
+		file = std::exchange(registry.traceFile, {});
+	}
+	if (file.empty())
+		return;
+	std::ofstream out(file);
+	if (not out)
+		throw TU::Exception(std::string("Could not open file:") + file);
+	writeBlockTrace(out);
+}
+
+size_t writeBlockTrace(std::ostream& out)
+{
+	auto& registry = getBlockRegistry();
+	const std::scoped_lock lock(registry.mutex);
+	size_t written = 0;
+	size_t dropped = 0;
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	auto writeThread = [&](size_t index, const std::vector<TraceEvent>& trace) {
+		if (trace.empty())
+			return;
+		out << (written == 0 ? "\n" : ",\n");
+		out << std::format(R"({{"name":"thread_name","ph":"M","pid":0,"tid":{},"args":{{"name":"thread {}"}}}})",
+			index, index);
+		for (auto const& event: trace)
+		{
+			auto const& path = registry.paths[event.pathId];
+			out << ",\n{\"name\":";
+			writeJsonString(out, path.name);
+			//Chrome wants microseconds
+			out << std::format(R"(,"cat":"block","ph":"X","ts":{:.3f},"dur":{:.3f},"pid":0,"tid":{},"args":{{"location":)",
+				event.start / 1e3, event.duration / 1e3, index);
+			writeJsonString(out, path.location);
+			out << "}}";
+			++written;
+		}
+	};
+	for (auto& thread: registry.threads)
+	{
+		const std::scoped_lock threadLock(thread->statsMutex);
+		writeThread(thread->index, thread->trace);
+		dropped += thread->droppedEvents;
+	}
+	for (auto const& retired: registry.retiredTraces)
+	{
+		writeThread(retired.index, retired.events);
+		dropped += retired.droppedEvents;
+	}
+	out << std::format("\n],\"otherData\":{{\"droppedEvents\":{}}}}}\n", dropped);
+	return written;
 }
 
 
@@ -3,7 +3,15 @@
 //
 
 #pragma once
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <ostream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "tubul_histogram.h"
 #include "tubul_time.h"
 #define TUBUL_BLOCK TU::Block ___aux_t_block(__FUNCTION__)
 
@@ -21,6 +29,16 @@ struct BlockStats
 	TimeDuration t_;
 };
 
+struct ThreadBlocks;
+
+/** Measures (and logs, depending on LogType) the scope where it lives, see api/tubul.h. Blocks
+ * are timed with steady_clock, and a thread finds the location of a block it opened before
+ * without locks or hashing, so a block costs little more than two clock reads.
+ *
+ * Every thread has its own stack of blocks, so a block must close in the thread that opened it,
+ * after the blocks opened inside it. A block kept open across a co_await that resumes in another
+ * thread (see tubul_task.h), or closed out of order, is dropped from the stats with a warning.
+ */
 struct Block
 {
 	enum class LogType
@@ -42,14 +60,155 @@ struct Block
 	void report();
 
 private:
+	void open(std::string_view name, bool copyName);
+
+	ThreadBlocks* owner_;
 	size_t index_;
 	LogType whenToLog_;
 };
 
 std::string getCurrentBlockLocation();
 
+/** True when the block location (like "main.loadData.read") matches the pattern: a glob where
+ * '*' matches any sequence of characters (dots included) and '?' a single one. Several
+ * patterns can be given separated by commas: "main.loadData.*,main.solve".
+ */
+bool matchesBlockPattern(std::string_view pattern, std::string_view location);
+
+/** Registers a block pattern (see matchesBlockPattern) and returns the bit that represents it
+ * in getCurrentBlockFilterMask(). Every location is matched only once against every pattern,
+ * when the first block opens there (or when the pattern is registered). The same pattern always
+ * gets the same bit; at most 64 different patterns can be registered.
+ */
+uint64_t registerBlockFilter(const std::string& pattern);
+
+/** Makes the blocks whose location matches the pattern (see matchesBlockPattern) keep a
+ * histogram of their durations, so reportBlocks() shows their min, p50, p90, p99 and max and not
+ * only the mean. It costs a few kb per location and thread, and some nanoseconds per block.
+ */
+void enableBlockHistograms(const std::string& pattern = "*");
+
+/** Makes every block read the hardware performance counters of its thread (cycles,
+ * instructions, cache and branch misses, see PerfCounterGroup) when it opens and closes, so
+ * reportBlocks() shows the IPC and the misses per thousand instructions of each location. Reading
+ * the counters is a system call, so it adds around a microsecond per block. Every thread opening
+ * blocks while they are on holds four perf file descriptors until it exits. Returns false (and
+ * warns once) when the counters are not available, and blocks keep measuring only time.
+ */
+bool enableBlockCounters();
+void disableBlockCounters();
+
+/** Number that identifies the current block location (0 outside of any block), to be turned
+ * into the location later with getBlockPathLocation. It only reads a thread_local, so it can be
+ * called from a signal handler.
+ */
+size_t getCurrentBlockPathId() noexcept;
+
+/** Location (like "main.loadData.read") of a number given by getCurrentBlockPathId. */
+std::string getBlockPathLocation(size_t pathId);
+
+/** Bits of the registered block filters that match the current block location. */
+uint64_t getCurrentBlockFilterMask();
+
+/** Hardware counters of the blocks of a location (see enableBlockCounters), added up over the
+ * calls that could read them.
+ */
+struct BlockCounters
+{
+	size_t calls = 0;
+	uint64_t cycles = 0;
+	uint64_t instructions = 0;
+	uint64_t cacheMisses = 0;
+	uint64_t branchMisses = 0;
+
+	[[nodiscard]] double ipc() const { return cycles ? static_cast<double>(instructions) / static_cast<double>(cycles) : 0.0; }
+	[[nodiscard]] double cacheMissesPerKiloInstruction() const { return perKiloInstruction(cacheMisses); }
+	[[nodiscard]] double branchMissesPerKiloInstruction() const { return perKiloInstruction(branchMisses); }
+
+private:
+	[[nodiscard]] double perKiloInstruction(uint64_t events) const
+	{
+		return instructions ? 1000.0 * static_cast<double>(events) / static_cast<double>(instructions) : 0.0;
+	}
+};
+
+/** Node of the call tree of the blocks: what the blocks closed at one location (like
+ * "main.loadData.read") measured, in all threads. The inclusive time counts the blocks opened
+ * inside, the exclusive one doesn't. Allocated counts the bytes allocated with new while the
+ * block was open (see memLifetime), children included.
+ */
+struct BlockTreeNode
+{
+	std::string name;
+	std::string location;
+	size_t count = 0;
+	TimeDuration inclusive = TimeDuration::zero();
+	TimeDuration exclusive = TimeDuration::zero();
+	size_t allocated = 0;
+	//Inclusive durations in nanoseconds, when enableBlockHistograms covers this location.
+	std::optional<Histogram> durations;
+	//When enableBlockCounters was on while blocks closed here.
+	std::optional<BlockCounters> counters;
+	std::vector<BlockTreeNode> children;
+};
+
+/** Call tree of every block closed so far. The root has no name: its children are the
+ * outermost blocks. Children are sorted by inclusive time, slowest first.
+ */
+BlockTreeNode getBlockTree();
+
+/** Blocks can be used from any thread: every thread has its own stack of blocks (and so its own
+ * location) and its own stats, which are added up when reporting. The report shows the call
+ * tree as an indented table.
+ */
 std::string reportBlocks();
 
+/** The call tree as JSON, with the fields of BlockTreeNode (times in seconds). */
+std::string reportBlocksJson();
+
+/** Table of the blocks by name, with a row per thread. Threads are numbered in the order they
+ * opened their first block (see getBlockThreadIndex). The threads that already exited are
+ * added up in a single "exited" row.
+ */
+std::string reportBlocksByThread();
+
 BlockStats getAccumulatedStats(const std::string& name);
 
+/** Thread number of the stats left by the threads that already exited. When a thread exits,
+ * its stats are added to the ones of the threads that exited before, and the rest of its block
+ * data (including its hardware counters) is released.
+ */
+inline constexpr size_t EXITED_BLOCK_THREADS = std::numeric_limits<size_t>::max();
+
+struct ThreadBlockStats
+{
+	size_t thread;
+	std::thread::id threadId;
+	BlockStats stats;
+};
+
+/** Accumulated stats of a block name in every running thread that used it, plus one entry for
+ * the threads that exited (EXITED_BLOCK_THREADS), if any of them used it.
+ */
+std::vector<ThreadBlockStats> getAccumulatedStatsByThread(const std::string& name);
+
+/** Number of the calling thread in the block reports. */
+size_t getBlockThreadIndex();
+
+/** Starts recording when every block runs, in every thread, for a timeline view. Each closed
+ * block costs a small event in a buffer of its thread; a thread keeps at most
+ * maxEventsPerThread of them and counts the rest as dropped. When file is given, the trace is
+ * written there by stopBlockTrace(), or at exit if tracing is still on. Blocks still open when
+ * the trace is written are not in it.
+ */
+void startBlockTrace(const std::string& file = {}, size_t maxEventsPerThread = 1 << 20);
+
+/** Stops recording, and writes the trace to the file given to startBlockTrace (if any). */
+void stopBlockTrace();
+
+/** Writes the events recorded so far as Chrome Trace Event JSON (it opens in chrome://tracing,
+ * Perfetto or speedscope). Returns the number of events.
+ */
+size_t writeBlockTrace(std::ostream& out);
+
 }
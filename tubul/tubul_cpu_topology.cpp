@@ -0,0 +1,155 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include "tubul_cpu_topology.h"
+#include "tubul_file_utils.h"
+#include "tubul_string.h"
+
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <thread>
+
+#if defined(TUBUL_LINUX)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace TU
+{
+
+size_t CpuTopology::cpuCount() const
+{
+	size_t total = 0;
+	for (const auto& node: nodes)
+		total += node.cpus.size();
+	return total;
+}
+
+std::vector<size_t> parseCpuList(std::string_view cpuList)
+{
+	std::vector<size_t> res;
+	for (auto item: split(trim(cpuList), ","))
+	{
+		item = trim(item);
+		if (item.empty())
+			continue;
+		//Each item is either a single cpu or an inclusive range "a-b"
+		auto dash = item.find('-');
+		auto first = item.substr(0, dash);
+		size_t begin = 0;
+		auto [p, ec] = std::from_chars(first.data(), first.data() + first.size(), begin);
+		if (ec != std::errc())
+			continue;
+		size_t end = begin;
+		if (dash != std::string_view::npos)
+		{
+			auto last = item.substr(dash + 1);
+			auto [p2, ec2] = std::from_chars(last.data(), last.data() + last.size(), end);
+			if (ec2 != std::errc())
+				continue;
+		}
+		for (size_t cpu = begin; cpu <= end; ++cpu)
+			res.push_back(cpu);
+	}
+	return res;
+}
+
+//Groups the cpus of a node by physical core, using the list of hyperthread siblings
+//of each cpu. If the siblings are not available, every cpu is a core on its own.
+static std::vector<std::vector<size_t>> groupCpusByCore(const std::filesystem::path& nodeDir, const std::vector<size_t>& cpus)
+{
+	std::vector<std::vector<size_t>> cores;
+	std::vector<size_t> assigned;
+	for (auto cpu: cpus)
+	{
+		if (std::find(assigned.begin(), assigned.end(), cpu) != assigned.end())
+			continue;
+		auto siblingsFile = nodeDir / ("cpu" + std::to_string(cpu)) / "topology" / "thread_siblings_list";
+		std::vector<size_t> siblings;
+		if (std::filesystem::exists(siblingsFile))
+			siblings = parseCpuList(readToString(siblingsFile.string()));
+		//Only keep siblings that are part of this node, and always the cpu itself.
+		std::vector<size_t> core;
+		for (auto s: siblings)
+			if (std::find(cpus.begin(), cpus.end(), s) != cpus.end())
+				core.push_back(s);
+		if (std::find(core.begin(), core.end(), cpu) == core.end())
+			core.push_back(cpu);
+		assigned.insert(assigned.end(), core.begin(), core.end());
+		cores.push_back(std::move(core));
+	}
+	return cores;
+}
+
+static CpuTopology defaultTopology()
+{
+	CpuTopology res;
+	NumaNode node{0, {}, {}};
+	size_t count = std::max(1U, std::thread::hardware_concurrency());
+	for (size_t cpu = 0; cpu < count; ++cpu)
+	{
+		node.cpus.push_back(cpu);
+		node.cores.push_back({cpu});
+	}
+	res.nodes.push_back(std::move(node));
+	return res;
+}
+
+CpuTopology readCpuTopology(const std::string& sysNodePath)
+{
+	namespace fs = std::filesystem;
+	CpuTopology res;
+	std::error_code ec;
+	if (not fs::is_directory(sysNodePath, ec))
+		return defaultTopology();
+
+	for (const auto& entry: fs::directory_iterator(sysNodePath, ec))
+	{
+		auto name = entry.path().filename().string();
+		if (not name.starts_with("node") or not entry.is_directory())
+			continue;
+		size_t id = 0;
+		auto [p, err] = std::from_chars(name.data() + 4, name.data() + name.size(), id);
+		if (err != std::errc() or p != name.data() + name.size())
+			continue;
+		auto cpuListFile = entry.path() / "cpulist";
+		if (not fs::exists(cpuListFile))
+			continue;
+		auto cpus = parseCpuList(readToString(cpuListFile.string()));
+		//Memory-only nodes have no cpus, and are of no use to place threads.
+		if (cpus.empty())
+			continue;
+		auto cores = groupCpusByCore(entry.path(), cpus);
+		res.nodes.push_back({id, std::move(cpus), std::move(cores)});
+	}
+	if (res.nodes.empty())
+		return defaultTopology();
+
+	std::sort(res.nodes.begin(), res.nodes.end(), [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+	return res;
+}
+
+bool pinCurrentThread(const std::vector<size_t>& cpus)
+{
+	if (cpus.empty())
+		return false;
+#if defined(TUBUL_LINUX)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (auto cpu: cpus)
+	{
+		if (cpu >= CPU_SETSIZE)
+			return false;
+		CPU_SET(cpu, &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	//Neither macos nor windows (for more than 64 cpus) provide a simple way to do this,
+	//so we just let the scheduler do its job.
+	return false;
+#endif
+}
+
+}
@@ -0,0 +1,51 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace TU
+{
+
+/** Description of a NUMA node as reported by the OS. Each node knows the
+ * logical cpus that belong to it, and those cpus grouped by physical core
+ * (i.e. hyperthreads of the same core are stored together).
+ */
+struct NumaNode
+{
+	size_t id;
+	std::vector<size_t> cpus;
+	std::vector<std::vector<size_t>> cores;
+};
+
+/** The layout of the machine. On linux it is read from /sys/devices/system/node,
+ * on any other platform (or if the sysfs files are missing, like in some containers)
+ * we report a single node containing hardware_concurrency() cpus, one per core.
+ */
+struct CpuTopology
+{
+	std::vector<NumaNode> nodes;
+
+	[[nodiscard]] size_t nodeCount() const { return nodes.size(); }
+	[[nodiscard]] size_t cpuCount() const;
+};
+
+/** Reads the topology of the machine. The path can be changed to point to a copy of
+ * the sysfs tree, which is mostly useful for testing.
+ */
+CpuTopology readCpuTopology(const std::string& sysNodePath = "/sys/devices/system/node");
+
+/** Parses the kernel's cpulist format (like "0-3,8,10-11") into the list of cpus. */
+std::vector<size_t> parseCpuList(std::string_view cpuList);
+
+/** Restricts the calling thread to run only on the given cpus. Returns false if the
+ * platform doesn't support it or the OS refused the request, in which case the thread
+ * keeps running wherever the scheduler wants.
+ */
+bool pinCurrentThread(const std::vector<size_t>& cpus);
+
+}
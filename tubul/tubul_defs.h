@@ -29,12 +29,22 @@
 #include "tubul_params.h"
 #include "tubul_logger.h"
 #include "tubul_log_engine.h"
+#include "tubul_log_file_sink.h"
+#include "tubul_binary_log.h"
 #include "tubul_thread_pool.h"
+#include "tubul_task.h"
+#include "tubul_histogram.h"
+#include "tubul_mpmc_queue.h"
+#include "tubul_sort.h"
+#include "tubul_parallel_sort.h"
 #include "tubul_graph.h"
 #include "tubul_stringid.h"
 #include "tubul_flat_map.h"
 #include "tubul_flat_set.h"
 #include "tubul_enumerate.h"
 #include "tubul_mem_utils.h"
+#include "tubul_profiler.h"
+#include "tubul_perf_counters.h"
+#include "tubul_metrics.h"
 #include "tubul_podvector.h"
 #include "tubul_smallvector.h"
\ No newline at end of file
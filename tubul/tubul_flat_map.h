@@ -6,9 +6,13 @@
 #include <functional>
 #include <vector>
 #include <utility>
+#include "tubul_sort.h"
 
 namespace TU {
 
+    //Only the constructors sorting on a pool need it, and those need tubul_parallel_sort.h too.
+    class ThreadPool;
+
     namespace detail {
         //This object is used by the FlatMap to wrap a comparison function
         //in a way that's more flexible for the container.
@@ -104,20 +108,33 @@ namespace TU {
                 const A &alloc = A())
                 : Base(alloc), MyCompare(comp) {}
 
+        //Bulk construction sorts the elements once. Arithmetic keys with the default
+        //comparison are radix sorted.
         template<class InputIterator>
         FlatMap(InputIterator first, InputIterator last,
                 const key_compare &comp = key_compare(),
                 const A &alloc = A())
                 : Base(first, last, alloc), MyCompare(comp) {
             MyCompare &me = *this;
-            std::sort(begin(), end(), me);
+            detail::flatContainerSort<C, KeyType>(begin(), end(), me, [](const value_type& v) { return v.first; });
         }
 
         FlatMap( std::initializer_list<value_type> slist,const key_compare &comp = key_compare(),
                 const A &alloc = A())
                 : Base(slist, alloc), MyCompare(comp) {
-            MyCompare& me = *this;
-            std::sort(begin(), end(), me);
+            MyCompare &me = *this;
+            detail::flatContainerSort<C, KeyType>(begin(), end(), me, [](const value_type& v) { return v.first; });
+        }
+
+        //Same as the range constructor, but sorting with parallelSort on the given pool (include
+        //tubul_parallel_sort.h to use it).
+        template<class InputIterator>
+        FlatMap(ThreadPool& pool, InputIterator first, InputIterator last,
+                const key_compare &comp = key_compare(),
+                const A &alloc = A())
+                : Base(first, last, alloc), MyCompare(comp) {
+            MyCompare &me = *this;
+            parallelSort(pool, begin(), end(), me);
         }
 
         FlatMap &operator=(const FlatMap &rhs) {
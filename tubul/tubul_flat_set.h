@@ -5,9 +5,13 @@
 #include <functional>
 #include <vector>
 #include <utility>
+#include "tubul_sort.h"
 
 namespace TU {
 
+    //Only the constructors sorting on a pool need it, and those need tubul_parallel_sort.h too.
+    class ThreadPool;
+
     namespace detail {
         template<class Value, class CompareFunc>
         class FlatSetCompare : public CompareFunc {
@@ -84,26 +88,36 @@ namespace TU {
                 const A &alloc = A())
                 : Base(alloc), MyCompare(comp) {}
 
+        //Bulk construction sorts the elements once. Arithmetic values with the default
+        //comparison are radix sorted.
         template<class InputIterator>
         FlatSet(InputIterator first, InputIterator last,
                 const key_compare &comp = key_compare(),
                 const A &alloc = A())
                 : Base(first, last, alloc), MyCompare(comp) {
             MyCompare &me = *this;
-            std::sort(begin(), end(), me);
-            //Ensure elements are unique
-            auto new_end = std::unique(begin(), end() );
-            Base::erase( new_end, end());
+            detail::flatContainerSort<C, ValueType>(begin(), end(), me, [](const value_type& v) { return v; });
+            removeDuplicates();
         }
 
         FlatSet( std::initializer_list<value_type> slist,const key_compare &comp = key_compare(),
                 const A &alloc = A())
                 : Base(slist,alloc), MyCompare(comp) {
             MyCompare &me = *this;
-            std::sort(begin(), end(), me);
-            //Ensure elements are unique
-            auto new_end = std::unique(begin(), end() );
-            Base::erase( new_end, end());
+            detail::flatContainerSort<C, ValueType>(begin(), end(), me, [](const value_type& v) { return v; });
+            removeDuplicates();
+        }
+
+        //Same as the range constructor, but sorting with parallelSort on the given pool (include
+        //tubul_parallel_sort.h to use it).
+        template<class InputIterator>
+        FlatSet(ThreadPool& pool, InputIterator first, InputIterator last,
+                const key_compare &comp = key_compare(),
+                const A &alloc = A())
+                : Base(first, last, alloc), MyCompare(comp) {
+            MyCompare &me = *this;
+            parallelSort(pool, begin(), end(), me);
+            removeDuplicates();
         }
 
         FlatSet &operator=(const FlatSet &rhs) {
@@ -379,6 +393,13 @@ namespace TU {
         template<class V1, class C1, class A1>
         friend bool operator<=(const FlatSet<V1, C1, A1> &lhs,
                                const FlatSet<V1, C1, A1> &rhs);
+
+    private:
+        //Ensure elements are unique, once sorted
+        void removeDuplicates() {
+            auto new_end = std::unique(begin(), end() );
+            Base::erase( new_end, end());
+        }
     }; //end of class FlatSet
 
 
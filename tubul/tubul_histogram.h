@@ -0,0 +1,154 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <limits>
+
+namespace TU
+{
+
+/** Histogram is a fixed-memory histogram of unsigned values (like durations in
+ * nanoseconds) using logarithmic buckets, in the spirit of HdrHistogram. Every power of
+ * two range is split in SUB_BUCKETS linear buckets, so any recorded value is known with a
+ * relative error below 1/SUB_BUCKETS (12.5%) no matter its magnitude, while the whole
+ * histogram takes a few kb regardless of how many values are recorded.
+ * Recording is a couple of relaxed atomic increments, so it can be shared between threads,
+ * and read (for example to report percentiles) while other threads keep recording.
+ */
+class Histogram
+{
+public:
+	static constexpr size_t SUB_BUCKET_BITS = 3;
+	static constexpr size_t SUB_BUCKETS = size_t{1} << SUB_BUCKET_BITS;
+	static constexpr size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	Histogram() = default;
+
+	Histogram(const Histogram& other) { merge(other); }
+
+	Histogram& operator=(const Histogram& other)
+	{
+		if (this != &other)
+		{
+			reset();
+			merge(other);
+		}
+		return *this;
+	}
+
+	void record(uint64_t value)
+	{
+		buckets_[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+		count_.fetch_add(1, std::memory_order_relaxed);
+		sum_.fetch_add(value, std::memory_order_relaxed);
+		updateMin(value);
+		updateMax(value);
+	}
+
+	void merge(const Histogram& other)
+	{
+		for (size_t i = 0; i < BUCKET_COUNT; ++i)
+		{
+			auto c = other.buckets_[i].load(std::memory_order_relaxed);
+			if (c)
+				buckets_[i].fetch_add(c, std::memory_order_relaxed);
+		}
+		count_.fetch_add(other.count_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		sum_.fetch_add(other.sum_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		updateMin(other.min_.load(std::memory_order_relaxed));
+		updateMax(other.max_.load(std::memory_order_relaxed));
+	}
+
+	void reset()
+	{
+		for (auto& b: buckets_)
+			b.store(0, std::memory_order_relaxed);
+		count_.store(0, std::memory_order_relaxed);
+		sum_.store(0, std::memory_order_relaxed);
+		min_.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+		max_.store(0, std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+	[[nodiscard]] uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+	[[nodiscard]] uint64_t min() const { return count() ? min_.load(std::memory_order_relaxed) : 0; }
+	[[nodiscard]] uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+	[[nodiscard]] double mean() const
+	{
+		auto c = count();
+		return c ? static_cast<double>(sum()) / static_cast<double>(c) : 0.0;
+	}
+
+	/** Value below which the given fraction (in [0,1]) of the recorded values are. The answer
+	 * is the upper limit of the bucket where that value lives, clamped to the real min/max.
+	 */
+	[[nodiscard]] uint64_t percentile(double fraction) const
+	{
+		auto total = count();
+		if (total == 0)
+			return 0;
+		fraction = std::clamp(fraction, 0.0, 1.0);
+		auto target = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * static_cast<double>(total) + 0.5));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < BUCKET_COUNT; ++i)
+		{
+			seen += buckets_[i].load(std::memory_order_relaxed);
+			if (seen >= target)
+				return std::clamp(bucketUpperBound(i), min(), max());
+		}
+		return max();
+	}
+
+	static size_t bucketIndex(uint64_t value)
+	{
+		if (value < SUB_BUCKETS)
+			return static_cast<size_t>(value);
+		const size_t exponent = std::bit_width(value) - 1;
+		const size_t shift = exponent - SUB_BUCKET_BITS;
+		const size_t subBucket = static_cast<size_t>(value >> shift) - SUB_BUCKETS;
+		return (shift + 1) * SUB_BUCKETS + subBucket;
+	}
+
+	static uint64_t bucketUpperBound(size_t index)
+	{
+		if (index < SUB_BUCKETS)
+			return index;
+		const size_t shift = index / SUB_BUCKETS - 1;
+		const uint64_t subBucket = index % SUB_BUCKETS;
+		const uint64_t next = (SUB_BUCKETS + subBucket + 1) << shift;
+		return next - 1;
+	}
+
+private:
+	void updateMin(uint64_t value)
+	{
+		auto current = min_.load(std::memory_order_relaxed);
+		while (value < current and not min_.compare_exchange_weak(current, value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	void updateMax(uint64_t value)
+	{
+		auto current = max_.load(std::memory_order_relaxed);
+		while (value > current and not max_.compare_exchange_weak(current, value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets_ = {};
+	std::atomic<uint64_t> count_ = 0;
+	std::atomic<uint64_t> sum_ = 0;
+	std::atomic<uint64_t> min_ = std::numeric_limits<uint64_t>::max();
+	std::atomic<uint64_t> max_ = 0;
+};
+
+}
@@ -3,33 +3,89 @@
 //
 
 #include "tubul_log_engine.h"
+#include "tubul_blocks.h"
+#include "tubul_exception.h"
+#include "tubul_mpmc_queue.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <ctime>
 #include <fstream>
-#include <sstream>
-#include <iomanip>
 #include <iostream>
 #include <mutex>
+#include <semaphore>
+#include <span>
+#include <thread>
 
 namespace TU {
 
-static
-    auto getFormattedTimestamp() {
+namespace {
+    //Last timestamp formatted by this thread, both without and with milliseconds. Log lines
+    //have second resolution, so while we stay in the same minute only the seconds (and the
+    //milliseconds) change and we just rewrite those digits.
+    struct TimestampCache {
+        static constexpr size_t BUFFER_SIZE = 48;
+
+        bool valid = false;
+        time_t minuteStart = 0;
+        time_t second = 0;
+        size_t secondsPos = 0;
+        size_t plainLength = 0;
+        size_t millisLength = 0;
+        std::array<char, BUFFER_SIZE> plain = {};
+        std::array<char, BUFFER_SIZE> millis = {};
+    };
+
+    void writeDigits(char *dest, unsigned value, size_t digits) {
+        for (size_t i = digits; i > 0; --i) {
+            dest[i - 1] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        }
+    }
+}
 
-		using namespace std::chrono;
-        auto nowTime = system_clock::now();
-        auto tnow = system_clock::to_time_t(nowTime);
-		std::tm buf;
+    std::string_view formatLogTimestamp(std::chrono::system_clock::time_point time, bool milliseconds) {
+        using namespace std::chrono;
+        thread_local TimestampCache cache;
+
+        const auto second = floor<seconds>(time);
+        const time_t tnow = system_clock::to_time_t(second);
+        if (not cache.valid or tnow < cache.minuteStart or tnow >= cache.minuteStart + 60) {
+            std::tm buf;
 #ifdef TUBUL_WINDOWS
-        //Windows bad people changed the api!!
-        localtime_s(&buf, &tnow);
+            //Windows bad people changed the api!!
+            localtime_s(&buf, &tnow);
 #else
-		localtime_r(&tnow, &buf);
+            localtime_r(&tnow, &buf);
 #endif
+            std::array<char, TimestampCache::BUFFER_SIZE> base;
+            const size_t length = std::strftime(base.data(), base.size() - 8, "%Y-%m-%d %H:%M:%S", &buf);
+            const std::string_view plainSuffix = " - ";
+            const std::string_view millisSuffix = ".000 - ";
+            std::copy_n(base.data(), length, cache.plain.data());
+            std::copy(plainSuffix.begin(), plainSuffix.end(), cache.plain.data() + length);
+            std::copy_n(base.data(), length, cache.millis.data());
+            std::copy(millisSuffix.begin(), millisSuffix.end(), cache.millis.data() + length);
+            cache.plainLength = length + plainSuffix.size();
+            cache.millisLength = length + millisSuffix.size();
+            cache.secondsPos = length - 2;
+            cache.minuteStart = tnow - buf.tm_sec;
+            cache.valid = true;
+        } else if (tnow != cache.second) {
+            const auto secondsInMinute = static_cast<unsigned>(tnow - cache.minuteStart);
+            writeDigits(cache.plain.data() + cache.secondsPos, secondsInMinute, 2);
+            writeDigits(cache.millis.data() + cache.secondsPos, secondsInMinute, 2);
+        }
+        cache.second = tnow;
 
-		std::ostringstream oss;
-		oss << std::put_time(&buf, "%Y-%m-%d %H:%M:%S - ") ;
-		return oss.str();
-	}
+        if (not milliseconds)
+            return {cache.plain.data(), cache.plainLength};
+        const auto ms = static_cast<unsigned>(duration_cast<std::chrono::milliseconds>(time - second).count());
+        writeDigits(cache.millis.data() + cache.secondsPos + 3, ms, 3);
+        return {cache.millis.data(), cache.millisLength};
+    }
 
     int getVersion(){ return 0; }
 
@@ -43,31 +99,193 @@ static
 
     }
 
+    /** Queue of pending messages and the thread writing them. Besides messages, the queue
+     * carries markers asking the writer to report back once everything before them is
+     * written (flush) or to finish (stop). Callbacks run in the writer thread and may log
+     * again: the writer never waits on its own queue, so a full queue drops those messages and
+     * a flush from there returns right away.
+     */
+    struct LogEngine::AsyncWriter {
+        struct Record {
+            enum class Kind : uint8_t { MESSAGE, FLUSH, STOP };
+
+            Kind kind = Kind::MESSAGE;
+            LogLevel level = LogLevel::INFO;
+            std::chrono::system_clock::time_point time;
+            uint64_t blockMask = 0;
+            std::string text;
+            std::binary_semaphore* done = nullptr;
+        };
+
+        AsyncWriter(LogEngine& engine, AsyncLogOptions options) :
+                options_(options),
+                queue_(options.queueCapacity),
+                thread_(&AsyncWriter::run, this, std::ref(engine)) {
+        }
+
+        bool onWriterThread() const {
+            return current_ == this;
+        }
+
+        void push(Record&& record) {
+            if (record.kind == Record::Kind::MESSAGE and
+                (options_.overflow == LogOverflowPolicy::DROP or onWriterThread())) {
+                if (not queue_.tryPush(std::move(record)))
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            queue_.push(std::move(record));
+        }
+
+        //Blocks until the writer reaches a marker of the given kind.
+        void sendMarker(Record::Kind kind) {
+            //Only the writer could reach the marker
+            if (onWriterThread())
+                return;
+            std::binary_semaphore done(0);
+            Record marker;
+            marker.kind = kind;
+            marker.done = &done;
+            queue_.push(std::move(marker));
+            done.acquire();
+        }
+
+        void stop() {
+            sendMarker(Record::Kind::STOP);
+            thread_.join();
+        }
+
+        void run(LogEngine& engine) {
+            current_ = this;
+            std::vector<Record> batch;
+            batch.reserve(options_.maxBatch);
+            uint64_t reportedDrops = 0;
+            bool running = true;
+            while (running) {
+                //Sleep until there's something to write, then grab as much as we can at once.
+                batch.emplace_back();
+                queue_.pop(batch.back());
+                Record record;
+                while (batch.size() < options_.maxBatch and queue_.tryPop(record))
+                    batch.push_back(std::move(record));
+
+                std::vector<std::binary_semaphore*> waiting;
+                {
+                    const std::scoped_lock lock(engine.loggersMutex_);
+                    for (auto& item: batch) {
+                        if (item.kind == Record::Kind::MESSAGE) {
+                            //The writer must survive a failing sink, or nothing else would be logged.
+                            try {
+                                engine.dispatch(item.level, item.text, item.time, item.blockMask, false);
+                            } catch (...) {
+                            }
+                            continue;
+                        }
+                        waiting.push_back(item.done);
+                        if (item.kind == Record::Kind::STOP)
+                            running = false;
+                    }
+                    auto drops = dropped_.load(std::memory_order_relaxed);
+                    if (drops != reportedDrops) {
+                        engine.dispatch(LogLevel::WARNING, "WARNING: " + std::to_string(drops - reportedDrops) +
+                                        " log messages were dropped (async log queue full)",
+                                        std::chrono::system_clock::now(), 0, false);
+                        reportedDrops = drops;
+                    }
+                    engine.flushStreams();
+                }
+                batch.clear();
+                for (auto* done: waiting)
+                    done->release();
+            }
+        }
+
+        //The writer running in this thread, if any
+        static inline thread_local const AsyncWriter* current_ = nullptr;
+
+        const AsyncLogOptions options_;
+        MPMCQueue<Record> queue_;
+        std::atomic<uint64_t> dropped_ = 0;
+        std::thread thread_;
+    };
+
+    /** Thread flushing the log files every half of the shortest flushInterval, so a line waits at
+     * most about one and a half times its interval. It's only needed in synchronous mode, where
+     * files are otherwise flushed only when something is logged, but it's harmless in async mode.
+     */
+    struct LogEngine::FileFlusher {
+        FileFlusher(LogEngine& engine, std::chrono::milliseconds interval) :
+                period_(std::max(std::chrono::milliseconds(1), interval / 2)),
+                thread_(&FileFlusher::run, this, std::ref(engine)) {
+        }
+
+        ~FileFlusher() {
+            {
+                std::lock_guard lock(mutex_);
+                exit_ = true;
+            }
+            cv_.notify_one();
+            thread_.join();
+        }
+
+        //Files with shorter intervals make the thread check more often
+        void useInterval(std::chrono::milliseconds interval) {
+            {
+                std::lock_guard lock(mutex_);
+                period_ = std::min(period_, std::max(std::chrono::milliseconds(1), interval / 2));
+            }
+            cv_.notify_one();
+        }
+
+        void run(LogEngine& engine) {
+            std::unique_lock lock(mutex_);
+            while (not exit_) {
+                cv_.wait_for(lock, period_, [this] { return exit_; });
+                if (exit_)
+                    break;
+                lock.unlock();
+                {
+                    const std::scoped_lock loggersLock(engine.loggersMutex_);
+                    engine.flushDueFiles();
+                }
+                lock.lock();
+            }
+        }
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::chrono::milliseconds period_;
+        bool exit_ = false;
+        std::thread thread_;
+    };
+
     LogEngine::~LogEngine() {
+        flusher_.reset();
+        stopAsync();
         // close managed files
         while (not managedFiles_.empty())
             managedFiles_.pop_back();
     }
 
-    size_t LogEngine::openFile(std::string const &fileName) {
+    size_t LogEngine::openFile(std::string const &fileName, FileLogOptions fileOptions) {
         size_t ret = managedFiles_.size();
-        managedFiles_.emplace_back(fileName);
+        managedFiles_.push_back(std::make_unique<LogFileSink>(fileName, fileOptions));
         return ret;
     }
 
-   std::ostream& LogEngine::getLogStream(const LogStreamItem& item) {
-        if ( std::holds_alternative<ManagedFileIndex>(item)) {
-            auto &fileIdx = std::get<ManagedFileIndex>(item);
-            return managedFiles_[fileIdx.index_];
-        }
-        if ( std::holds_alternative<std::ostream*>(item)) {
-            auto ptr = std::get<std::ostream*>(item);
-            return *ptr;
+    std::shared_ptr<std::mutex> LogEngine::sinkMutex(const LogStreamItem& item) const {
+        if (std::holds_alternative<std::ostream*>(item)) {
+            for (auto &[logWrapper, loggerLevel, options, mutex, blockFilter] : loggers_)
+                if (logWrapper.index() == item.index() and std::get<std::ostream*>(logWrapper) == std::get<std::ostream*>(item))
+                    return mutex;
         }
-        throw std::runtime_error("Unknown logger stream type");
+        return std::make_shared<std::mutex>();
     }
 
-    void LogEngine::addLoggerDefinition(std::ostream &outLog, LogLevel level, LogOptions options) {
+    size_t LogEngine::addLoggerDefinition(std::ostream &outLog, LogLevel level, LogOptions options) {
+        // pending messages go to the loggers that were defined when they were logged
+        flush();
+        const auto lock = lockLoggers();
         // first logger definition overrides default behavior
         if (not loggerDefined_) {
             loggers_.clear();
@@ -75,22 +293,43 @@ static
         }
         LogStreamItem item(std::in_place_type<std::ostream*>, std::addressof(outLog));
 
-        loggers_.emplace_back(item, level, options);
+        loggers_.emplace_back(item, level, options, sinkMutex(item), 0);
+        updateLevelMask();
+        return loggers_.size() - 1;
     }
 
-    void LogEngine::addLoggerDefinition(const std::string &outLogFilename, LogLevel level, LogOptions options) {
+    size_t LogEngine::addLoggerDefinition(const std::string &outLogFilename, LogLevel level, LogOptions options) {
+        return addLoggerDefinition(outLogFilename, level, FileLogOptions{}, options);
+    }
+
+    size_t LogEngine::addLoggerDefinition(const std::string &outLogFilename, LogLevel level, FileLogOptions fileOptions,
+                                        LogOptions options) {
+        // pending messages go to the loggers that were defined when they were logged
+        flush();
+        const auto lock = lockLoggers();
         // first logger definition overrides default behavior
         if (not loggerDefined_) {
             loggers_.clear();
             loggerDefined_ = true;
         }
-        ManagedFileIndex item = { openFile(outLogFilename) };
+        ManagedFileIndex item = { openFile(outLogFilename, fileOptions) };
         LogStreamItem logItem(std::in_place_type<ManagedFileIndex>, item);
 
-        loggers_.emplace_back(logItem, level, options);
+        loggers_.emplace_back(logItem, level, options, sinkMutex(logItem), 0);
+        updateLevelMask();
+        if (fileOptions.flushInterval.count() > 0) {
+            if (flusher_)
+                flusher_->useInterval(fileOptions.flushInterval);
+            else
+                flusher_ = std::make_unique<FileFlusher>(*this, fileOptions.flushInterval);
+        }
+        return loggers_.size() - 1;
     }
 
-    void LogEngine::addLoggerDefinition(LogCallback callback, LogLevel level, LogOptions options) {
+    size_t LogEngine::addLoggerDefinition(LogCallback callback, LogLevel level, LogOptions options) {
+        // pending messages go to the loggers that were defined when they were logged
+        flush();
+        const auto lock = lockLoggers();
         // first logger definition overrides default behavior
         if (not loggerDefined_) {
             loggers_.clear();
@@ -100,34 +339,78 @@ static
         managedCallbacks_.emplace_back(std::move(callback));
         LogStreamItem logItem(std::in_place_type<ManagedCallback>, item);
 
-        loggers_.emplace_back(logItem, level, options);
+        loggers_.emplace_back(logItem, level, options, sinkMutex(logItem), 0);
+        updateLevelMask();
+        return loggers_.size() - 1;
+    }
+
+    size_t LogEngine::addLoggerDefinition(const std::string &ringFilename, LogLevel level, RingLogOptions ringOptions,
+                                          LogOptions options) {
+        // pending messages go to the loggers that were defined when they were logged
+        flush();
+        const auto lock = lockLoggers();
+        // first logger definition overrides default behavior
+        if (not loggerDefined_) {
+            loggers_.clear();
+            loggerDefined_ = true;
+        }
+        ManagedRingIndex item = { managedRings_.size() };
+        managedRings_.push_back(std::make_unique<MappedRing>(ringFilename, ringOptions.capacity));
+        LogStreamItem logItem(std::in_place_type<ManagedRingIndex>, item);
+
+        loggers_.emplace_back(logItem, level, options, sinkMutex(logItem), 0);
+        updateLevelMask();
+        return loggers_.size() - 1;
+    }
+
+    void LogEngine::setLoggerBlockFilter(size_t logger, const std::string &pattern) {
+        flush();
+        const auto lock = lockLoggers();
+        if (logger >= loggers_.size())
+            throw TU::Exception("[Log] Unknown logger " + std::to_string(logger));
+        std::get<uint64_t>(loggers_[logger]) = pattern.empty() ? 0 : registerBlockFilter(pattern);
+        updateLevelMask();
     }
 
     void LogEngine::clearLoggerDefinitions(){
+        flush();
+        const auto lock = lockLoggers();
         loggers_.clear();
         loggerDefined_ = true;
+        updateLevelMask();
     }
 
 	struct LogEngine::LogDispatchVisitor
 	{
-		void handleStream(std::ostream *sPtr) const
+		//The line is put together in a buffer of the thread, so the sink is only locked
+		//for a single write.
+		std::string_view buildLine() const
 		{
-			static std::mutex iolock;
-			std::scoped_lock<std::mutex> l(iolock);
-
-			std::ostream &out = *sPtr;
+			thread_local std::string line;
+			line.clear();
 			if (useTimestampFlag)
-				out << timestamp;
-			out << text;
+				line += timestamp;
+			line += text;
 			if (text.empty() or (text.back() != '\n'))
-				out << std::endl;
-			else
-				out << std::flush;
+				line += '\n';
+			return line;
+		}
+
+		void handleStream(std::ostream *sPtr) const
+		{
+			auto line = buildLine();
+			std::scoped_lock<std::mutex> l(sinkMutex);
+			sPtr->write(line.data(), static_cast<std::streamsize>(line.size()));
+			if (flushLine)
+				sPtr->flush();
 		}
+
+		//Files decide by themselves when to flush (see FileLogOptions)
 		void operator()(ManagedFileIndex &idx) const
 		{
-			auto aux = std::addressof(engine.managedFiles_[idx.index_]);
-			handleStream(aux);
+			auto line = buildLine();
+			std::scoped_lock<std::mutex> l(sinkMutex);
+			engine.managedFiles_[idx.index_]->write(line, level);
 		}
 
 		void operator()(std::ostream *sPtr) const
@@ -135,34 +418,76 @@ static
 			handleStream(sPtr);
 		}
 
+		//A ring doesn't need flushing: the line is in the mapped pages as soon as it's written.
+		void operator()(ManagedRingIndex &idx) const
+		{
+			auto line = buildLine();
+			auto& ring = *engine.managedRings_[idx.index_];
+			//Lines longer than a record can be are cut.
+			line = line.substr(0, ring.capacity() / 2 - sizeof(uint64_t));
+			std::scoped_lock<std::mutex> l(sinkMutex);
+			ring.write(std::as_bytes(std::span(line.data(), line.size())));
+		}
+
 		void operator()(ManagedCallback& idx)
 		{
 			auto& callback = engine.managedCallbacks_[idx.index_];
 
-			static std::mutex cblock;
-			std::scoped_lock<std::mutex> l(cblock);
-			callback(level, text);
+			std::scoped_lock<std::mutex> l(sinkMutex);
+			callback(level, std::string(text));
 		}
 
 		LogEngine         &engine;
 		LogLevel           level;
-		const std::string &text;
-		const std::string &timestamp;
+		std::string_view   text;
+		std::string_view   timestamp;
 		bool               useTimestampFlag;
+		bool               flushLine;
+		std::mutex        &sinkMutex;
 	};
 
-	void LogEngine::log(LogLevel level, std::string const &text)
+	void LogEngine::log(LogLevel level, std::string_view text)
 	{
-#ifdef NDEBUG
-		if (level == LogLevel::DEBUG)
+		if (not accepts(level))
 			return;
-#endif
 
-		std::string timestamp;
-		auto        useTimestamp = [](LogOptions options)
+		//The block location is taken here, the async writer thread is in none.
+		const uint64_t blockMask = blockFilters_.load(std::memory_order_relaxed) ? getCurrentBlockFilterMask() : 0;
+		if (async_)
+		{
+			AsyncWriter::Record record;
+			record.level = level;
+			record.time = std::chrono::system_clock::now();
+			record.blockMask = blockMask;
+			record.text.assign(text);
+			async_->push(std::move(record));
+			return;
+		}
+		dispatch(level, text, std::chrono::system_clock::now(), blockMask, true);
+	}
+
+	void LogEngine::dispatch(LogLevel level, std::string_view text, std::chrono::system_clock::time_point time, uint64_t blockMask, bool flushEachLine)
+	{
+		auto useTimestamp = [](LogOptions options)
 		{ return (not(options & LogOptions::NOTIMESTAMP)); };
+		//The timestamp is formatted once per message (and flavour), not once per logger. We keep a
+		//copy since the formatter's buffer belongs to the thread, and a callback could log again.
+		std::array<std::array<char, 48>, 2> stampBuffers;
+		std::array<std::string_view, 2> stamps;
+		auto timestampFor = [&](LogOptions options)
+		{
+			const bool millis = (options & LogOptions::MILLISECONDS);
+			auto& stamp = stamps[millis];
+			if (stamp.empty())
+			{
+				auto formatted = formatLogTimestamp(time, millis);
+				auto length = formatted.copy(stampBuffers[millis].data(), stampBuffers[millis].size());
+				stamp = {stampBuffers[millis].data(), length};
+			}
+			return stamp;
+		};
 
-		for (auto &[logWrapper, loggerLevel, options] : loggers_)
+		for (auto &[logWrapper, loggerLevel, options, mutex, blockFilter] : loggers_)
 		{
 			if (level > loggerLevel)
 				continue;
@@ -173,16 +498,138 @@ static
 			if ((options & LogOptions::EXCLUSIVE) and (level != loggerLevel))
 				continue;
 
+			if (blockFilter and not (blockFilter & blockMask))
+				continue;
+
+			std::string_view timestamp;
 			if (useTimestamp(options))
-			{
-				timestamp = getFormattedTimestamp();
-			}
+				timestamp = timestampFor(options);
 			// lambda that helps us dispatch to the actual backends of each logItem
-			LogDispatchVisitor dispatch{*this, level, text, timestamp, useTimestamp(options)};
+			LogDispatchVisitor dispatch{*this, level, text, timestamp, useTimestamp(options), flushEachLine, *mutex};
 			std::visit(dispatch, logWrapper);
 		}
 	}
 
+	bool LogEngine::accepts(LogLevel level) const
+	{
+		if (not logCompiledIn(level))
+			return false;
+#ifdef NDEBUG
+		if (level == LogLevel::DEBUG)
+			return false;
+#endif
+		return levelMask_.load(std::memory_order_relaxed) & levelBit(level);
+	}
+
+	void LogEngine::updateLevelMask()
+	{
+		uint32_t mask = 0;
+		uint64_t filters = 0;
+		for (auto &[logWrapper, loggerLevel, options, mutex, blockFilter] : loggers_)
+		{
+			filters |= blockFilter;
+			if (options & LogOptions::QUIET)
+				continue;
+			if (options & LogOptions::EXCLUSIVE)
+			{
+				mask |= levelBit(loggerLevel);
+				continue;
+			}
+			//Every level up to the logger's one (they are sorted from most to least important)
+			mask |= (levelBit(loggerLevel) << 1) - 1;
+		}
+		levelMask_.store(mask, std::memory_order_relaxed);
+		blockFilters_.store(filters, std::memory_order_relaxed);
+	}
+
+	void LogEngine::flushStreams()
+	{
+		for (auto &[logWrapper, loggerLevel, options, mutex, blockFilter] : loggers_)
+		{
+			//Callbacks have nothing to flush, and rings are left to the OS (see flushFiles)
+			if (std::holds_alternative<ManagedCallback>(logWrapper) or std::holds_alternative<ManagedRingIndex>(logWrapper))
+				continue;
+			std::scoped_lock<std::mutex> l(*mutex);
+			if (auto fileIdx = std::get_if<ManagedFileIndex>(&logWrapper))
+				managedFiles_[fileIdx->index_]->flush();
+			else
+				std::get<std::ostream*>(logWrapper)->flush();
+		}
+	}
+
+	void LogEngine::flushFiles()
+	{
+		for (auto &[logWrapper, loggerLevel, options, mutex, blockFilter] : loggers_)
+		{
+			if (auto fileIdx = std::get_if<ManagedFileIndex>(&logWrapper))
+			{
+				std::scoped_lock<std::mutex> l(*mutex);
+				managedFiles_[fileIdx->index_]->flush();
+			}
+			else if (auto ringIdx = std::get_if<ManagedRingIndex>(&logWrapper))
+			{
+				std::scoped_lock<std::mutex> l(*mutex);
+				managedRings_[ringIdx->index_]->flush();
+			}
+		}
+	}
+
+	void LogEngine::flushDueFiles()
+	{
+		const auto now = std::chrono::steady_clock::now();
+		for (auto &[logWrapper, loggerLevel, options, mutex, blockFilter] : loggers_)
+		{
+			if (auto fileIdx = std::get_if<ManagedFileIndex>(&logWrapper))
+			{
+				std::scoped_lock<std::mutex> l(*mutex);
+				managedFiles_[fileIdx->index_]->flushIfDue(now);
+			}
+		}
+	}
+
+	std::unique_lock<std::mutex> LogEngine::lockLoggers()
+	{
+		//The writer holds the lock while it calls the callbacks
+		if (async_ and async_->onWriterThread())
+			throw TU::Exception("[Log] The loggers can't change from a log callback in asynchronous mode");
+		return std::unique_lock(loggersMutex_);
+	}
+
+	void LogEngine::startAsync(AsyncLogOptions options)
+	{
+		if (async_)
+			return;
+		async_ = std::make_unique<AsyncWriter>(*this, options);
+	}
+
+	void LogEngine::stopAsync()
+	{
+		if (not async_)
+			return;
+		if (async_->onWriterThread())
+			throw TU::Exception("[Log] Asynchronous logging can't stop from a log callback");
+		async_->stop();
+		async_.reset();
+	}
+
+	bool LogEngine::isAsync() const
+	{
+		return static_cast<bool>(async_);
+	}
+
+	void LogEngine::flush()
+	{
+		if (async_)
+			async_->sendMarker(AsyncWriter::Record::Kind::FLUSH);
+		else
+			flushFiles();
+	}
+
+	uint64_t LogEngine::droppedMessages() const
+	{
+		return async_ ? async_->dropped_.load(std::memory_order_relaxed) : 0;
+	}
+
     LogEngine &getLogEngineInstance() {
         static LogEngine engine;
         return engine;
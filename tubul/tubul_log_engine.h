@@ -4,17 +4,59 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 #include <functional>
+#include <memory>
+#include <mutex>
 
 #include "tubul_log_types.h"
+#include "tubul_log_file_sink.h"
+#include "tubul_mapped_ring.h"
 
 namespace TU {
 
     int getVersion();
 
+    /** Formats the timestamp that prefixes log lines, "YYYY-mm-dd HH:MM:SS - " (or with
+     * ".mmm" milliseconds before the separator), in local time. Every thread caches the last
+     * result and only rewrites the seconds while in the same minute. The returned view is valid
+     * until the next call from the same thread.
+     */
+    std::string_view formatLogTimestamp(std::chrono::system_clock::time_point time, bool milliseconds = false);
+
+    /** What an asynchronous log() does when the queue of pending messages is full: wait for
+     * the writer thread to make room, or throw the message away (the writer reports how many
+     * were lost).
+     */
+    enum class LogOverflowPolicy : uint8_t {
+        BLOCK,
+        DROP
+    };
+
+    /** Configuration of the asynchronous logging mode. The queue holds at most queueCapacity
+     * messages, and the writer thread writes up to maxBatch of them before flushing the sinks.
+     */
+    struct AsyncLogOptions {
+        size_t queueCapacity = 8192;
+        LogOverflowPolicy overflow = LogOverflowPolicy::BLOCK;
+        size_t maxBatch = 512;
+    };
+
+    /** Configuration of a log ring: a memory mapped file keeping the last capacity bytes of log
+     * lines (see TU::MappedRing). Lines are in the file as soon as they are logged, without any
+     * system call, so they survive a crash of the process. TU::dumpLogRing reads it.
+     */
+    struct RingLogOptions {
+        size_t capacity = 16 * 1024 * 1024;
+    };
+
     /** Internal class that handles log-related functionality. It is not expected
      * the tubul users would deal directly with the LogEngine, and Tubul should expose the
      * functionality through other free helper functions to simplify usage.
@@ -29,17 +71,51 @@ namespace TU {
         ~LogEngine();
 
         //Functions to add a "log stream". We can add an user-defined stream-like object (via ostream reference)
-        //or receive a string and create a new file that we will use as a log backend.
-        void addLoggerDefinition(std::ostream &outLog, LogLevel level, LogOptions options = LogOptions::NONE);
-        void addLoggerDefinition(const std::string &logFilename, LogLevel level, LogOptions options = LogOptions::NONE);
-        void addLoggerDefinition(LogCallback callback, LogLevel level, LogOptions options = LogOptions::NONE);
+        //or receive a string and create a new file that we will use as a log backend. They return the
+        //index of the new logger, valid until the definitions are cleared.
+        size_t addLoggerDefinition(std::ostream &outLog, LogLevel level, LogOptions options = LogOptions::NONE);
+        size_t addLoggerDefinition(const std::string &logFilename, LogLevel level, LogOptions options = LogOptions::NONE);
+        size_t addLoggerDefinition(const std::string &logFilename, LogLevel level, FileLogOptions fileOptions,
+                                   LogOptions options = LogOptions::NONE);
+        size_t addLoggerDefinition(LogCallback callback, LogLevel level, LogOptions options = LogOptions::NONE);
+        size_t addLoggerDefinition(const std::string &ringFilename, LogLevel level, RingLogOptions ringOptions,
+                                   LogOptions options = LogOptions::NONE);
+
+        //Makes a logger write only the messages logged inside blocks whose location matches the pattern
+        //(see TU::matchesBlockPattern), like "main.loadData.*". An empty pattern removes the filter.
+        void setLoggerBlockFilter(size_t logger, const std::string &pattern);
 
         //Delete all existing logger streams
         void clearLoggerDefinitions();
 
-        //Base functions to handle the logging requests. The safe version uses a mutex to prevent issues
-        //while using the logger in threads.
-        void log(LogLevel level, std::string const &text);
+        //Base function to handle the logging requests. It can be called from any thread: every line is
+        //built in a buffer of the calling thread, and only the sinks it's written to are locked (one
+        //write each), so threads logging to different sinks don't wait for each other.
+        void log(LogLevel level, std::string_view text);
+
+        //True when at least one logger would write a message of this level. It's a single
+        //atomic read, so callers can skip building messages nobody will see.
+        [[nodiscard]] bool accepts(LogLevel level) const;
+
+        //Asynchronous mode: log() only queues the message (taking the timestamp right away), and
+        //a background thread formats and writes the messages in batches, flushing the sinks once
+        //per batch instead of once per line. Callbacks are called from that thread: they can log
+        //(when the queue is full those messages are dropped instead of waiting for the writer,
+        //whatever the policy) and flush (it doesn't wait), but not change the loggers or the mode.
+        //stopAsync() writes everything still queued before going back to synchronous logging, and
+        //so does the destructor. Like the logger definitions, the mode should be changed while no
+        //other thread is logging.
+        void startAsync(AsyncLogOptions options = {});
+        void stopAsync();
+        [[nodiscard]] bool isAsync() const;
+
+        //Waits until every message logged before the call has been written and the sinks flushed
+        //(log files keep lines in a buffer, see FileLogOptions).
+        void flush();
+
+        //Number of messages thrown away since async mode started, by the DROP overflow policy or
+        //because a callback logged with the queue full.
+        [[nodiscard]] uint64_t droppedMessages() const;
 
     private:
         //Simple structure to wrap an index from managed files vector
@@ -49,24 +125,61 @@ namespace TU {
         struct ManagedCallback {
             size_t index_;
         };
+        struct ManagedRingIndex {
+            size_t index_;
+        };
 
     	struct LogDispatchVisitor;
-
-        //Loggers can point to a managed file or a user-provided stream.
-        using LogStreamItem = std::variant<ManagedFileIndex, std::ostream*, ManagedCallback>;
-        //The definition of a log is a LogStream (the variant we just defined) along with the level and options
-        using LogDefinition = std::tuple< LogStreamItem, TU::LogLevel, TU::LogOptions>;
-
-        //Open a file and stores the created stream. Returns an index (pretty much like a C fd) to be used later.
-        size_t openFile(std::string const &fileName);
-        //Given a LogStreamItem, returns the associated std::ostream&
-        std::ostream& getLogStream(const LogStreamItem& item) ;
-
-        std::vector<std::ofstream> managedFiles_;
+        struct AsyncWriter;
+        struct FileFlusher;
+
+        //Loggers can point to a managed file, a user-provided stream, a callback or a managed log ring.
+        using LogStreamItem = std::variant<ManagedFileIndex, std::ostream*, ManagedCallback, ManagedRingIndex>;
+        //The definition of a log is a LogStream (the variant we just defined) along with the level and options,
+        //the mutex of its sink (shared by the definitions writing to the same stream) and the bit of its
+        //block filter (zero when it has none).
+        using LogDefinition = std::tuple< LogStreamItem, TU::LogLevel, TU::LogOptions, std::shared_ptr<std::mutex>, uint64_t>;
+
+        //Open a file and stores the created sink. Returns an index (pretty much like a C fd) to be used later.
+        size_t openFile(std::string const &fileName, FileLogOptions fileOptions);
+        //Mutex for a new logger: the one of the logger already writing to the same stream, or a new one.
+        std::shared_ptr<std::mutex> sinkMutex(const LogStreamItem& item) const;
+        //Sends a message to every logger that accepts its level.
+        //blockMask has the block filters matching the location where it was logged.
+        void dispatch(LogLevel level, std::string_view text, std::chrono::system_clock::time_point time, uint64_t blockMask,
+                      bool flushEachLine);
+        //Flushes the streams of all the loggers
+        void flushStreams();
+        //Flushes only the log files and rings. Synchronous logging already flushes the other streams
+        //after every line, and those may not exist anymore when the loggers are redefined.
+        void flushFiles();
+        //Flushes the log files whose oldest buffered line waited their flushInterval (FileFlusher)
+        void flushDueFiles();
+        //Lock to change the loggers. Throws in the async writer thread, which already holds it.
+        std::unique_lock<std::mutex> lockLoggers();
+        //Recomputes levelMask_ after the loggers change
+        void updateLevelMask();
+
+        static constexpr uint32_t levelBit(LogLevel level) { return uint32_t{1} << static_cast<uint32_t>(level); }
+
+        std::vector<std::unique_ptr<LogFileSink>> managedFiles_;
     	std::vector<LogCallback> managedCallbacks_;
+        std::vector<std::unique_ptr<MappedRing>> managedRings_;
         std::vector<LogDefinition> loggers_;
 
         bool loggerDefined_;
+        //Bit i is set when some logger accepts the LogLevel with value i
+        std::atomic<uint32_t> levelMask_ = 0;
+        //Block filters used by some logger. Without them, we don't even look at the current block.
+        std::atomic<uint64_t> blockFilters_ = 0;
+
+        //Only used in async mode. The mutex keeps the writer thread away from the loggers while
+        //they are being redefined.
+        std::unique_ptr<AsyncWriter> async_;
+        std::mutex loggersMutex_;
+        //Started by the first log file with a flushInterval, so buffered lines reach the disk even
+        //when nothing else is logged. Declared last, so it stops before anything else goes away.
+        std::unique_ptr<FileFlusher> flusher_;
     };
 
     /** Function to get the global LogEngine in tubul. Most functions should access logging
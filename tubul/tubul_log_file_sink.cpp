@@ -0,0 +1,140 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include "tubul_log_file_sink.h"
+#include "tubul_exception.h"
+
+#include <array>
+#include <filesystem>
+#include <utility>
+
+#ifdef TUBUL_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+namespace TU {
+
+namespace {
+#ifdef TUBUL_HAS_ZLIB
+    //Gzips source into target and removes source (or target, if something failed).
+    void gzipFile(const std::string& source, const std::string& target) {
+        std::FILE* in = std::fopen(source.c_str(), "rb");
+        if (in == nullptr)
+            return;
+        gzFile out = gzopen(target.c_str(), "wb");
+        if (out == nullptr) {
+            std::fclose(in);
+            return;
+        }
+        std::array<char, 64 * 1024> chunk;
+        bool ok = true;
+        size_t read;
+        while (ok and (read = std::fread(chunk.data(), 1, chunk.size(), in)) > 0)
+            ok = gzwrite(out, chunk.data(), static_cast<unsigned>(read)) == static_cast<int>(read);
+        std::fclose(in);
+        ok = (gzclose(out) == Z_OK) and ok;
+        std::error_code ec;
+        std::filesystem::remove(ok ? source : target, ec);
+    }
+#endif
+}
+
+    LogFileSink::LogFileSink(std::string path, FileLogOptions options) :
+        path_(std::move(path)),
+        options_(options) {
+        buffer_.reserve(options_.bufferSize);
+        open();
+    }
+
+    LogFileSink::~LogFileSink() {
+        flush();
+        if (file_)
+            std::fclose(file_);
+        if (compression_.valid())
+            compression_.wait();
+    }
+
+    bool LogFileSink::compressionSupported() {
+#ifdef TUBUL_HAS_ZLIB
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void LogFileSink::open() {
+        file_ = std::fopen(path_.c_str(), "w");
+        if (file_ == nullptr)
+            throw TU::Exception(std::string("Could not open file:") + path_);
+        //We do the buffering ourselves
+        std::setvbuf(file_, nullptr, _IONBF, 0);
+        fileSize_ = 0;
+        openedAt_ = std::chrono::steady_clock::now();
+    }
+
+    std::string LogFileSink::rotatedName(size_t index, bool compressed) const {
+        return path_ + "." + std::to_string(index) + (compressed ? ".gz" : "");
+    }
+
+    void LogFileSink::write(std::string_view line, LogLevel level) {
+        const auto now = std::chrono::steady_clock::now();
+        const bool tooBig = options_.maxFileSize > 0 and fileSize_ + line.size() > options_.maxFileSize;
+        const bool tooOld = options_.rotationInterval.count() > 0 and now - openedAt_ >= options_.rotationInterval;
+        if (fileSize_ > 0 and (tooBig or tooOld))
+            rotate();
+
+        if (buffer_.size() + line.size() > options_.bufferSize)
+            flush();
+        if (buffer_.empty())
+            bufferedSince_ = now;
+        buffer_.append(line);
+        fileSize_ += line.size();
+        if (level <= options_.flushLevel)
+            flush();
+        else
+            flushIfDue(now);
+    }
+
+    void LogFileSink::flush() {
+        if (file_ and not buffer_.empty()) {
+            std::fwrite(buffer_.data(), 1, buffer_.size(), file_);
+            std::fflush(file_);
+            buffer_.clear();
+        }
+    }
+
+    void LogFileSink::flushIfDue(std::chrono::steady_clock::time_point now) {
+        if (not buffer_.empty() and now - bufferedSince_ >= options_.flushInterval)
+            flush();
+    }
+
+    void LogFileSink::rotate() {
+        flush();
+        std::fclose(file_);
+        file_ = nullptr;
+        //The previous compression works on "<path>.1", which is about to move.
+        if (compression_.valid())
+            compression_.wait();
+
+        std::error_code ec;
+        if (options_.maxFiles == 0) {
+            std::filesystem::remove(path_, ec);
+        } else {
+            std::filesystem::remove(rotatedName(options_.maxFiles, false), ec);
+            std::filesystem::remove(rotatedName(options_.maxFiles, true), ec);
+            for (size_t i = options_.maxFiles - 1; i >= 1; --i) {
+                for (bool compressed: {false, true}) {
+                    if (std::filesystem::exists(rotatedName(i, compressed), ec))
+                        std::filesystem::rename(rotatedName(i, compressed), rotatedName(i + 1, compressed), ec);
+                }
+            }
+            std::filesystem::rename(path_, rotatedName(1, false), ec);
+#ifdef TUBUL_HAS_ZLIB
+            if (options_.compressRotated)
+                compression_ = std::async(std::launch::async, gzipFile, rotatedName(1, false), rotatedName(1, true));
+#endif
+        }
+        open();
+    }
+}
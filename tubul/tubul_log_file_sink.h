@@ -0,0 +1,87 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <future>
+#include <string>
+#include <string_view>
+
+#include "tubul_log_types.h"
+
+namespace TU {
+
+    /** Configuration of a log file. Lines are kept in a buffer of bufferSize bytes, which is
+     * written when it fills up, when a message of flushLevel (or more important) arrives, when
+     * a line has been waiting for flushInterval, and at exit or TU::flushLog(). Through the
+     * loggers, a background thread of the LogEngine checks the buffers every half of the shortest
+     * flushInterval, so lines reach the file even if nothing else is logged after them.
+     *
+     * The file rotates when it would grow over maxFileSize bytes, or when it has been open for
+     * rotationInterval (zero disables each of them): "log" moves to "log.1", "log.1" to "log.2"
+     * and so on, keeping at most maxFiles old files. With compressRotated, the old files are
+     * gzipped ("log.1.gz") by a background thread (only when tubul is built with zlib).
+     */
+    struct FileLogOptions {
+        size_t bufferSize = 64 * 1024;
+        LogLevel flushLevel = LogLevel::ERROR;
+        std::chrono::milliseconds flushInterval{1000};
+        size_t maxFileSize = 0;
+        std::chrono::seconds rotationInterval{0};
+        size_t maxFiles = 5;
+        bool compressRotated = false;
+    };
+
+    /** File backend of the loggers defined with a file name. It's not thread safe: the
+     * LogEngine locks it.
+     */
+    class LogFileSink {
+    public:
+        explicit LogFileSink(std::string path, FileLogOptions options = {});
+
+        LogFileSink(const LogFileSink&) = delete;
+        LogFileSink& operator=(const LogFileSink&) = delete;
+
+        ~LogFileSink();
+
+        /** Adds a complete line (with its end of line) of the given level. */
+        void write(std::string_view line, LogLevel level);
+
+        /** Writes the buffered lines to the file. */
+        void flush();
+
+        /** Writes the buffered lines if the oldest of them has waited flushInterval or more. */
+        void flushIfDue(std::chrono::steady_clock::time_point now);
+
+        /** Starts a new file now, moving the current one to "<path>.1". */
+        void rotate();
+
+        /** Bytes in the current file, including the ones still buffered. */
+        [[nodiscard]] size_t fileSize() const { return fileSize_; }
+        [[nodiscard]] const std::string& path() const { return path_; }
+        [[nodiscard]] const FileLogOptions& options() const { return options_; }
+
+        /** True when tubul was built with zlib, so compressRotated works. */
+        static bool compressionSupported();
+
+    private:
+        void open();
+        //Name of the i-th old file, compressed or not.
+        [[nodiscard]] std::string rotatedName(size_t index, bool compressed) const;
+
+        std::string path_;
+        FileLogOptions options_;
+        std::FILE* file_ = nullptr;
+        std::string buffer_;
+        size_t fileSize_ = 0;
+        //When the oldest line in the buffer was written
+        std::chrono::steady_clock::time_point bufferedSince_;
+        std::chrono::steady_clock::time_point openedAt_;
+        //Compression of the last rotated file, waited for before rotating again.
+        std::future<void> compression_;
+    };
+}
@@ -16,13 +16,29 @@ enum class LogLevel : uint8_t
 	DEBUG
 };
 
+/** TUBUL_LOG_MIN_LEVEL is the least important level compiled in (set it with the CMake option of
+ * the same name, e.g. -DTUBUL_LOG_MIN_LEVEL=REPORT). Messages of less important levels, and the
+ * code building them when using TUBUL_LOG or the lazy log* overloads, are removed at compile time.
+ */
+#ifndef TUBUL_LOG_MIN_LEVEL
+#define TUBUL_LOG_MIN_LEVEL DEBUG
+#endif
+
+inline constexpr LogLevel LOG_MIN_LEVEL = LogLevel::TUBUL_LOG_MIN_LEVEL;
+
+constexpr bool logCompiledIn(LogLevel level)
+{
+	return level <= LOG_MIN_LEVEL;
+}
+
 enum class LogOptions : uint8_t
 {
 	NONE        = 0,
 	COLOR       = 1, // send commands for color output
 	EXCLUSIVE   = 2, // only send to specified LogLevel
 	NOTIMESTAMP = 4, // don't prefix timestamp
-	QUIET       = 8  // don't show anything
+	QUIET       = 8, // don't show anything
+	MILLISECONDS = 16 // add milliseconds to the timestamp
 };
 
 inline LogOptions operator|(LogOptions a, LogOptions b)
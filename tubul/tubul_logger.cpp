@@ -9,7 +9,9 @@
 
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <stdexcept>
+#include <unordered_set>
 #include <utility>
 
 #ifndef TUBUL_MACOS
@@ -19,22 +21,56 @@
 namespace TU {
 
 
-    void addLoggerDefinition(std::ostream &out, TU::LogLevel level, TU::LogOptions options) {
-        getLogEngineInstance().addLoggerDefinition(out, level, options);
+    size_t addLoggerDefinition(std::ostream &out, TU::LogLevel level, TU::LogOptions options) {
+        return getLogEngineInstance().addLoggerDefinition(out, level, options);
     }
 
-    void addLoggerDefinition(std::string const &logfile, TU::LogLevel level, TU::LogOptions options) {
-        getLogEngineInstance().addLoggerDefinition(logfile, level, options);
+    size_t addLoggerDefinition(std::string const &logfile, TU::LogLevel level, TU::LogOptions options) {
+        return getLogEngineInstance().addLoggerDefinition(logfile, level, options);
     }
 
-    void addLoggerDefinition(std::function<void(TU::LogLevel, const std::string&)> callback, TU::LogLevel level, TU::LogOptions options) {
-        getLogEngineInstance().addLoggerDefinition(std::move(callback), level, options);
+    size_t addLoggerDefinition(std::string const &logfile, TU::LogLevel level, FileLogOptions fileOptions, TU::LogOptions options) {
+        return getLogEngineInstance().addLoggerDefinition(logfile, level, fileOptions, options);
+    }
+
+    size_t addLoggerDefinition(std::function<void(TU::LogLevel, const std::string&)> callback, TU::LogLevel level, TU::LogOptions options) {
+        return getLogEngineInstance().addLoggerDefinition(std::move(callback), level, options);
+    }
+
+    size_t addLoggerDefinition(std::string const &ringFile, TU::LogLevel level, RingLogOptions ringOptions, TU::LogOptions options) {
+        return getLogEngineInstance().addLoggerDefinition(ringFile, level, ringOptions, options);
+    }
+
+    size_t dumpLogRing(std::string const &ringFile, std::ostream &out) {
+        const MappedRing ring(ringFile);
+        size_t lines = 0;
+        ring.forEachRecord([&out, &lines](std::span<const std::byte> line) {
+            out.write(reinterpret_cast<const char*>(line.data()), static_cast<std::streamsize>(line.size()));
+            ++lines;
+        });
+        return lines;
+    }
+
+    void setLoggerBlockFilter(size_t logger, std::string const &pattern) {
+        getLogEngineInstance().setLoggerBlockFilter(logger, pattern);
     }
 
     void clearLoggerDefinitions(){
         getLogEngineInstance().clearLoggerDefinitions();
     }
 
+    void startAsyncLogging(AsyncLogOptions options) {
+        getLogEngineInstance().startAsync(options);
+    }
+
+    void stopAsyncLogging() {
+        getLogEngineInstance().stopAsync();
+    }
+
+    void flushLog() {
+        getLogEngineInstance().flush();
+    }
+
     void logInfo(std::string const &msg) {
         getLogEngineInstance().log(LogLevel::INFO, msg);
     }
@@ -63,6 +99,57 @@ namespace TU {
         getLogEngineInstance().log(LogLevel::STATS, "STATS: " + msg);
     }
 
+    //log() is thread safe on its own (see LogEngine::log), these remain for the code using them.
+    void safelogError(std::string const &msg) {
+        logError(msg);
+    }
+
+    void safelogWarning(std::string const &msg) {
+        logWarning(msg);
+    }
+
+    void safelogReport(std::string const &msg) {
+        logReport(msg);
+    }
+
+    void safelogInfo(std::string const &msg) {
+        logInfo(msg);
+    }
+
+    void safelogDevel(std::string const &msg) {
+        logDevel(msg);
+    }
+
+    void safelogStat(std::string const &msg) {
+        logStat(msg);
+    }
+
+namespace {
+    void logOnceAt(LogLevel level, const std::string &msg, std::string place) {
+        static std::mutex placesMutex;
+        static std::unordered_set<std::string> places;
+        if (not logEnabled(level))
+            return;
+        {
+            const std::scoped_lock lock(placesMutex);
+            if (not places.insert(std::move(place)).second)
+                return;
+        }
+        getLogEngineInstance().log(level, msg);
+    }
+}
+
+#ifdef TUBUL_MACOS
+    void logOnce(LogLevel level, const std::string &msg, int line, const char *file, int column) {
+        logOnceAt(level, msg, std::string(file) + ":" + std::to_string(line) + ":" + std::to_string(column));
+    }
+#else
+    void logOnce(LogLevel level, const std::string &msg, const std::source_location location) {
+        logOnceAt(level, msg, std::string(location.file_name()) + ":" + std::to_string(location.line()) + ":" +
+                              std::to_string(location.column()));
+    }
+#endif
+
 #ifdef TUBUL_MACOS
 
     [[nodiscard]] TU::Exception throwError(const std::string &msg, int line, const char *file, const char *function) {
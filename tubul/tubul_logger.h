@@ -4,8 +4,16 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <concepts>
 #include <cstdint>
+#include <memory>
 #include <sstream>
+#include <string_view>
+#include <type_traits>
 #include "tubul_log_engine.h"
 #include "tubul_exception.h"
 #ifndef TUBUL_MACOS
@@ -28,28 +36,227 @@ namespace TU {
     void logStat(std::string const &msg);
     void logDebug(std::string const &msg);
 
+/** True when a message of this level would be written somewhere. Levels compiled out (see
+ * TUBUL_LOG_MIN_LEVEL) are a constant false, so code under "if (TU::logEnabled(...))" vanishes.
+ */
+    inline bool logEnabled(LogLevel level) {
+        return logCompiledIn(level) and getLogEngineInstance().accepts(level);
+    }
+
+/** Lazy versions of the log* functions: the callable builds the message (anything convertible
+ * to std::string) and is only called when the level is enabled. Example:
+ *     TU::logDevel([&] { return std::format("Iteration {} cost {}", it, expensiveCost()); });
+ */
+#define TUBUL_LAZY_LOG_FUNCTION(NAME, LEVEL) \
+    template<typename MessageFn> requires std::invocable<MessageFn&> \
+    void NAME(MessageFn&& makeMessage) { \
+        if constexpr (logCompiledIn(LEVEL)) { \
+            if (getLogEngineInstance().accepts(LEVEL)) \
+                NAME(std::string(makeMessage())); \
+        } \
+    }
+
+    TUBUL_LAZY_LOG_FUNCTION(logError, LogLevel::ERROR)
+    TUBUL_LAZY_LOG_FUNCTION(logWarning, LogLevel::WARNING)
+    TUBUL_LAZY_LOG_FUNCTION(logReport, LogLevel::REPORT)
+    TUBUL_LAZY_LOG_FUNCTION(logInfo, LogLevel::INFO)
+    TUBUL_LAZY_LOG_FUNCTION(logDevel, LogLevel::DEVEL)
+    TUBUL_LAZY_LOG_FUNCTION(logStat, LogLevel::STATS)
+    TUBUL_LAZY_LOG_FUNCTION(logDebug, LogLevel::DEBUG)
+#undef TUBUL_LAZY_LOG_FUNCTION
+
 // ostream-like handler objects
 
+    /** Builds a message with "<<" and logs it when destroyed. If no logger accepts the level,
+     * everything is skipped without formatting anything. Strings and numbers are written into
+     * an inline buffer (numbers with std::to_chars, with the same output as a default ostream),
+     * so short messages don't allocate; longer ones move to a std::string. Any other type with
+     * an ostream operator<<, and any manipulator (std::hex, std::setprecision, std::setw...),
+     * switches the message to a std::ostringstream, so manipulators apply to the rest of it.
+     */
     class LogStream {
     public:
-        explicit LogStream(LogLevel level): level_(level) {}
+        static constexpr size_t INLINE_CAPACITY = 256;
+
+        explicit LogStream(LogLevel level):
+            level_(level),
+            enabled_(logEnabled(level)) {}
+
+        //The message ends with a note telling how many similar messages were suppressed (if any)
+        LogStream(LogLevel level, uint64_t suppressed):
+            level_(level),
+            enabled_(logEnabled(level)),
+            suppressed_(suppressed) {}
+
+        LogStream(const LogStream&) = delete;
+        LogStream& operator=(const LogStream&) = delete;
 
         ~LogStream() {
-                getLogEngineInstance().log(level_, parts_.str());
+            if (not enabled_)
+                return;
+            if (suppressed_ > 0)
+                *this << " (" << suppressed_ << " similar messages suppressed)";
+            getLogEngineInstance().log(level_, view());
         };
 
         template<typename TypeToLog>
         LogStream& operator<<(TypeToLog&& msg ) {
-            parts_ << msg;
-           return *this;
+            using T = std::remove_cvref_t<TypeToLog>;
+            if (not enabled_)
+                return *this;
+            if constexpr (std::is_same_v<std::decay_t<TypeToLog>, std::ios_base& (*)(std::ios_base&)>) {
+                streamed() << msg;
+            } else if (streamed_) {
+                *streamed_ << msg;
+            } else if constexpr (std::is_same_v<T, char> or std::is_same_v<T, signed char> or std::is_same_v<T, unsigned char>) {
+                const char c = static_cast<char>(msg);
+                append(std::string_view(&c, 1));
+            } else if constexpr (std::is_same_v<T, bool>) {
+                append(msg ? "1" : "0");
+            } else if constexpr (std::is_pointer_v<T> and std::is_convertible_v<T, const char*>) {
+                if (msg)
+                    append(std::string_view(msg));
+            } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+                append(std::string_view(msg));
+            } else if constexpr (std::is_arithmetic_v<T>) {
+                appendNumber(msg);
+            } else {
+                //Other types, including manipulators like std::setprecision or std::setw which
+                //are helper structs, must reach the same stream as whatever follows them.
+                streamed() << msg;
+            }
+            return *this;
         }
 
     private:
-        std::stringstream parts_;
+        //Used once a manipulator shows up, so it applies to everything after it.
+        std::ostringstream& streamed() {
+            if (not streamed_) {
+                auto previous = view();
+                streamed_ = std::make_unique<std::ostringstream>();
+                *streamed_ << previous;
+            }
+            return *streamed_;
+        }
+
+        std::string_view view() const {
+            if (streamed_)
+                return streamed_->view();
+            if (onHeap_)
+                return heap_;
+            return {buffer_.data(), size_};
+        }
+
+        void append(std::string_view text) {
+            if (not onHeap_ and size_ + text.size() <= INLINE_CAPACITY) {
+                std::copy(text.begin(), text.end(), buffer_.data() + size_);
+                size_ += text.size();
+                return;
+            }
+            if (not onHeap_) {
+                heap_.reserve(2 * (size_ + text.size()));
+                heap_.assign(buffer_.data(), size_);
+                onHeap_ = true;
+            }
+            heap_.append(text);
+        }
+
+        template<typename Number>
+        void appendNumber(Number value) {
+            std::array<char, 64> digits;
+            std::to_chars_result res;
+            if constexpr (std::is_floating_point_v<Number>)
+                res = std::to_chars(digits.data(), digits.data() + digits.size(), value, std::chars_format::general, 6);
+            else
+                res = std::to_chars(digits.data(), digits.data() + digits.size(), value);
+            append(std::string_view(digits.data(), static_cast<size_t>(res.ptr - digits.data())));
+        }
 
         LogLevel level_;
+        bool enabled_;
+        uint64_t suppressed_ = 0;
+        bool onHeap_ = false;
+        size_t size_ = 0;
+        std::array<char, INLINE_CAPACITY> buffer_;
+        std::string heap_;
+        std::unique_ptr<std::ostringstream> streamed_;
+    };
+
+/** Stream style logging where nothing after the macro is evaluated unless the level is
+ * enabled, and compiled out entirely below TUBUL_LOG_MIN_LEVEL:
+ *     TUBUL_LOG(DEVEL) << "Graph has " << countNodes(g) << " nodes";
+ */
+#define TUBUL_LOG(LEVEL) \
+    if (not TU::logEnabled(TU::LogLevel::LEVEL)) {} else TU::LogStream(TU::LogLevel::LEVEL)
+
+/** Decides which messages of a call site get logged: the first burst of them, and after that
+ * one per period, which tells how many were suppressed since the previous one. Once the burst is
+ * over, allow() is a clock read and a couple of relaxed atomics. See TUBUL_LOG_RATE_LIMITED.
+ */
+    class LogRateLimiter {
+    public:
+        LogRateLimiter(uint64_t burst, std::chrono::steady_clock::duration period):
+            burst_(burst),
+            period_(period.count()) {}
+
+        //True when the message must be logged. suppressed is set to the number of messages
+        //skipped since the last one logged.
+        bool allow(uint64_t& suppressed) {
+            suppressed = 0;
+            if (seen_.load(std::memory_order_relaxed) < burst_ and seen_.fetch_add(1, std::memory_order_relaxed) < burst_)
+                return true;
+            const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+            auto next = nextReport_.load(std::memory_order_relaxed);
+            //The period starts with the first suppressed message
+            if (next == 0 and nextReport_.compare_exchange_strong(next, now + period_, std::memory_order_relaxed))
+                next = now + period_;
+            if (now >= next and nextReport_.compare_exchange_strong(next, now + period_, std::memory_order_relaxed)) {
+                suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+                return true;
+            }
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+    private:
+        const uint64_t burst_;
+        const std::chrono::steady_clock::rep period_;
+        std::atomic<uint64_t> seen_ = 0;
+        std::atomic<uint64_t> suppressed_ = 0;
+        std::atomic<std::chrono::steady_clock::rep> nextReport_ = 0;
     };
 
+/** Like TUBUL_LOG, but each place using it logs at most BURST messages, and after that one every
+ * PERIOD (a std::chrono duration), followed by the number of messages suppressed in between.
+ * BURST and PERIOD must be constants:
+ *     TUBUL_LOG_RATE_LIMITED(WARNING, 10, std::chrono::seconds(5)) << "Infeasible move " << move;
+ */
+#define TUBUL_LOG_RATE_LIMITED(LEVEL, BURST, PERIOD) \
+    if (uint64_t tubulSuppressed_ = 0; not TU::logEnabled(TU::LogLevel::LEVEL) or \
+        not []() -> TU::LogRateLimiter& { static TU::LogRateLimiter limiter(BURST, PERIOD); return limiter; }().allow(tubulSuppressed_)) {} \
+    else TU::LogStream(TU::LogLevel::LEVEL, tubulSuppressed_)
+
+/** Like TUBUL_LOG, but only the first time the line runs (a relaxed atomic read afterwards):
+ *     TUBUL_LOG_ONCE(WARNING) << "No solver license, using the fallback";
+ */
+#define TUBUL_LOG_ONCE(LEVEL) \
+    if (not TU::logEnabled(TU::LogLevel::LEVEL) or []() { \
+            static std::atomic<bool> logged = false; \
+            return logged.load(std::memory_order_relaxed) or logged.exchange(true, std::memory_order_relaxed); \
+        }()) {} \
+    else TU::LogStream(TU::LogLevel::LEVEL)
+
+/** Logs msg only the first time it's called from a given place of the code (file, line and
+ * column). It looks the place up in a table, so prefer TUBUL_LOG_ONCE in hot code.
+ */
+#ifdef TUBUL_MACOS
+    void logOnce(LogLevel level, const std::string &msg, int line = __builtin_LINE(),
+                 const char *file = __builtin_FILE(), int column = __builtin_COLUMN());
+#else
+    void logOnce(LogLevel level, const std::string &msg,
+                 const std::source_location location = std::source_location::current());
+#endif
+
     LogStream logError();
     LogStream logWarning();
     LogStream logReport();
@@ -0,0 +1,258 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include "tubul_mapped_ring.h"
+#include "tubul_exception.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+
+#ifdef TUBUL_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace TU
+{
+
+namespace
+{
+	constexpr char RING_MAGIC[8] = {'T', 'U', 'B', 'R', 'I', 'N', 'G', '1'};
+	constexpr uint32_t WRAP_MARKER = 0xFFFFFFFF;
+	constexpr uint64_t RECORD_ALIGNMENT = 8;
+	constexpr uint64_t LENGTH_SIZE = sizeof(uint32_t);
+
+	constexpr uint64_t alignUp(uint64_t value)
+	{
+		return (value + RECORD_ALIGNMENT - 1) & ~(RECORD_ALIGNMENT - 1);
+	}
+}
+
+//Positions (head and tail) always grow, the place in the file is position % capacity.
+//Everything between tail and head is valid.
+struct MappedRing::Header
+{
+	char magic[8];
+	uint64_t version;
+	uint64_t capacity;
+	uint64_t head;
+	uint64_t tail;
+	uint64_t dropped;
+	uint64_t reserved[2];
+};
+
+#ifdef TUBUL_WINDOWS
+
+struct MappedRing::Internals
+{
+	HANDLE fd_ = INVALID_HANDLE_VALUE;
+	HANDLE mapping_ = nullptr;
+};
+
+void MappedRing::map(size_t fileSize, bool writable)
+{
+	auto& fd = impl_->fd_;
+	auto& mapping = impl_->mapping_;
+	fd = CreateFileA(path_.c_str(), writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0,
+					 writable ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (fd == INVALID_HANDLE_VALUE)
+		throw TU::Exception(std::string("Could not open file:") + path_);
+	const auto size64 = static_cast<uint64_t>(fileSize);
+	mapping = CreateFileMappingA(fd, 0, writable ? PAGE_READWRITE : PAGE_READONLY, static_cast<DWORD>(size64 >> 32),
+								 static_cast<DWORD>(size64 & 0xFFFFFFFF), 0);
+	if (mapping == nullptr)
+		throw TU::Exception(std::string("Could not map file:") + path_);
+	data_ = static_cast<std::byte*>(MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, fileSize));
+	if (data_ == nullptr)
+		throw TU::Exception(std::string("Could not map file:") + path_);
+	size_ = fileSize;
+}
+
+MappedRing::~MappedRing()
+{
+	if (data_)
+		UnmapViewOfFile(data_);
+	if (impl_->mapping_)
+		CloseHandle(impl_->mapping_);
+	if (impl_->fd_ != INVALID_HANDLE_VALUE)
+		CloseHandle(impl_->fd_);
+}
+
+void MappedRing::flush()
+{
+	FlushViewOfFile(data_, 0);
+}
+
+#else
+
+struct MappedRing::Internals
+{
+	int fd_ = -1;
+};
+
+void MappedRing::map(size_t fileSize, bool writable)
+{
+	auto& fd = impl_->fd_;
+	fd = writable ? open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : open(path_.c_str(), O_RDONLY);
+	if (fd == -1)
+		throw TU::Exception(std::string("Could not open file:") + path_);
+	if (writable and ftruncate(fd, static_cast<off_t>(fileSize)) == -1)
+		throw TU::Exception(std::string("Could not resize file:") + path_);
+	void* mapped = mmap(nullptr, fileSize, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED)
+		throw TU::Exception(std::string("Could not map file:") + path_);
+	data_ = static_cast<std::byte*>(mapped);
+	size_ = fileSize;
+}
+
+MappedRing::~MappedRing()
+{
+	if (data_)
+		munmap(data_, size_);
+	if (impl_->fd_ != -1)
+		close(impl_->fd_);
+}
+
+void MappedRing::flush()
+{
+	msync(data_, size_, MS_ASYNC);
+}
+
+#endif
+
+MappedRing::MappedRing(const std::string& path, size_t capacity) :
+	path_(path),
+	impl_(std::make_unique<Internals>())
+{
+	const uint64_t dataSize = alignUp(std::max<uint64_t>(capacity, 64));
+	map(sizeof(Header) + dataSize, true);
+	auto& h = header();
+	std::memcpy(h.magic, RING_MAGIC, sizeof(RING_MAGIC));
+	h.version = 1;
+	h.capacity = dataSize;
+	h.head = 0;
+	h.tail = 0;
+	h.dropped = 0;
+}
+
+MappedRing::MappedRing(const std::string& path) :
+	path_(path),
+	readOnly_(true),
+	impl_(std::make_unique<Internals>())
+{
+	std::error_code ec;
+	const auto fileSize = std::filesystem::file_size(path, ec);
+	if (ec or fileSize < sizeof(Header))
+		throw TU::Exception(std::string("Could not open file:") + path);
+	map(fileSize, false);
+	const auto& h = header();
+	if (std::memcmp(h.magic, RING_MAGIC, sizeof(RING_MAGIC)) != 0 or h.capacity + sizeof(Header) > fileSize)
+		throw TU::Exception("[MappedRing] " + path + " is not a ring file, or it is corrupt");
+}
+
+MappedRing::Header& MappedRing::header() const
+{
+	static_assert(sizeof(Header) == 64);
+	return *reinterpret_cast<Header*>(data_);
+}
+
+std::byte* MappedRing::records() const
+{
+	return data_ + sizeof(Header);
+}
+
+size_t MappedRing::capacity() const
+{
+	return header().capacity;
+}
+
+uint64_t MappedRing::droppedRecords() const
+{
+	return std::atomic_ref<uint64_t>(header().dropped).load(std::memory_order_relaxed);
+}
+
+bool MappedRing::write(std::span<const std::byte> record)
+{
+	if (readOnly_)
+		throw TU::Exception("[MappedRing] " + path_ + " was opened read only");
+	auto& h = header();
+	const uint64_t capacity = h.capacity;
+	const uint64_t needed = alignUp(LENGTH_SIZE + record.size());
+	if (needed > capacity / 2)
+		return false;
+
+	const std::scoped_lock lock(mutex_);
+	uint64_t head = h.head;
+	uint64_t tail = h.tail;
+	uint64_t offset = head % capacity;
+	//Records never wrap around the end, so we may need to skip the end of the buffer.
+	const uint64_t padding = (offset + needed > capacity) ? capacity - offset : 0;
+
+	//Make room dropping the oldest records. The tail moves before we overwrite anything, so
+	//a reader after a crash never sees half overwritten records.
+	uint64_t dropped = 0;
+	while (head + padding + needed - tail > capacity)
+	{
+		const uint64_t tailOffset = tail % capacity;
+		uint32_t length;
+		std::memcpy(&length, records() + tailOffset, LENGTH_SIZE);
+		tail += (length == WRAP_MARKER) ? capacity - tailOffset : alignUp(LENGTH_SIZE + length);
+		++dropped;
+	}
+	if (dropped)
+	{
+		std::atomic_ref<uint64_t>(h.dropped).fetch_add(dropped, std::memory_order_relaxed);
+		std::atomic_ref<uint64_t>(h.tail).store(tail, std::memory_order_release);
+	}
+
+	if (padding)
+	{
+		std::memcpy(records() + offset, &WRAP_MARKER, LENGTH_SIZE);
+		head += padding;
+		offset = 0;
+	}
+	const auto length = static_cast<uint32_t>(record.size());
+	std::memcpy(records() + offset, &length, LENGTH_SIZE);
+	if (not record.empty())
+		std::memcpy(records() + offset + LENGTH_SIZE, record.data(), record.size());
+	//Only now the record becomes visible.
+	std::atomic_ref<uint64_t>(h.head).store(head + needed, std::memory_order_release);
+	return true;
+}
+
+void MappedRing::forEachRecord(const std::function<void(std::span<const std::byte>)>& fn) const
+{
+	std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+	if (not readOnly_)
+		lock.lock();
+	//Not const: atomic_ref of a const object only comes with C++26 (a load doesn't write anyway).
+	auto& h = header();
+	const uint64_t capacity = h.capacity;
+	const uint64_t head = std::atomic_ref<uint64_t>(h.head).load(std::memory_order_acquire);
+	uint64_t pos = std::atomic_ref<uint64_t>(h.tail).load(std::memory_order_acquire);
+	while (pos < head)
+	{
+		const uint64_t offset = pos % capacity;
+		uint32_t length;
+		std::memcpy(&length, records() + offset, LENGTH_SIZE);
+		if (length == WRAP_MARKER)
+		{
+			pos += capacity - offset;
+			continue;
+		}
+		//A length that doesn't fit means a corrupt file, there's nothing more to read.
+		if (offset + LENGTH_SIZE + length > capacity)
+			break;
+		fn(std::span<const std::byte>(records() + offset + LENGTH_SIZE, length));
+		pos += alignUp(LENGTH_SIZE + length);
+	}
+}
+
+}
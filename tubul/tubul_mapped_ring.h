@@ -0,0 +1,73 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+
+namespace TU
+{
+
+/** MappedRing is a ring buffer of variable sized records living in a memory mapped file. When
+ * it's full, the oldest records are overwritten, so the file always holds the latest data and
+ * never grows. The header at the start of the file tells where the valid records are, and it's
+ * only updated after a record is completely written, so the contents survive a crash of the
+ * process (the OS writes the mapped pages back to the file) and can be read afterwards.
+ *
+ * Writers are serialized with a mutex. Every record is a 4 byte length followed by the payload,
+ * padded to 8 bytes, and never wraps around the end of the file (a marker skips to the start).
+ */
+class MappedRing
+{
+public:
+	/** Creates (or truncates) the file at path with room for capacity bytes of records. */
+	MappedRing(const std::string& path, size_t capacity);
+
+	/** Opens an existing ring to read it. Writing to it throws. */
+	explicit MappedRing(const std::string& path);
+
+	MappedRing(const MappedRing&) = delete;
+	MappedRing& operator=(const MappedRing&) = delete;
+
+	~MappedRing();
+
+	/** Appends a record, dropping the oldest ones if needed. Records bigger than half the
+	 * capacity are rejected (returns false).
+	 */
+	bool write(std::span<const std::byte> record);
+
+	/** Calls fn with every record in the ring, from the oldest to the newest. */
+	void forEachRecord(const std::function<void(std::span<const std::byte>)>& fn) const;
+
+	/** Asks the OS to write the mapped pages to the file, without waiting for it. */
+	void flush();
+
+	[[nodiscard]] size_t capacity() const;
+	/** Number of records overwritten to make room for new ones since the file was created. */
+	[[nodiscard]] uint64_t droppedRecords() const;
+	[[nodiscard]] const std::string& path() const { return path_; }
+
+private:
+	struct Header;
+	struct Internals;
+
+	void map(size_t fileSize, bool writable);
+	[[nodiscard]] Header& header() const;
+	[[nodiscard]] std::byte* records() const;
+
+	std::string path_;
+	std::byte* data_ = nullptr;
+	size_t size_ = 0;
+	bool readOnly_ = false;
+	mutable std::mutex mutex_;
+	std::unique_ptr<Internals> impl_;
+};
+
+}
@@ -177,6 +177,7 @@ struct MemoryStats {
 	using PtrSize = std::pair<void*,size_t>;
 	std::atomic_size_t lifetime;
 	std::atomic_size_t alive;
+	std::atomic_size_t allocations;
 	std::vector<PtrSize> sizes;
 
 	auto findArrayAlloc(void *ptr) {
@@ -209,6 +210,11 @@ size_t memLifetime() {
 	return stat.lifetime.load();
 }
 
+size_t memAllocations() {
+	const auto& stat = getTubulStats();
+	return stat.allocations.load();
+}
+
 /**
  * This is the private implementation of the memory monitoring thread.
  * It's actually quite simple using std::thread ability to run a given
@@ -305,6 +311,7 @@ void* operator new(std::size_t sz)
 	//get the stats and add the allocation.
 	auto& stats = TU::getTubulStats();
 	auto total = stats.lifetime.fetch_add(sz);
+	stats.allocations.fetch_add(1, std::memory_order_relaxed);
 	auto cur = stats.alive.fetch_add(sz);
 	if constexpr (TUBUL_LOG_ALLOCATIONS)
 		std::printf("1) new(size_t), size = %zu alive = %zu total alloc'd= %zu\n", sz, cur+sz, total+sz);
@@ -324,6 +331,7 @@ void* operator new[](std::size_t sz)
 	//get the stats and add the allocation.
 	auto& stats = TU::getTubulStats();
 	auto total = stats.lifetime.fetch_add(sz);
+	stats.allocations.fetch_add(1, std::memory_order_relaxed);
 	auto cur = stats.alive.fetch_add(sz);
 	if constexpr (TUBUL_LOG_ALLOCATIONS)
 		std::printf("2) new[](size_t), size = %zu alive = %zu total alloc'd= %zu\n", sz, cur+sz, total+sz);
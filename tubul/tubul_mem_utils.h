@@ -36,8 +36,9 @@ namespace TU
 	 * be used to detect at which point a big number of allocations happened, even
 	 * if the current rss does not change in the end, for example, succesively
 	 * allocating and then deleting those objects. Lifetime memory is always
-	 * increasing, while alive an varies.
+	 * increasing, while alive an varies. memAllocations counts the calls to new.
 	 */
 	size_t memAlive();
 	size_t memLifetime();
+	size_t memAllocations();
 }
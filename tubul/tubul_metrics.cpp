@@ -0,0 +1,286 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include "tubul_metrics.h"
+#include "tubul_exception.h"
+
+#include <array>
+#include <charconv>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+namespace TU
+{
+
+size_t Internal::nextMetricsShard()
+{
+	static std::atomic<size_t> next = 0;
+	return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+enum class MetricsRegistry::Type
+{
+	COUNTER,
+	GAUGE,
+	HISTOGRAM
+};
+
+struct MetricsRegistry::Metric
+{
+	Type type;
+	std::string help;
+	std::unique_ptr<Counter> counter;
+	std::unique_ptr<Gauge> gauge;
+	std::unique_ptr<Histogram> histogram;
+};
+
+namespace
+{
+constexpr std::array<std::pair<double, const char*>, 3> QUANTILES = {{{0.5, "0.5"}, {0.9, "0.9"}, {0.99, "0.99"}}};
+
+const char* typeName(int type)
+{
+	static constexpr std::array<const char*, 3> names = {"counter", "gauge", "summary"};
+	return names[static_cast<size_t>(type)];
+}
+
+bool validName(const std::string& name)
+{
+	auto valid = [](char c, bool first) {
+		return (c >= 'a' and c <= 'z') or (c >= 'A' and c <= 'Z') or c == '_' or c == ':' or
+			   (not first and c >= '0' and c <= '9');
+	};
+	if (name.empty() or not valid(name[0], true))
+		return false;
+	for (size_t i = 1; i < name.size(); ++i)
+		if (not valid(name[i], false))
+			return false;
+	return true;
+}
+
+//Shortest text that reads back as the same double, what Prometheus expects
+std::string numberToStr(double v)
+{
+	std::array<char, 32> buffer;
+	auto [end, ec] = std::to_chars(buffer.data(), buffer.data() + buffer.size(), v);
+	return {buffer.data(), end};
+}
+
+std::string escapeHelp(const std::string& help)
+{
+	std::string res;
+	for (char c: help)
+	{
+		if (c == '\\')
+			res += "\\\\";
+		else if (c == '\n')
+			res += "\\n";
+		else
+			res += c;
+	}
+	return res;
+}
+}
+
+MetricsRegistry::MetricsRegistry() = default;
+
+MetricsRegistry::~MetricsRegistry() = default;
+
+MetricsRegistry::Metric& MetricsRegistry::find(const std::string& name, const std::string& help, Type type)
+{
+	std::lock_guard lock(mutex_);
+	auto it = metrics_.find(name);
+	if (it != metrics_.end())
+	{
+		if (it->second->type != type)
+			throw TU::Exception("[Metrics] Metric " + name + " already exists as a " +
+								typeName(static_cast<int>(it->second->type)));
+		return *it->second;
+	}
+	if (not validName(name))
+		throw TU::Exception("[Metrics] Invalid metric name: '" + name + "'");
+
+	auto metric = std::make_unique<Metric>();
+	metric->type = type;
+	metric->help = help;
+	switch (type)
+	{
+	case Type::COUNTER:
+		metric->counter = std::make_unique<Counter>();
+		break;
+	case Type::GAUGE:
+		metric->gauge = std::make_unique<Gauge>();
+		break;
+	case Type::HISTOGRAM:
+		metric->histogram = std::make_unique<Histogram>();
+		break;
+	}
+	return *metrics_.emplace(name, std::move(metric)).first->second;
+}
+
+Counter& MetricsRegistry::counter(const std::string& name, const std::string& help)
+{
+	return *find(name, help, Type::COUNTER).counter;
+}
+
+Gauge& MetricsRegistry::gauge(const std::string& name, const std::string& help)
+{
+	return *find(name, help, Type::GAUGE).gauge;
+}
+
+Histogram& MetricsRegistry::histogram(const std::string& name, const std::string& help)
+{
+	return *find(name, help, Type::HISTOGRAM).histogram;
+}
+
+void MetricsRegistry::writePrometheus(std::ostream& out) const
+{
+	std::lock_guard lock(mutex_);
+	for (auto const& [name, metric]: metrics_)
+	{
+		if (not metric->help.empty())
+			out << "# HELP " << name << ' ' << escapeHelp(metric->help) << '\n';
+		out << "# TYPE " << name << ' ' << typeName(static_cast<int>(metric->type)) << '\n';
+		switch (metric->type)
+		{
+		case Type::COUNTER:
+			out << name << ' ' << metric->counter->value() << '\n';
+			break;
+		case Type::GAUGE:
+			out << name << ' ' << numberToStr(metric->gauge->value()) << '\n';
+			break;
+		case Type::HISTOGRAM:
+			for (auto [fraction, label]: QUANTILES)
+				out << name << "{quantile=\"" << label << "\"} " << metric->histogram->percentile(fraction) << '\n';
+			out << name << "_sum " << metric->histogram->sum() << '\n';
+			out << name << "_count " << metric->histogram->count() << '\n';
+			break;
+		}
+	}
+}
+
+void MetricsRegistry::writeCsv(std::ostream& out, bool header) const
+{
+	const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+	if (header)
+		out << "timestamp_ms,name,value\n";
+
+	std::lock_guard lock(mutex_);
+	for (auto const& [name, metric]: metrics_)
+	{
+		switch (metric->type)
+		{
+		case Type::COUNTER:
+			out << now << ',' << name << ',' << metric->counter->value() << '\n';
+			break;
+		case Type::GAUGE:
+			out << now << ',' << name << ',' << numberToStr(metric->gauge->value()) << '\n';
+			break;
+		case Type::HISTOGRAM:
+			out << now << ',' << name << "_count," << metric->histogram->count() << '\n';
+			out << now << ',' << name << "_sum," << metric->histogram->sum() << '\n';
+			for (auto [fraction, label]: QUANTILES)
+				out << now << ',' << name << "_p" << static_cast<int>(fraction * 100) << ','
+					<< metric->histogram->percentile(fraction) << '\n';
+			break;
+		}
+	}
+}
+
+void MetricsRegistry::write(std::ostream& out, MetricsFormat format) const
+{
+	if (format == MetricsFormat::PROMETHEUS)
+		writePrometheus(out);
+	else
+		writeCsv(out);
+}
+
+MetricsRegistry& getMetrics()
+{
+	static MetricsRegistry registry;
+	return registry;
+}
+
+/**
+ * The reporter thread works like the one of MemoryMonitor, but it waits on a condition
+ * variable instead of sleeping, so destroying the reporter doesn't wait for a whole period.
+ * Before exiting it writes the metrics one last time, so the final values are always in the file.
+ */
+struct MetricsReporter::Impl
+{
+	Impl(std::string file, MetricsFormat format, std::chrono::milliseconds period, const MetricsRegistry& registry) :
+		file_(std::move(file)), format_(format), period_(period), registry_(registry)
+	{
+		if (format_ == MetricsFormat::CSV)
+		{
+			csv_.open(file_, std::ios::app);
+			if (not csv_)
+				throw TU::Exception("[Metrics] Can't open metrics report file: " + file_);
+			csvHeader_ = csv_.tellp() == 0;
+		}
+		th_ = std::thread(&Impl::reportWorker, this);
+	}
+
+	~Impl()
+	{
+		{
+			std::lock_guard lock(mutex_);
+			exit_ = true;
+		}
+		cv_.notify_one();
+		if (th_.joinable())
+			th_.join();
+	}
+
+	void reportWorker()
+	{
+		std::unique_lock lock(mutex_);
+		while (not cv_.wait_for(lock, period_, [this] { return exit_; }))
+			dump();
+		dump();
+	}
+
+	void dump()
+	{
+		if (format_ == MetricsFormat::CSV)
+		{
+			registry_.writeCsv(csv_, csvHeader_);
+			csv_.flush();
+			csvHeader_ = false;
+			return;
+		}
+		const auto tmp = file_ + ".tmp";
+		{
+			std::ofstream out(tmp);
+			registry_.writePrometheus(out);
+		}
+		std::error_code ec;
+		std::filesystem::rename(tmp, file_, ec);
+	}
+
+private:
+	std::string file_;
+	MetricsFormat format_;
+	std::chrono::milliseconds period_;
+	const MetricsRegistry& registry_;
+	std::ofstream csv_;
+	bool csvHeader_ = false;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	bool exit_ = false;
+	std::thread th_;
+};
+
+MetricsReporter::MetricsReporter(const std::string& reportFileName, MetricsFormat format,
+		std::chrono::milliseconds period, const MetricsRegistry& registry) :
+	impl_(std::make_unique<Impl>(reportFileName, format, period, registry))
+{}
+
+MetricsReporter::~MetricsReporter() = default;
+
+}
@@ -0,0 +1,139 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#pragma once
+
+#include "tubul_histogram.h"
+#include "tubul_mpmc_queue.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace TU
+{
+
+namespace Internal
+{
+	size_t nextMetricsShard();
+
+	//Every thread updates always the same shard of a counter, picked round robin the first time
+	inline size_t metricsShard()
+	{
+		static thread_local const size_t shard = nextMetricsShard();
+		return shard;
+	}
+}
+
+/** Monotonic counter (rows parsed, nodes visited...). Adding to it is a relaxed atomic add
+ * on a cache line of its own for the calling thread, so many threads can count at the same
+ * time without contention; reading it adds up all the shards.
+ */
+class Counter
+{
+public:
+	static constexpr size_t SHARDS = 16;
+
+	void add(uint64_t n = 1)
+	{
+		shards_[Internal::metricsShard() % SHARDS].value.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] uint64_t value() const
+	{
+		uint64_t res = 0;
+		for (auto const& s: shards_)
+			res += s.value.load(std::memory_order_relaxed);
+		return res;
+	}
+
+private:
+	struct alignas(CACHE_LINE_SIZE) Shard
+	{
+		std::atomic<uint64_t> value = 0;
+	};
+	std::array<Shard, SHARDS> shards_ = {};
+};
+
+/** Value that goes up and down (queue length, open files...). */
+class Gauge
+{
+public:
+	void set(double v) { value_.store(v, std::memory_order_relaxed); }
+	void add(double v) { value_.fetch_add(v, std::memory_order_relaxed); }
+	[[nodiscard]] double value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<double> value_ = 0.0;
+};
+
+enum class MetricsFormat
+{
+	PROMETHEUS,
+	CSV
+};
+
+/** Named counters, gauges and histograms of the process. Looking a metric up takes a lock, so
+ * get the reference once and keep it (metrics live as long as the registry); updating it is
+ * lock-free. Names follow the Prometheus rules ([a-zA-Z_:][a-zA-Z0-9_:]*), and asking for an
+ * existing name with another type throws.
+ */
+class MetricsRegistry
+{
+public:
+	MetricsRegistry();
+	MetricsRegistry(const MetricsRegistry&) = delete;
+	MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+	~MetricsRegistry();
+
+	Counter& counter(const std::string& name, const std::string& help = {});
+	Gauge& gauge(const std::string& name, const std::string& help = {});
+	Histogram& histogram(const std::string& name, const std::string& help = {});
+
+	/** Prometheus text exposition format. Histograms are written as summaries (quantiles 0.5,
+	 * 0.9, 0.99 plus _sum and _count), since their buckets are not the Prometheus ones.
+	 */
+	void writePrometheus(std::ostream& out) const;
+
+	/** One "timestamp_ms,name,value" line per value, histograms expanded like in Prometheus
+	 * (name_count, name_sum, name_p50...), so successive dumps can be appended to one file.
+	 */
+	void writeCsv(std::ostream& out, bool header = true) const;
+
+	void write(std::ostream& out, MetricsFormat format) const;
+
+private:
+	enum class Type;
+	struct Metric;
+	Metric& find(const std::string& name, const std::string& help, Type type);
+
+	mutable std::mutex mutex_;
+	std::map<std::string, std::unique_ptr<Metric>> metrics_;
+};
+
+/** The registry of the process, the one the reporter dumps by default. */
+MetricsRegistry& getMetrics();
+
+/** Like MemoryMonitor, a thread that dumps the metrics to a file every period while the object
+ * lives, and once more when it's destroyed. The Prometheus format rewrites the file each time
+ * (through a temporary file and a rename, so a reader never sees half a dump), CSV appends.
+ */
+struct MetricsReporter
+{
+	struct Impl;
+
+	explicit MetricsReporter(const std::string& reportFileName, MetricsFormat format = MetricsFormat::PROMETHEUS,
+			std::chrono::milliseconds period = std::chrono::seconds(1), const MetricsRegistry& registry = getMetrics());
+	~MetricsReporter();
+
+	std::unique_ptr<Impl> impl_;
+};
+
+}
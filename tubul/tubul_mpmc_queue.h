@@ -0,0 +1,236 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+// References:
+//   Dmitry Vyukov's bounded MPMC queue
+//     https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace TU
+{
+
+/** Size we assume for a cache line, used to pad data touched by different threads. */
+inline constexpr size_t CACHE_LINE_SIZE = 64;
+
+/** MPMCQueue is a bounded multi-producer multi-consumer FIFO queue, following Dmitry Vyukov's
+ * design: a ring of slots where each slot has a sequence number telling if it's ready to be
+ * written or read for the current lap. Producers and consumers only compete on an atomic
+ * counter (one for each side) and never take locks. Every slot is padded to a cache line so
+ * neighbours don't suffer false sharing.
+ *
+ * The try* functions never block: tryPush fails when the queue is full and tryPop when it's
+ * empty. push and pop block until they succeed, first spinning for a short while and then
+ * sleeping (with C++20 atomic wait) until the other side makes progress. The other side only
+ * pays for a notify when somebody is actually sleeping.
+ *
+ * The capacity is rounded up to a power of two. T must be move constructible and its
+ * constructors should not throw (a throwing constructor would leave its slot unusable).
+ */
+template <typename T>
+class MPMCQueue
+{
+public:
+	using value_type = T;
+
+	explicit MPMCQueue(size_t capacity) :
+		capacity_(std::bit_ceil(std::max<size_t>(capacity, 2))),
+		mask_(capacity_ - 1),
+		slots_(std::make_unique<Slot[]>(capacity_))
+	{
+		for (size_t i = 0; i < capacity_; ++i)
+			slots_[i].sequence_.store(i, std::memory_order_relaxed);
+	}
+
+	MPMCQueue(const MPMCQueue&) = delete;
+	MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+	~MPMCQueue()
+	{
+		//Destroy whatever is left in the queue. Nobody else can be using it at this point.
+		const size_t head = enqueue_pos_.load(std::memory_order_relaxed);
+		for (size_t pos = dequeue_pos_.load(std::memory_order_relaxed); pos != head; ++pos)
+		{
+			Slot& slot = slots_[pos & mask_];
+			if (slot.sequence_.load(std::memory_order_relaxed) == pos + 1)
+				slot.item()->~T();
+		}
+	}
+
+	[[nodiscard]] size_t capacity() const { return capacity_; }
+
+	/** Number of elements in the queue. It's only a hint when other threads are using it. */
+	[[nodiscard]] size_t sizeApprox() const
+	{
+		auto tail = dequeue_pos_.load(std::memory_order_relaxed);
+		auto head = enqueue_pos_.load(std::memory_order_relaxed);
+		return head > tail ? head - tail : 0;
+	}
+
+	[[nodiscard]] bool emptyApprox() const { return sizeApprox() == 0; }
+
+	template <typename... Args>
+	bool tryEmplace(Args&&... args)
+	{
+		size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Slot& slot = slots_[pos & mask_];
+			const size_t seq = slot.sequence_.load(std::memory_order_acquire);
+			const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (diff == 0)
+			{
+				if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					new (slot.storage_) T(std::forward<Args>(args)...);
+					slot.sequence_.store(pos + 1, std::memory_order_release);
+					notifyConsumers();
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				//The slot still holds the element of the previous lap: the queue is full.
+				return false;
+			}
+			else
+			{
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	//The value is only moved from if the push succeeds.
+	bool tryPush(T&& value) { return tryEmplace(std::move(value)); }
+	bool tryPush(const T& value) { return tryEmplace(value); }
+
+	bool tryPop(T& out)
+	{
+		size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Slot& slot = slots_[pos & mask_];
+			const size_t seq = slot.sequence_.load(std::memory_order_acquire);
+			const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+			if (diff == 0)
+			{
+				if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					T* item = slot.item();
+					out = std::move(*item);
+					item->~T();
+					slot.sequence_.store(pos + capacity_, std::memory_order_release);
+					notifyProducers();
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				//Nothing was written in this slot for this lap: the queue is empty.
+				return false;
+			}
+			else
+			{
+				pos = dequeue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	template <typename... Args>
+	void emplace(Args&&... args)
+	{
+		waitUntil(popped_, producers_waiting_, [&] { return tryEmplace(std::forward<Args>(args)...); });
+	}
+
+	void push(T&& value) { emplace(std::move(value)); }
+	void push(const T& value) { emplace(value); }
+
+	void pop(T& out)
+	{
+		waitUntil(pushed_, consumers_waiting_, [&] { return tryPop(out); });
+	}
+
+	T pop()
+	{
+		T res;
+		pop(res);
+		return res;
+	}
+
+private:
+	struct alignas(CACHE_LINE_SIZE) Slot
+	{
+		T* item() { return std::launder(reinterpret_cast<T*>(storage_)); }
+
+		std::atomic<size_t> sequence_;
+		alignas(T) unsigned char storage_[sizeof(T)];
+	};
+
+	//Spin a little, then sleep on the epoch counter of the other side until it changes. The
+	//fence after announcing ourselves pairs with the one in wakeUp() (a Dekker handshake):
+	//either the other side sees us waiting and bumps the epoch, or our next attempt sees the
+	//slot it just published.
+	template <typename TryFn>
+	static void waitUntil(std::atomic<uint32_t>& epoch, std::atomic<uint32_t>& waiting, TryFn&& attempt)
+	{
+		static constexpr int SPINS = 64;
+		for (int i = 0; i < SPINS; ++i)
+		{
+			if (attempt())
+				return;
+			if (i >= SPINS / 2)
+				std::this_thread::yield();
+		}
+		for (;;)
+		{
+			waiting.fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			const auto current = epoch.load(std::memory_order_acquire);
+			const bool done = attempt();
+			if (not done)
+				epoch.wait(current, std::memory_order_acquire);
+			waiting.fetch_sub(1, std::memory_order_relaxed);
+			if (done or attempt())
+				return;
+		}
+	}
+
+	//Only reads the waiting counter, so while nobody blocks its cache line stays shared.
+	static void wakeUp(std::atomic<uint32_t>& epoch, std::atomic<uint32_t>& waiting)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting.load(std::memory_order_relaxed) > 0)
+		{
+			epoch.fetch_add(1, std::memory_order_release);
+			epoch.notify_all();
+		}
+	}
+
+	void notifyConsumers() { wakeUp(pushed_, consumers_waiting_); }
+	void notifyProducers() { wakeUp(popped_, producers_waiting_); }
+
+	const size_t capacity_;
+	const size_t mask_;
+	std::unique_ptr<Slot[]> slots_;
+
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueue_pos_ = 0;
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeue_pos_ = 0;
+	//Counters used to sleep in the blocking functions. They only change when somebody is
+	//waiting, so the non blocking path only pays a fence and a read of a shared line.
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> pushed_ = 0;
+	std::atomic<uint32_t> consumers_waiting_ = 0;
+	alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> popped_ = 0;
+	std::atomic<uint32_t> producers_waiting_ = 0;
+};
+
+}
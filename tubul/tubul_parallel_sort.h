@@ -0,0 +1,182 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <ranges>
+#include <utility>
+#include <vector>
+#include "tubul_thread_pool.h"
+
+namespace TU
+{
+
+/** parallelSort never splits the input in chunks smaller than this. Inputs smaller than two
+ * chunks are sorted on the calling thread.
+ */
+inline constexpr size_t PARALLEL_SORT_MIN_CHUNK = 4096;
+
+namespace detail
+{
+	//Runs fn(0) ... fn(jobs - 1) using the pool and the calling thread. Jobs are claimed from
+	//a shared counter, so the caller keeps working until every job is taken and never waits for
+	//a pool task to start. That makes it safe to call from inside a task, even when every
+	//worker is busy. Pool tasks that start after everything is claimed simply return.
+	template <typename Fn>
+	void runParallel(ThreadPool& pool, size_t jobs, Fn&& fn)
+	{
+		if (jobs == 0)
+			return;
+		struct State
+		{
+			explicit State(size_t count) : jobs_(count) {}
+
+			const size_t jobs_;
+			std::atomic<size_t> next_ = 0;
+			std::atomic<size_t> done_ = 0;
+		};
+		auto state = std::make_shared<State>(jobs);
+		auto* job_fn = &fn;
+		auto work = [state, job_fn]
+		{
+			for (size_t job = state->next_.fetch_add(1); job < state->jobs_; job = state->next_.fetch_add(1))
+			{
+				(*job_fn)(job);
+				if (state->done_.fetch_add(1) + 1 == state->jobs_)
+					state->done_.notify_all();
+			}
+		};
+		const size_t helpers = std::min(jobs - 1, pool.threadCount());
+		for (size_t i = 0; i < helpers; ++i)
+			pool.pushTask(work);
+		work();
+		for (size_t done = state->done_.load(); done < jobs; done = state->done_.load())
+			state->done_.wait(done);
+	}
+
+	//Merges the sorted runs [a0, a1) and [b0, b1) of src into dst starting at out.
+	struct MergeJob
+	{
+		size_t a0, a1, b0, b1, out;
+	};
+
+	//Splits the merge of two adjacent runs in pieces of about piece_size elements that can be
+	//merged independently: pivots are taken evenly from the longest run, and the other run is
+	//cut where those pivots would go.
+	template <typename SrcIt, typename Compare>
+	void splitMerge(SrcIt src, size_t a0, size_t a1, size_t b0, size_t b1, size_t piece_size, Compare& comp, std::vector<MergeJob>& jobs)
+	{
+		const bool a_longest = (a1 - a0) >= (b1 - b0);
+		const size_t long0 = a_longest ? a0 : b0;
+		const size_t long1 = a_longest ? a1 : b1;
+		const size_t short0 = a_longest ? b0 : a0;
+		const size_t short1 = a_longest ? b1 : a1;
+		const size_t total = (a1 - a0) + (b1 - b0);
+		const size_t pieces = std::max<size_t>(1, std::min(long1 - long0, total / piece_size));
+		const size_t out0 = a0;
+
+		size_t prev_long = long0;
+		size_t prev_short = short0;
+		for (size_t piece = 1; piece <= pieces; ++piece)
+		{
+			size_t next_long = long1;
+			size_t next_short = short1;
+			if (piece < pieces)
+			{
+				next_long = long0 + (long1 - long0) * piece / pieces;
+				next_short = static_cast<size_t>(std::lower_bound(src + prev_short, src + short1, src[next_long], comp) - src);
+			}
+			const size_t out = out0 + (prev_long - long0) + (prev_short - short0);
+			jobs.push_back(MergeJob{prev_long, next_long, prev_short, next_short, out});
+			prev_long = next_long;
+			prev_short = next_short;
+		}
+	}
+
+	//One round of the merge sort: merges runs 0-1, 2-3, ... of src into dst (an odd run at
+	//the end is just moved) and returns the boundaries of the new runs.
+	template <typename SrcIt, typename DstIt, typename Compare>
+	std::vector<size_t> mergeRound(ThreadPool& pool, SrcIt src, DstIt dst, const std::vector<size_t>& runs, size_t piece_size, Compare& comp)
+	{
+		std::vector<MergeJob> jobs;
+		std::vector<size_t> merged{0};
+		for (size_t r = 0; r + 1 < runs.size(); r += 2)
+		{
+			const size_t end = (r + 2 < runs.size()) ? runs[r + 2] : runs[r + 1];
+			splitMerge(src, runs[r], runs[r + 1], runs[r + 1], end, piece_size, comp, jobs);
+			merged.push_back(end);
+		}
+		runParallel(pool, jobs.size(), [&](size_t j)
+		{
+			const auto& job = jobs[j];
+			std::merge(std::make_move_iterator(src + job.a0), std::make_move_iterator(src + job.a1),
+					   std::make_move_iterator(src + job.b0), std::make_move_iterator(src + job.b1), dst + job.out, comp);
+		});
+		return merged;
+	}
+}
+
+
+/** Sorts [first, last) with comp, using the workers of the pool. The input is split in one
+ * chunk per worker (plus one for the calling thread, which takes part in the work), every
+ * chunk is sorted with std::sort and then the chunks are merged in pairs. Every merge is
+ * split in independent pieces, so all the threads keep busy until the last merge. It needs a
+ * temporary copy of the input and, like std::sort, it is not stable.
+ * It can be called from inside a pool task: the calling thread does the work itself when the
+ * workers are busy.
+ */
+template <std::random_access_iterator It, typename Compare = std::less<>>
+void parallelSort(ThreadPool& pool, It first, It last, Compare comp = {})
+{
+	using T = std::iter_value_t<It>;
+	const auto n = static_cast<size_t>(last - first);
+	const size_t threads = pool.threadCount() + 1;
+	const size_t chunks = std::min(threads, n / PARALLEL_SORT_MIN_CHUNK);
+	if (chunks < 2)
+	{
+		std::sort(first, last, comp);
+		return;
+	}
+
+	std::vector<size_t> runs(chunks + 1);
+	for (size_t c = 0; c <= chunks; ++c)
+		runs[c] = n * c / chunks;
+	detail::runParallel(pool, chunks, [&](size_t c) { std::sort(first + runs[c], first + runs[c + 1], comp); });
+
+	//The merges ping-pong between the input and the buffer, starting from the buffer.
+	std::vector<T> buffer(std::make_move_iterator(first), std::make_move_iterator(last));
+	const size_t piece_size = std::max(PARALLEL_SORT_MIN_CHUNK, n / threads);
+	bool in_buffer = true;
+	while (runs.size() > 2)
+	{
+		if (in_buffer)
+			runs = detail::mergeRound(pool, buffer.begin(), first, runs, piece_size, comp);
+		else
+			runs = detail::mergeRound(pool, first, buffer.begin(), runs, piece_size, comp);
+		in_buffer = not in_buffer;
+	}
+	if (in_buffer)
+	{
+		detail::runParallel(pool, chunks, [&](size_t c)
+		{
+			auto begin = buffer.begin() + static_cast<std::ptrdiff_t>(n * c / chunks);
+			auto end = buffer.begin() + static_cast<std::ptrdiff_t>(n * (c + 1) / chunks);
+			std::move(begin, end, first + static_cast<std::ptrdiff_t>(n * c / chunks));
+		});
+	}
+}
+
+/** Sorts a whole random access container (std::vector, PODVector, ...) with parallelSort. */
+template <std::ranges::random_access_range R, typename Compare = std::less<>>
+void parallelSort(ThreadPool& pool, R&& range, Compare comp = {})
+{
+	parallelSort(pool, std::ranges::begin(range), std::ranges::end(range), std::move(comp));
+}
+
+}
@@ -0,0 +1,119 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include "tubul_perf_counters.h"
+
+#include <utility>
+
+#ifdef TUBUL_LINUX
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace TU
+{
+
+#ifdef TUBUL_LINUX
+
+namespace
+{
+	int openCounter(uint64_t config, int groupFd)
+	{
+		perf_event_attr attr{};
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config;
+		attr.disabled = groupFd == -1 ? 1 : 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0));
+	}
+}
+
+struct PerfCounterGroup::Internals
+{
+	std::array<int, COUNT> fds = {-1, -1, -1, -1};
+};
+
+PerfCounterGroup::PerfCounterGroup() :
+	internals_(std::make_unique<Internals>())
+{
+	constexpr std::array<uint64_t, COUNT> configs = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+	auto& fds = internals_->fds;
+	for (size_t i = 0; i < COUNT; ++i)
+	{
+		fds[i] = openCounter(configs[i], i == 0 ? -1 : fds[0]);
+		if (fds[i] == -1)
+		{
+			for (auto& fd: fds)
+				if (fd != -1)
+					close(std::exchange(fd, -1));
+			return;
+		}
+	}
+	ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+PerfCounterGroup::~PerfCounterGroup()
+{
+	for (auto fd: internals_->fds)
+		if (fd != -1)
+			close(fd);
+}
+
+bool PerfCounterGroup::valid() const
+{
+	return internals_->fds[0] != -1;
+}
+
+bool PerfCounterGroup::read(Values& values) const
+{
+	if (not valid())
+		return false;
+	//nr, time enabled, time running, and the values
+	std::array<uint64_t, 3 + COUNT> data;
+	const auto bytes = ::read(internals_->fds[0], data.data(), sizeof(data));
+	//Without time running, the group never got on the PMU and the values mean nothing.
+	if (bytes != static_cast<ssize_t>(sizeof(data)) or data[0] != COUNT or data[2] == 0)
+		return false;
+	for (size_t i = 0; i < COUNT; ++i)
+		values[i] = data[3 + i];
+	return true;
+}
+
+#else
+
+struct PerfCounterGroup::Internals
+{
+};
+
+PerfCounterGroup::PerfCounterGroup() = default;
+
+PerfCounterGroup::~PerfCounterGroup() = default;
+
+bool PerfCounterGroup::valid() const
+{
+	return false;
+}
+
+bool PerfCounterGroup::read(Values&) const
+{
+	return false;
+}
+
+#endif
+
+bool PerfCounterGroup::supported()
+{
+	const PerfCounterGroup group;
+	Values values{};
+	return group.read(values);
+}
+
+}
@@ -0,0 +1,53 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace TU
+{
+
+/** Hardware performance counters of the calling thread (Linux perf_event_open): cycles,
+ * instructions, cache misses and branch misses, counted in user space only. They are opened as
+ * one group, so the four values always cover the same instructions.
+ *
+ * When the counters can't be used (other platforms, perf_event_paranoid too strict, a VM or
+ * container without a PMU) the group is simply not valid() and read() returns false.
+ */
+class PerfCounterGroup
+{
+public:
+	enum Counter : size_t
+	{
+		CYCLES,
+		INSTRUCTIONS,
+		CACHE_MISSES,
+		BRANCH_MISSES,
+		COUNT
+	};
+	using Values = std::array<uint64_t, COUNT>;
+
+	PerfCounterGroup();
+	PerfCounterGroup(const PerfCounterGroup&) = delete;
+	PerfCounterGroup& operator=(const PerfCounterGroup&) = delete;
+	~PerfCounterGroup();
+
+	[[nodiscard]] bool valid() const;
+
+	/** Current value of the counters, since the group was opened. */
+	bool read(Values& values) const;
+
+	/** True when the counters can be opened in this process. */
+	static bool supported();
+
+private:
+	struct Internals;
+	std::unique_ptr<Internals> internals_;
+};
+
+}
@@ -0,0 +1,302 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#include "tubul_profiler.h"
+#include "tubul_blocks.h"
+#include "tubul_exception.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef TUBUL_WINDOWS
+#include <csignal>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#endif
+
+#if defined(TUBUL_LINUX) and (defined(__x86_64__) or defined(__aarch64__))
+#include <sys/uio.h>
+#include <unistd.h>
+#define TUBUL_PROFILER_FRAME_POINTERS
+#endif
+
+namespace TU
+{
+
+namespace
+{
+	constexpr int MAX_FRAMES = 62;
+	//Frames of the signal handler itself (the handler and the signal trampoline).
+	constexpr int HANDLER_FRAMES = 2;
+
+	struct Sample
+	{
+		std::atomic<bool> ready = false;
+		uint32_t depth = 0;
+		size_t pathId = 0;
+		std::array<void*, MAX_FRAMES> frames;
+	};
+
+	//Everything the signal handler touches is allocated before the timer starts: the handler
+	//only takes a slot with an atomic increment and fills it.
+	struct Profiler
+	{
+		std::mutex mutex;
+		std::atomic<bool> running = false;
+		std::vector<Sample> samples;
+		size_t capacity = 0;
+		std::atomic<size_t> next = 0;
+		std::atomic<size_t> dropped = 0;
+		bool framePointers = false;
+		bool handlerInstalled = false;
+	};
+
+	Profiler& getProfiler()
+	{
+		static Profiler profiler;
+		return profiler;
+	}
+
+#ifdef TUBUL_PROFILER_FRAME_POINTERS
+	//Reading through the kernel turns a bad address into an error instead of a crash, and it's a
+	//plain system call, so it can be used in the signal handler.
+	bool readMemory(uintptr_t address, void* out, size_t size)
+	{
+		iovec local{out, size};
+		iovec remote{reinterpret_cast<void*>(address), size};
+		return process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == static_cast<ssize_t>(size);
+	}
+
+	//Follows the chain of frame pointers from the interrupted instruction. Frames of code built
+	//without frame pointers are skipped or end the walk early, but no lock is taken.
+	int walkFramePointers(const ucontext_t* context, void** frames, int maxFrames)
+	{
+#if defined(__x86_64__)
+		const auto pc = static_cast<uintptr_t>(context->uc_mcontext.gregs[REG_RIP]);
+		auto fp = static_cast<uintptr_t>(context->uc_mcontext.gregs[REG_RBP]);
+		const auto sp = static_cast<uintptr_t>(context->uc_mcontext.gregs[REG_RSP]);
+#else
+		const auto pc = static_cast<uintptr_t>(context->uc_mcontext.pc);
+		auto fp = static_cast<uintptr_t>(context->uc_mcontext.regs[29]);
+		const auto sp = static_cast<uintptr_t>(context->uc_mcontext.sp);
+#endif
+		int depth = 0;
+		frames[depth++] = reinterpret_cast<void*>(pc);
+		//The stack grows down, so every caller's frame is above the previous one.
+		while (depth < maxFrames and fp >= sp and fp % sizeof(uintptr_t) == 0)
+		{
+			//A frame record is the caller's frame pointer followed by the return address.
+			std::array<uintptr_t, 2> record;
+			if (not readMemory(fp, record.data(), sizeof(record)) or record[1] == 0)
+				break;
+			frames[depth++] = reinterpret_cast<void*>(record[1]);
+			if (record[0] <= fp)
+				break;
+			fp = record[0];
+		}
+		return depth;
+	}
+#endif
+
+#ifndef TUBUL_WINDOWS
+	void onProfilingSignal(int, siginfo_t*, void* context)
+	{
+		auto& profiler = getProfiler();
+		if (not profiler.running.load(std::memory_order_acquire))
+			return;
+		const int savedErrno = errno;
+		const auto slot = profiler.next.fetch_add(1, std::memory_order_relaxed);
+		if (slot < profiler.capacity)
+		{
+			auto& sample = profiler.samples[slot];
+#ifdef TUBUL_PROFILER_FRAME_POINTERS
+			if (profiler.framePointers)
+			{
+				const int depth = walkFramePointers(static_cast<const ucontext_t*>(context), sample.frames.data(), MAX_FRAMES);
+				sample.depth = static_cast<uint32_t>(depth);
+			}
+			else
+#endif
+			{
+				(void)context;
+				std::array<void*, MAX_FRAMES + HANDLER_FRAMES> frames;
+				const int depth = backtrace(frames.data(), static_cast<int>(frames.size()));
+				const int skip = std::min(depth, HANDLER_FRAMES);
+				for (int i = skip; i < depth; ++i)
+					sample.frames[i - skip] = frames[i];
+				sample.depth = static_cast<uint32_t>(depth - skip);
+			}
+			sample.pathId = getCurrentBlockPathId();
+			sample.ready.store(true, std::memory_order_release);
+		}
+		else
+		{
+			profiler.dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+		errno = savedErrno;
+	}
+
+	void setTimer(int frequency)
+	{
+		itimerval timer{};
+		if (frequency > 0)
+		{
+			timer.it_interval.tv_sec = 0;
+			timer.it_interval.tv_usec = std::max(1, 1000000 / frequency);
+			timer.it_value = timer.it_interval;
+		}
+		setitimer(ITIMER_PROF, &timer, nullptr);
+	}
+
+	//Name of the function of a frame, or the binary and offset when it has no symbol.
+	std::string frameName(void* address, bool returnAddress)
+	{
+		//A return address points after the call, which may be the start of the next function.
+		auto* lookup = static_cast<char*>(address) - (returnAddress ? 1 : 0);
+		Dl_info info{};
+		if (dladdr(lookup, &info) == 0)
+			return std::format("{}", address);
+		std::string name;
+		if (info.dli_sname != nullptr)
+		{
+			int status = 0;
+			char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+			name = status == 0 ? demangled : info.dli_sname;
+			std::free(demangled);
+		}
+		else
+		{
+			std::string module = info.dli_fname != nullptr ? info.dli_fname : "?";
+			module = module.substr(module.find_last_of('/') + 1);
+			name = std::format("{}+{:#x}", module, lookup - static_cast<char*>(info.dli_fbase));
+		}
+		//';' separates the frames in the collapsed format
+		for (auto& c: name)
+			if (c == ';')
+				c = ':';
+		return name;
+	}
+#endif
+}
+
+void startSamplingProfiler(SamplingProfilerOptions options)
+{
+#ifdef TUBUL_WINDOWS
+	(void)options;
+	throw TU::Exception("[Profiler] The sampling profiler is not supported on Windows");
+#else
+	if (options.frequency <= 0 or options.maxSamples == 0)
+		throw TU::Exception("[Profiler] The frequency and the number of samples must be positive");
+	auto& profiler = getProfiler();
+	const std::scoped_lock lock(profiler.mutex);
+	if (profiler.running.load())
+		throw TU::Exception("[Profiler] The sampling profiler is already running");
+#ifndef TUBUL_PROFILER_FRAME_POINTERS
+	if (options.framePointers)
+		throw TU::Exception("[Profiler] Frame pointer unwinding is only supported on Linux x86-64 and arm64");
+#endif
+
+	profiler.samples = std::vector<Sample>(options.maxSamples);
+	profiler.capacity = options.maxSamples;
+	profiler.next = 0;
+	profiler.dropped = 0;
+	profiler.framePointers = options.framePointers;
+	//The first backtrace loads the unwinder, which is not something to do inside a signal handler.
+	std::array<void*, 4> warmUp;
+	backtrace(warmUp.data(), static_cast<int>(warmUp.size()));
+
+	//The handler stays installed after stopping: a signal still on its way would kill the
+	//process with the default action.
+	if (not profiler.handlerInstalled)
+	{
+		struct sigaction action{};
+		action.sa_sigaction = onProfilingSignal;
+		action.sa_flags = SA_RESTART | SA_SIGINFO;
+		sigemptyset(&action.sa_mask);
+		if (sigaction(SIGPROF, &action, nullptr) != 0)
+			throw TU::Exception("[Profiler] Could not install the SIGPROF handler");
+		profiler.handlerInstalled = true;
+	}
+	profiler.running.store(true, std::memory_order_release);
+	setTimer(options.frequency);
+#endif
+}
+
+size_t stopSamplingProfiler()
+{
+	auto& profiler = getProfiler();
+	const std::scoped_lock lock(profiler.mutex);
+	if (not profiler.running.load())
+		return 0;
+#ifndef TUBUL_WINDOWS
+	setTimer(0);
+#endif
+	profiler.running.store(false, std::memory_order_release);
+	return std::min(profiler.next.load(), profiler.capacity);
+}
+
+size_t droppedProfilerSamples()
+{
+	return getProfiler().dropped.load();
+}
+
+size_t writeCollapsedStacks(std::ostream& out)
+{
+#ifdef TUBUL_WINDOWS
+	(void)out;
+	return 0;
+#else
+	auto& profiler = getProfiler();
+	const std::scoped_lock lock(profiler.mutex);
+	const auto taken = std::min(profiler.next.load(), profiler.capacity);
+
+	std::unordered_map<void*, std::string> returnNames;
+	std::unordered_map<void*, std::string> pcNames;
+	std::unordered_map<size_t, std::string> locations;
+	std::map<std::string, size_t> stacks;
+	for (size_t i = 0; i < taken; ++i)
+	{
+		const auto& sample = profiler.samples[i];
+		if (not sample.ready.load(std::memory_order_acquire))
+			continue;
+		auto location = locations.find(sample.pathId);
+		if (location == locations.end())
+			location = locations.emplace(sample.pathId, sample.pathId == 0 ? std::string("[no block]") :
+				"[" + getBlockPathLocation(sample.pathId) + "]").first;
+
+		std::string stack = location->second;
+		//Outermost frame first. The innermost one is where the signal arrived, the rest are
+		//return addresses.
+		for (size_t f = sample.depth; f-- > 0;)
+		{
+			const bool returnAddress = f > 0;
+			auto& names = returnAddress ? returnNames : pcNames;
+			auto name = names.find(sample.frames[f]);
+			if (name == names.end())
+				name = names.emplace(sample.frames[f], frameName(sample.frames[f], returnAddress)).first;
+			stack += ';';
+			stack += name->second;
+		}
+		++stacks[stack];
+	}
+	for (const auto& [stack, count]: stacks)
+		out << stack << ' ' << count << '\n';
+	return stacks.size();
+#endif
+}
+
+}
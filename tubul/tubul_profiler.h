@@ -0,0 +1,53 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+
+namespace TU
+{
+
+struct SamplingProfilerOptions
+{
+	//Samples per second of CPU time used by the process
+	int frequency = 99;
+	//Samples kept (the rest are counted as dropped). Every sample takes about half a kb.
+	size_t maxSamples = 20000;
+	//Walk the frame pointers instead of calling backtrace() (see below). Only on Linux x86-64
+	//and arm64, and the stacks are only complete for code built with -fno-omit-frame-pointer
+	//(the TUBUL_FRAME_POINTERS cmake option does it for tubul and the code linking it).
+	bool framePointers = false;
+};
+
+/** In-process sampling profiler. While it runs, the process gets a SIGPROF every 1/frequency
+ * seconds of CPU time, and the handler stores the stack of the thread that was running, along
+ * with its current TU::Block location. It finds hotspots inside big blocks without annotating
+ * more code or using external tools.
+ *
+ * Only one profiler runs at a time. It uses setitimer and backtrace, so it's not available on
+ * Windows (starting it throws). Function names come from the dynamic symbol table: link the
+ * executable with -rdynamic to see the names of its own functions.
+ *
+ * glibc's backtrace() is not async-signal-safe: the unwinder takes the dynamic loader lock, so a
+ * sample landing while the thread is inside dlopen, or unwinding an exception, can deadlock the
+ * process. Programs that load libraries or throw while being profiled should use framePointers,
+ * whose handler takes no locks (it reads the stack through a system call that can't fault).
+ */
+void startSamplingProfiler(SamplingProfilerOptions options = {});
+
+/** Stops taking samples and returns how many were taken. They are kept until the next start. */
+size_t stopSamplingProfiler();
+
+/** Samples dropped because maxSamples was reached. */
+size_t droppedProfilerSamples();
+
+/** Writes the samples in the collapsed stack format of flamegraph.pl (and speedscope, etc): one
+ * line per distinct stack, "[block.location];outer;...;inner count". Samples outside of any
+ * block start with "[no block]". Returns the number of lines.
+ */
+size_t writeCollapsedStacks(std::ostream& out);
+
+}
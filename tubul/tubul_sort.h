@@ -0,0 +1,203 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <ranges>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace TU
+{
+
+/** Below this size radix sort falls back to a comparison sort, since clearing and scanning
+ * the digit histograms costs more than sorting a handful of elements.
+ */
+inline constexpr size_t RADIX_SORT_MIN_SIZE = 256;
+
+namespace detail
+{
+	/** Keys radix sort knows how to handle: integers and 32/64 bit floats. */
+	template <typename K>
+	concept RadixKey = (std::integral<K> and not std::is_same_v<K, bool>) or (std::floating_point<K> and (sizeof(K) == 4 or sizeof(K) == 8));
+
+	template <typename K>
+	struct RadixBitsOf
+	{
+		using type = std::make_unsigned_t<K>;
+	};
+
+	template <std::floating_point K>
+	struct RadixBitsOf<K>
+	{
+		using type = std::conditional_t<sizeof(K) == 4, uint32_t, uint64_t>;
+	};
+
+	template <RadixKey K>
+	using RadixBits = typename RadixBitsOf<K>::type;
+
+	//Maps a key to an unsigned integer with the same order, so the sort only deals with bytes.
+	//Signed integers get their sign bit flipped. Positive floats get the sign bit set, and
+	//negative ones get all bits flipped (bigger magnitude means smaller number). This puts
+	//-0.0 just before +0.0 and NaNs at the ends, depending on their sign.
+	template <RadixKey K>
+	constexpr RadixBits<K> radixBits(K key)
+	{
+		using U = RadixBits<K>;
+		constexpr U SIGN_BIT = U{1} << (sizeof(U) * 8 - 1);
+		if constexpr (std::floating_point<K>)
+		{
+			const auto bits = std::bit_cast<U>(key);
+			return (bits & SIGN_BIT) ? static_cast<U>(~bits) : static_cast<U>(bits | SIGN_BIT);
+		}
+		else if constexpr (std::is_signed_v<K>)
+			return static_cast<U>(static_cast<U>(key) ^ SIGN_BIT);
+		else
+			return key;
+	}
+
+	/** Element types radix sort can sort without being told how to get the key: the keys
+	 * themselves, or pairs with the key as first (like the contents of a FlatMap).
+	 */
+	template <typename T>
+	concept RadixSortable = RadixKey<T> or requires(const T& v) {
+		requires RadixKey<std::remove_cvref_t<decltype(v.first)>>;
+	};
+
+	template <RadixSortable T>
+	constexpr auto radixDefaultKey(const T& v)
+	{
+		if constexpr (RadixKey<T>)
+			return v;
+		else
+			return v.first;
+	}
+
+	/** True when sorting with C gives the same order as radix sort on the key K. */
+	template <typename C, typename K>
+	inline constexpr bool isRadixOrder = RadixKey<K> and (std::is_same_v<C, std::less<K>> or std::is_same_v<C, std::less<>>);
+}
+
+/** Sorts [first, last) in ascending order of key(element) with a LSD radix sort, one byte
+ * of the key per pass. The key must be an integer or a float/double, and the sort is stable,
+ * so it also sorts key-value pairs (or any struct) by their key. Passes where all elements
+ * share the same byte are skipped, so small keys in wide types (like ids below 65536 stored in
+ * an int64_t) only pay for the bytes they use. Floats are ordered as with operator< except
+ * that -0.0 goes before +0.0 and NaNs go to the start (negative) or the end (positive).
+ * It needs a temporary copy of the input.
+ */
+template <std::random_access_iterator It, typename KeyFn>
+	requires detail::RadixKey<std::remove_cvref_t<std::invoke_result_t<KeyFn&, std::iter_reference_t<It>>>>
+void radixSortBy(It first, It last, KeyFn key)
+{
+	using T = std::iter_value_t<It>;
+	using K = std::remove_cvref_t<std::invoke_result_t<KeyFn&, std::iter_reference_t<It>>>;
+	using U = detail::RadixBits<K>;
+	constexpr size_t PASSES = sizeof(U);
+	constexpr size_t DIGITS = 256;
+
+	auto bits = [&key](const T& v) { return detail::radixBits(static_cast<K>(std::invoke(key, v))); };
+	const auto n = static_cast<size_t>(last - first);
+	if (n < RADIX_SORT_MIN_SIZE)
+	{
+		std::stable_sort(first, last, [&bits](const T& a, const T& b) { return bits(a) < bits(b); });
+		return;
+	}
+
+	//The histograms of all the passes are computed in a single scan of the input.
+	std::array<std::array<size_t, DIGITS>, PASSES> counts = {};
+	for (auto it = first; it != last; ++it)
+	{
+		const U u = bits(*it);
+		for (size_t pass = 0; pass < PASSES; ++pass)
+			++counts[pass][(u >> (pass * 8)) & 0xFF];
+	}
+
+	//Every pass scatters the elements from one side to the other, starting from the buffer.
+	std::vector<T> buffer(std::make_move_iterator(first), std::make_move_iterator(last));
+	bool in_buffer = true;
+	const U first_bits = bits(buffer.front());
+	for (size_t pass = 0; pass < PASSES; ++pass)
+	{
+		const size_t shift = pass * 8;
+		auto& count = counts[pass];
+		if (count[(first_bits >> shift) & 0xFF] == n)
+			continue;
+
+		std::array<size_t, DIGITS> offsets;
+		size_t sum = 0;
+		for (size_t d = 0; d < DIGITS; ++d)
+		{
+			offsets[d] = sum;
+			sum += count[d];
+		}
+		auto scatter = [&](auto src, auto dst)
+		{
+			for (size_t i = 0; i < n; ++i)
+			{
+				const size_t digit = (bits(src[i]) >> shift) & 0xFF;
+				dst[offsets[digit]++] = std::move(src[i]);
+			}
+		};
+		if (in_buffer)
+			scatter(buffer.begin(), first);
+		else
+			scatter(first, buffer.begin());
+		in_buffer = not in_buffer;
+	}
+	if (in_buffer)
+		std::move(buffer.begin(), buffer.end(), first);
+}
+
+template <std::ranges::random_access_range R, typename KeyFn>
+void radixSortBy(R&& range, KeyFn key)
+{
+	radixSortBy(std::ranges::begin(range), std::ranges::end(range), std::move(key));
+}
+
+/** Radix sorts integers and floats by their value, and pairs (like std::pair<int, Value>)
+ * by their first member. See radixSortBy.
+ */
+template <std::random_access_iterator It>
+	requires detail::RadixSortable<std::iter_value_t<It>>
+void radixSort(It first, It last)
+{
+	radixSortBy(first, last, [](const auto& v) { return detail::radixDefaultKey(v); });
+}
+
+template <std::ranges::random_access_range R>
+	requires detail::RadixSortable<std::ranges::range_value_t<R>>
+void radixSort(R&& range)
+{
+	radixSort(std::ranges::begin(range), std::ranges::end(range));
+}
+
+namespace detail
+{
+	//Sort used by the bulk constructors of FlatMap and FlatSet: radix sort when the
+	//comparison is the natural order of an arithmetic key, std::sort otherwise.
+	template <typename C, typename K, typename It, typename Compare, typename KeyFn>
+	void flatContainerSort(It first, It last, Compare& comp, KeyFn key)
+	{
+		if constexpr (isRadixOrder<C, K>)
+		{
+			if (static_cast<size_t>(last - first) >= RADIX_SORT_MIN_SIZE)
+			{
+				radixSortBy(first, last, key);
+				return;
+			}
+		}
+		std::sort(first, last, comp);
+	}
+}
+
+}
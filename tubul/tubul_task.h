@@ -0,0 +1,417 @@
+//
+// Created by Carlos Acosta on 18-10-26.
+//
+
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <semaphore>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace TU
+{
+
+/** Task<T> is the return type of a coroutine producing a T (or nothing). Tasks are lazy:
+ * the body doesn't start until someone co_awaits the task, and when the task finishes
+ * the awaiting coroutine continues right away on the same thread. Combined with
+ * ThreadPool::schedule() it allows writing pipelines that jump to the pool's workers
+ * without blocking any thread while waiting:
+ *
+ * TU::Task<std::string> readFile(TU::ThreadPool& pool, std::string name) {
+ *     co_await pool.schedule();            //From here on we run in a worker
+ *     co_return TU::readToString(name);
+ * }
+ * TU::Task<Index> load(TU::ThreadPool& pool) {
+ *     auto contents = co_await readFile(pool, "data.csv");
+ *     co_return buildIndex(contents);
+ * }
+ * auto index = TU::syncWait(load(pool));  //Blocks the calling (non coroutine) thread.
+ *
+ * Use whenAll to run several tasks concurrently and wait for all of them. Exceptions
+ * thrown inside a task are rethrown to whoever awaits it.
+ *
+ * Blocks (TU::Block) belong to the thread that opens them, so don't keep one open across a
+ * co_await that can resume on another thread (like pool.schedule()): open it after the co_await,
+ * or in a scope that ends before it. A block that closes on another thread is not measured (it
+ * warns once).
+ */
+template <typename T = void>
+class Task;
+
+namespace detail
+{
+	struct TaskPromiseBase
+	{
+		//When the task finishes we jump straight into whoever was awaiting it.
+		struct FinalAwaiter
+		{
+			bool await_ready() const noexcept { return false; }
+
+			template <typename Promise>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept
+			{
+				auto continuation = finished.promise().continuation_;
+				return continuation ? continuation : std::noop_coroutine();
+			}
+
+			void await_resume() const noexcept {}
+		};
+
+		std::suspend_always initial_suspend() const noexcept { return {}; }
+		FinalAwaiter final_suspend() const noexcept { return {}; }
+		void unhandled_exception() noexcept { exception_ = std::current_exception(); }
+
+		void rethrowIfFailed() const
+		{
+			if (exception_)
+				std::rethrow_exception(exception_);
+		}
+
+		std::coroutine_handle<> continuation_;
+		std::exception_ptr exception_;
+	};
+
+	template <typename T>
+	struct TaskPromise : TaskPromiseBase
+	{
+		Task<T> get_return_object() noexcept;
+
+		template <typename U>
+		void return_value(U&& value)
+		{
+			value_.emplace(std::forward<U>(value));
+		}
+
+		T result()
+		{
+			rethrowIfFailed();
+			return std::move(*value_);
+		}
+
+		std::optional<T> value_;
+	};
+
+	template <>
+	struct TaskPromise<void> : TaskPromiseBase
+	{
+		Task<void> get_return_object() noexcept;
+
+		void return_void() const noexcept {}
+
+		void result() const { rethrowIfFailed(); }
+	};
+}
+
+template <typename T>
+class [[nodiscard]] Task
+{
+public:
+	using promise_type = detail::TaskPromise<T>;
+	using Handle = std::coroutine_handle<promise_type>;
+
+	Task() = default;
+	explicit Task(Handle h) noexcept : handle_(h) {}
+	Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+	Task& operator=(Task&& other) noexcept
+	{
+		if (this != &other)
+		{
+			destroy();
+			handle_ = std::exchange(other.handle_, {});
+		}
+		return *this;
+	}
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+	~Task() { destroy(); }
+
+	[[nodiscard]] bool valid() const noexcept { return static_cast<bool>(handle_); }
+	[[nodiscard]] bool done() const noexcept { return handle_ and handle_.done(); }
+
+	//Awaiter interface: awaiting a task starts it, and resumes the awaiting coroutine once
+	//it's done (through symmetric transfer, so long chains don't grow the stack).
+	bool await_ready() const noexcept { return not handle_ or handle_.done(); }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		handle_.promise().continuation_ = awaiting;
+		return handle_;
+	}
+
+	T await_resume() { return handle_.promise().result(); }
+
+private:
+	void destroy() noexcept
+	{
+		if (handle_)
+			handle_.destroy();
+		handle_ = {};
+	}
+
+	Handle handle_;
+};
+
+namespace detail
+{
+	template <typename T>
+	Task<T> TaskPromise<T>::get_return_object() noexcept
+	{
+		return Task<T>{std::coroutine_handle<TaskPromise<T>>::from_promise(*this)};
+	}
+
+	inline Task<void> TaskPromise<void>::get_return_object() noexcept
+	{
+		return Task<void>{std::coroutine_handle<TaskPromise<void>>::from_promise(*this)};
+	}
+
+	//Coroutine used to drive a task to completion from code that is not a coroutine. When
+	//it finishes it releases a semaphore the blocked thread is waiting on.
+	struct SyncWaitTask
+	{
+		struct promise_type
+		{
+			SyncWaitTask get_return_object() noexcept
+			{
+				return SyncWaitTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+			}
+			std::suspend_always initial_suspend() const noexcept { return {}; }
+			auto final_suspend() const noexcept
+			{
+				struct ReleaseAwaiter
+				{
+					bool await_ready() const noexcept { return false; }
+					void await_suspend(std::coroutine_handle<promise_type> h) const noexcept { h.promise().done_->release(); }
+					void await_resume() const noexcept {}
+				};
+				return ReleaseAwaiter{};
+			}
+			void return_void() const noexcept {}
+			//The body catches everything itself.
+			void unhandled_exception() const noexcept { std::terminate(); }
+
+			std::binary_semaphore* done_ = nullptr;
+		};
+
+		explicit SyncWaitTask(std::coroutine_handle<promise_type> h) : handle_(h) {}
+		SyncWaitTask(SyncWaitTask&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+		~SyncWaitTask()
+		{
+			if (handle_)
+				handle_.destroy();
+		}
+
+		void run(std::binary_semaphore& done)
+		{
+			handle_.promise().done_ = &done;
+			handle_.resume();
+			done.acquire();
+		}
+
+		std::coroutine_handle<promise_type> handle_;
+	};
+
+	template <typename T>
+	SyncWaitTask makeSyncWaitTask(Task<T>& task, std::optional<T>& result, std::exception_ptr& error)
+	{
+		try
+		{
+			result.emplace(co_await task);
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+	}
+
+	inline SyncWaitTask makeSyncWaitTask(Task<void>& task, std::exception_ptr& error)
+	{
+		try
+		{
+			co_await task;
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+	}
+
+	//Shared state of a whenAll: a counter of unfinished tasks (plus one for the awaiting
+	//coroutine itself, so it can't be resumed before it has finished suspending), who to
+	//resume at the end, and the first exception thrown by any of the tasks.
+	struct WhenAllState
+	{
+		explicit WhenAllState(size_t count) : remaining_(count + 1) {}
+
+		std::atomic<size_t> remaining_;
+		std::coroutine_handle<> continuation_;
+		std::atomic_flag failed_ = ATOMIC_FLAG_INIT;
+		std::exception_ptr exception_;
+
+		void setException(std::exception_ptr e)
+		{
+			if (not failed_.test_and_set())
+				exception_ = std::move(e);
+		}
+	};
+
+	struct WhenAllHelper
+	{
+		struct promise_type
+		{
+			WhenAllHelper get_return_object() noexcept
+			{
+				return WhenAllHelper{std::coroutine_handle<promise_type>::from_promise(*this)};
+			}
+			std::suspend_always initial_suspend() const noexcept { return {}; }
+			auto final_suspend() const noexcept
+			{
+				struct LastOneResumes
+				{
+					bool await_ready() const noexcept { return false; }
+					std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) const noexcept
+					{
+						auto* state = h.promise().state_;
+						if (state->remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+							return state->continuation_;
+						return std::noop_coroutine();
+					}
+					void await_resume() const noexcept {}
+				};
+				return LastOneResumes{};
+			}
+			void return_void() const noexcept {}
+			void unhandled_exception() const noexcept { std::terminate(); }
+
+			WhenAllState* state_ = nullptr;
+		};
+
+		explicit WhenAllHelper(std::coroutine_handle<promise_type> h) : handle_(h) {}
+		WhenAllHelper(WhenAllHelper&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+		~WhenAllHelper()
+		{
+			if (handle_)
+				handle_.destroy();
+		}
+
+		std::coroutine_handle<promise_type> handle_;
+	};
+
+	template <typename T>
+	WhenAllHelper makeWhenAllHelper(Task<T>& task, std::optional<T>& result, WhenAllState& state)
+	{
+		try
+		{
+			result.emplace(co_await task);
+		}
+		catch (...)
+		{
+			state.setException(std::current_exception());
+		}
+	}
+
+	inline WhenAllHelper makeWhenAllHelper(Task<void>& task, WhenAllState& state)
+	{
+		try
+		{
+			co_await task;
+		}
+		catch (...)
+		{
+			state.setException(std::current_exception());
+		}
+	}
+
+	struct WhenAllAwaiter
+	{
+		bool await_ready() const noexcept { return helpers_.empty(); }
+
+		bool await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			state_.continuation_ = awaiting;
+			for (auto& helper: helpers_)
+			{
+				helper.handle_.promise().state_ = &state_;
+				helper.handle_.resume();
+			}
+			//If every task already finished, we just keep going without suspending.
+			return state_.remaining_.fetch_sub(1, std::memory_order_acq_rel) != 1;
+		}
+
+		void await_resume() const
+		{
+			if (state_.exception_)
+				std::rethrow_exception(state_.exception_);
+		}
+
+		WhenAllState& state_;
+		std::vector<WhenAllHelper>& helpers_;
+	};
+}
+
+/** Runs a task to completion, blocking the calling thread until it finishes, and returns
+ * its result (or rethrows its exception). This is the bridge between normal code and
+ * coroutines, for example at main() or inside a test.
+ */
+template <typename T>
+T syncWait(Task<T> task)
+{
+	std::binary_semaphore done(0);
+	std::exception_ptr error;
+	if constexpr (std::is_void_v<T>)
+	{
+		detail::makeSyncWaitTask(task, error).run(done);
+		if (error)
+			std::rethrow_exception(error);
+	}
+	else
+	{
+		std::optional<T> result;
+		detail::makeSyncWaitTask(task, result, error).run(done);
+		if (error)
+			std::rethrow_exception(error);
+		return std::move(*result);
+	}
+}
+
+/** Starts all the given tasks at once and completes when all of them are finished,
+ * returning their results in the same order. If a task throws, the first exception is
+ * rethrown once all of them are done. Tasks only run concurrently if they move themselves
+ * to a ThreadPool (co_await pool.schedule()), otherwise they run one after the other.
+ */
+template <typename T>
+	requires(not std::is_void_v<T>)
+Task<std::vector<T>> whenAll(std::vector<Task<T>> tasks)
+{
+	detail::WhenAllState state(tasks.size());
+	std::vector<std::optional<T>> results(tasks.size());
+	std::vector<detail::WhenAllHelper> helpers;
+	helpers.reserve(tasks.size());
+	for (size_t i = 0; i < tasks.size(); ++i)
+		helpers.push_back(detail::makeWhenAllHelper(tasks[i], results[i], state));
+
+	co_await detail::WhenAllAwaiter{state, helpers};
+
+	std::vector<T> res;
+	res.reserve(results.size());
+	for (auto& r: results)
+		res.push_back(std::move(*r));
+	co_return res;
+}
+
+inline Task<void> whenAll(std::vector<Task<void>> tasks)
+{
+	detail::WhenAllState state(tasks.size());
+	std::vector<detail::WhenAllHelper> helpers;
+	helpers.reserve(tasks.size());
+	for (auto& task: tasks)
+		helpers.push_back(detail::makeWhenAllHelper(task, state));
+
+	co_await detail::WhenAllAwaiter{state, helpers};
+}
+
+}
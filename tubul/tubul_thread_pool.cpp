@@ -1,38 +1,163 @@
 
 #include "tubul_thread_pool.h"
+#include "tubul_enumerate.h"
+#include <chrono>
+#include <format>
+#include <sstream>
 
 
 namespace TU
 {
 
+    static int64_t steadyNs() {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
 
     ThreadPool::ThreadPool(size_t thread_count) :
-            thread_count_((thread_count > 0) ? thread_count : std::thread::hardware_concurrency()),
+            ThreadPool(ThreadPoolConfig{thread_count})
+    {
+    }
+
+    ThreadPool::ThreadPool(ThreadPoolConfig config) :
+            thread_count_((config.threadCount > 0) ? config.threadCount : std::thread::hardware_concurrency()),
+            queue_count_(1),
             threads_(std::make_unique<std::thread[]>(thread_count_)),
-            tasks_total_(0)
+            tasks_total_(0),
+            next_queue_(0)
     {
-        tasks_.reserve(thread_count);
+        computePlacement(config);
+        for (size_t q = 0; q < queue_count_; ++q)
+            queues_.push_back(std::make_unique<WorkQueue>(config.queueCapacity));
+        for (const auto& placement: placement_)
+            ++queues_[placement.queue_]->workers_;
+        if (config.collectStats)
+            counters_ = std::make_unique<WorkerCounters[]>(thread_count_);
         running_.test_and_set();
+        //Waiting for the workers to pin themselves makes getPoolWorkerCpus() reliable.
+        std::latch started(static_cast<std::ptrdiff_t>(thread_count_));
         for (size_t i = 0; i < thread_count_; ++i)
         {
-            threads_[i] = std::thread(&ThreadPool::workerFn, this);
+            threads_[i] = std::thread(&ThreadPool::workerFn, this, i, std::ref(started));
         }
+        started.wait();
     }
 
     ThreadPool::~ThreadPool() {
         waitForTasks();
         running_.clear();
-        task_available_cv_.notify_all();
+        for (auto& work_queue: queues_)
+        {
+            //Taking the lock ensures no worker is between checking running_ and going to sleep,
+            //which would make it miss the notification.
+            { const std::scoped_lock lock(work_queue->mutex_); }
+            work_queue->task_available_cv_.notify_all();
+        }
         for (size_t i = 0; i < thread_count_; ++i)
         {
             threads_[i].join();
         }
     }
 
+    void ThreadPool::computePlacement(const ThreadPoolConfig& config) {
+        placement_.resize(thread_count_, WorkerPlacement{0, {}});
+        //Without pinning or node queues the pool doesn't care about the machine's layout.
+        if (config.affinity == ThreadAffinity::NONE and not config.nodeLocalQueues)
+            return;
+
+        const CpuTopology topology = config.topology ? *config.topology : readCpuTopology();
+        //We can't use more nodes than threads, otherwise a node queue would have no workers.
+        const size_t nodes_used = std::max<size_t>(1, std::min(topology.nodeCount(), thread_count_));
+        if (config.nodeLocalQueues)
+            queue_count_ = nodes_used;
+
+        for (size_t i = 0; i < thread_count_; ++i)
+        {
+            const size_t node_index = i % nodes_used;
+            const size_t local_index = i / nodes_used;
+            auto& placement = placement_[i];
+            placement.queue_ = config.nodeLocalQueues ? node_index : 0;
+            if (node_index >= topology.nodeCount())
+                continue;
+            const auto& node = topology.nodes[node_index];
+            switch (config.affinity)
+            {
+                case ThreadAffinity::CPU:
+                    if (not node.cpus.empty())
+                        placement.cpus_ = {node.cpus[local_index % node.cpus.size()]};
+                    break;
+                case ThreadAffinity::CORE:
+                    if (not node.cores.empty())
+                        placement.cpus_ = node.cores[local_index % node.cores.size()];
+                    break;
+                case ThreadAffinity::NUMA_NODE:
+                    placement.cpus_ = node.cpus;
+                    break;
+                case ThreadAffinity::NONE:
+                    break;
+            }
+        }
+    }
+
+    void ThreadPool::enqueue(size_t queue, std::function<void()>&& task) {
+        //The counters go up before the task is visible, so a fast worker can't
+        //make them go below zero.
+        ++tasks_total_;
+        auto& work_queue = *queues_[queue];
+        const auto depth = static_cast<size_t>(work_queue.pending_.fetch_add(1) + 1);
+        const bool stats = collectsStats();
+        QueuedTask item{std::move(task), stats ? steadyNs() : 0};
+        if (not work_queue.ring_.tryPush(std::move(item)))
+        {
+            const std::scoped_lock overflow_lock(work_queue.mutex_);
+            work_queue.overflow_.push_back(std::move(item));
+            work_queue.overflow_size_.fetch_add(1);
+        }
+        if (stats)
+        {
+            auto peak = work_queue.peak_depth_.load(std::memory_order_relaxed);
+            while (depth > peak and not work_queue.peak_depth_.compare_exchange_weak(peak, depth, std::memory_order_relaxed))
+            {
+            }
+        }
+        //Only bother the workers if somebody is sleeping. Taking the lock ensures the sleeping
+        //worker is already waiting on the condition variable and won't miss the notification.
+        if (work_queue.sleepers_.load() > 0)
+        {
+            { const std::scoped_lock lock(work_queue.mutex_); }
+            work_queue.task_available_cv_.notify_one();
+        }
+        //More tasks waiting than workers to run them: wake up a sleeper of another node to help.
+        if (queue_count_ > 1 and depth > work_queue.workers_)
+            wakeStealer(queue);
+    }
+
+    void ThreadPool::wakeStealer(size_t busy_queue) {
+        for (size_t offset = 1; offset < queue_count_; ++offset)
+        {
+            auto& other = *queues_[(busy_queue + offset) % queue_count_];
+            if (other.sleepers_.load() == 0)
+                continue;
+            {
+                const std::scoped_lock lock(other.mutex_);
+                other.steal_wakeup_.store(true);
+            }
+            other.task_available_cv_.notify_one();
+            return;
+        }
+    }
+
+    size_t ThreadPool::nextQueue() {
+        if (queue_count_ == 1)
+            return 0;
+        return next_queue_.fetch_add(1, std::memory_order_relaxed) % queue_count_;
+    }
+
     void ThreadPool::waitForTasks() {
         waiting_.test_and_set();
-        std::unique_lock<std::mutex> tasks_lock(tasks_mutex_);
-        task_done_cv_.wait(tasks_lock, [this] { return (tasks_total_ == 0); });
+        std::unique_lock<std::mutex> done_lock(done_mutex_);
+        task_done_cv_.wait(done_lock, [this] { return (tasks_total_ == 0); });
         waiting_.clear();
     }
 
@@ -40,6 +165,10 @@ namespace TU
         return thread_count_;
     }
 
+    size_t ThreadPool::nodeCount() const {
+        return queue_count_;
+    }
+
     std::vector<std::thread::id> ThreadPool::getPoolWorkerIds() const{
         std::vector<std::thread::id> res;
         for (size_t i = 0; i < thread_count_; ++i) {
@@ -48,24 +177,150 @@ namespace TU
         return res;
     }
 
-    void ThreadPool::workerFn() {
+    std::vector<std::vector<size_t>> ThreadPool::getPoolWorkerCpus() const{
+        std::vector<std::vector<size_t>> res;
+        for (const auto& placement: placement_) {
+            res.push_back( placement.cpus_ );
+        }
+        return res;
+    }
+
+    bool ThreadPool::tryTake(WorkQueue& work_queue, QueuedTask& task) {
+        if (work_queue.ring_.tryPop(task))
+        {
+            work_queue.pending_.fetch_sub(1);
+            return true;
+        }
+        if (work_queue.overflow_size_.load(std::memory_order_relaxed) == 0)
+            return false;
+        const std::scoped_lock overflow_lock(work_queue.mutex_);
+        if (work_queue.overflow_.empty())
+            return false;
+        task = std::move(work_queue.overflow_.back());
+        work_queue.overflow_.pop_back();
+        work_queue.overflow_size_.fetch_sub(1);
+        work_queue.pending_.fetch_sub(1);
+        return true;
+    }
+
+    bool ThreadPool::stealTask(size_t own_queue, QueuedTask& task) {
+        for (size_t offset = 1; offset < queue_count_; ++offset)
+        {
+            if (tryTake(*queues_[(own_queue + offset) % queue_count_], task))
+                return true;
+        }
+        return false;
+    }
+
+    void ThreadPool::runTask(QueuedTask& task, WorkerCounters* counters) {
+        if (counters)
+        {
+            const auto start = steadyNs();
+            counters->queue_wait_ns_.record(static_cast<uint64_t>(std::max<int64_t>(0, start - task.enqueued_ns_)));
+            task.function_();
+            counters->busy_ns_.fetch_add(static_cast<uint64_t>(steadyNs() - start), std::memory_order_relaxed);
+            counters->tasks_executed_.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            task.function_();
+        }
+        if (--tasks_total_ == 0 and waiting_.test())
+        {
+            const std::scoped_lock done_lock(done_mutex_);
+            task_done_cv_.notify_all();
+        }
+    }
+
+    void ThreadPool::workerFn(size_t worker_index, std::latch& started) {
+        auto& placement = placement_[worker_index];
+        if (not placement.cpus_.empty() and not pinCurrentThread(placement.cpus_))
+            placement.cpus_.clear();
+        started.count_down();
+
+        WorkerCounters* counters = counters_ ? &counters_[worker_index] : nullptr;
+        auto& work_queue = *queues_[placement.queue_];
         while (running_.test())
         {
-            std::function<void()> task;
-            std::unique_lock<std::mutex> tasks_lock(tasks_mutex_);
-            task_available_cv_.wait(tasks_lock, [this] { return !tasks_.empty() || !running_.test(); });
-            if (running_.test())
+            QueuedTask task;
+            if (tryTake(work_queue, task))
             {
-                task = std::move(tasks_.back());
-                tasks_.pop_back();
-                tasks_lock.unlock();
-                task();
-                tasks_lock.lock();
-                --tasks_total_;
-                if (waiting_.test())
-                    task_done_cv_.notify_one();
+                runTask(task, counters);
+                continue;
             }
+            //Nothing to do at home, so we try to help the other nodes before sleeping.
+            if (queue_count_ > 1 and stealTask(placement.queue_, task))
+            {
+                if (counters)
+                    counters->steals_.fetch_add(1, std::memory_order_relaxed);
+                runTask(task, counters);
+                continue;
+            }
+            std::unique_lock<std::mutex> sleep_lock(work_queue.mutex_);
+            work_queue.sleepers_.fetch_add(1);
+            const auto idle_start = counters ? steadyNs() : 0;
+            work_queue.task_available_cv_.wait(sleep_lock, [this, &work_queue] {
+                return work_queue.pending_.load() > 0 || work_queue.steal_wakeup_.exchange(false) || !running_.test();
+            });
+            if (counters)
+                counters->idle_ns_.fetch_add(static_cast<uint64_t>(steadyNs() - idle_start), std::memory_order_relaxed);
+            work_queue.sleepers_.fetch_sub(1);
+        }
+    }
+
+    bool ThreadPool::collectsStats() const {
+        return static_cast<bool>(counters_);
+    }
+
+    std::vector<ThreadPoolWorkerStats> ThreadPool::getWorkerStats() const {
+        std::vector<ThreadPoolWorkerStats> res;
+        if (not counters_)
+            return res;
+        res.reserve(thread_count_);
+        for (size_t i = 0; i < thread_count_; ++i)
+        {
+            const auto& c = counters_[i];
+            const auto queue = placement_[i].queue_;
+            ThreadPoolWorkerStats stats;
+            stats.tasksExecuted = c.tasks_executed_.load(std::memory_order_relaxed);
+            stats.busyNs = c.busy_ns_.load(std::memory_order_relaxed);
+            stats.idleNs = c.idle_ns_.load(std::memory_order_relaxed);
+            stats.steals = c.steals_.load(std::memory_order_relaxed);
+            stats.queue = queue;
+            stats.peakQueueDepth = queues_[queue]->peak_depth_.load(std::memory_order_relaxed);
+            stats.queueWaitNs = c.queue_wait_ns_;
+            res.push_back(std::move(stats));
+        }
+        return res;
+    }
+
+    // generates a table with a row per worker, in the same style of reportBlocks
+    std::string ThreadPool::reportStats() const {
+        std::ostringstream report;
+        if (not counters_)
+        {
+            report << "ThreadPool stats are disabled (see ThreadPoolConfig::collectStats)\n";
+            return report.str();
+        }
+
+        auto seconds = [](uint64_t ns) { return static_cast<double>(ns) * 1e-9; };
+        auto micros = [](uint64_t ns) { return static_cast<double>(ns) * 1e-3; };
+
+        // header
+        report << std::format("| {:<6} | {:<5} | {:<10} | {:<12} | {:<12} | {:<7} | {:<10} | {:<10} | {:<10} | {:<10} |\n",
+            "worker", "queue", "tasks", "busy time", "idle time", "steals", "peak depth", "wait p50", "wait p99", "wait max");
+
+        uint64_t total_tasks = 0;
+        for (const auto& [i, stats]: enumerate(getWorkerStats()))
+        {
+            total_tasks += stats.tasksExecuted;
+            const auto& wait = stats.queueWaitNs;
+            report << std::format("| {:<6} | {:<5} | {:<10} | {:<12.6g} | {:<12.6g} | {:<7} | {:<10} | {:<10.4g} | {:<10.4g} | {:<10.4g} |\n",
+                i, stats.queue, stats.tasksExecuted, seconds(stats.busyNs), seconds(stats.idleNs), stats.steals,
+                stats.peakQueueDepth, micros(wait.percentile(0.5)), micros(wait.percentile(0.99)), micros(wait.max()));
         }
+        report << std::format("Total tasks executed: {} (times in seconds, waits in microseconds)\n", total_tasks);
+        return report.str();
     }
 
 }
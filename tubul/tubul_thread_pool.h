@@ -3,19 +3,78 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <coroutine>
 #include <exception>
 #include <functional>
 #include <future>
+#include <latch>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <thread>
 #include <type_traits>
 #include <utility>
+#include <string>
 #include <vector>
+#include "tubul_cpu_topology.h"
+#include "tubul_histogram.h"
+#include "tubul_mpmc_queue.h"
 
 namespace TU
 {
 
+    /** How the workers of a ThreadPool are placed on the machine.
+     * NONE lets the OS scheduler move the threads freely (the default).
+     * CPU pins each worker to a single logical cpu.
+     * CORE pins each worker to a physical core (all its hyperthreads).
+     * NUMA_NODE lets each worker run on any cpu of the node it was assigned to.
+     */
+    enum class ThreadAffinity
+    {
+        NONE,
+        CPU,
+        CORE,
+        NUMA_NODE
+    };
+
+    /** Configuration of a ThreadPool. Workers are distributed round robin over the
+     * NUMA nodes of the topology (worker i goes to node i % nodeCount), so pinning
+     * spreads the pool over all sockets instead of filling the first one.
+     * When nodeLocalQueues is set, each node gets its own task queue that is only
+     * served by the workers of that node (they will steal from other nodes when they
+     * run out of work), which keeps tasks close to the memory they touch when used
+     * with pushTaskOnNode.
+     * The topology is read from the OS when it's not provided and actually needed.
+     * queueCapacity is the size of the lock-free ring of each queue (tasks beyond that go to
+     * a slower, locked overflow, so pushing never blocks).
+     * With collectStats, every worker keeps counters of what it does (see reportStats()).
+     * They cost a couple of clock reads per task, so they are off by default.
+     */
+    struct ThreadPoolConfig
+    {
+        size_t threadCount = 0;
+        ThreadAffinity affinity = ThreadAffinity::NONE;
+        bool nodeLocalQueues = false;
+        bool collectStats = false;
+        size_t queueCapacity = 1024;
+        std::optional<CpuTopology> topology = {};
+    };
+
+    /** Snapshot of the counters of one worker of a ThreadPool. Times are in nanoseconds.
+     * The queue wait histogram measures how long tasks were queued before this worker took
+     * them, and the peak queue depth is the one of the queue the worker serves.
+     */
+    struct ThreadPoolWorkerStats
+    {
+        uint64_t tasksExecuted = 0;
+        uint64_t busyNs = 0;
+        uint64_t idleNs = 0;
+        uint64_t steals = 0;
+        size_t queue = 0;
+        size_t peakQueueDepth = 0;
+        Histogram queueWaitNs;
+    };
+
 
     class ThreadPool
     {
@@ -23,11 +82,47 @@ namespace TU
 
         explicit ThreadPool(size_t thread_count = 0);
 
+        explicit ThreadPool(ThreadPoolConfig config);
+
         ~ThreadPool();
 
         [[maybe_unused]] [[nodiscard]]
         size_t threadCount() const;
 
+        /**
+         * @brief Number of task queues in the pool. It is the number of NUMA nodes used by the
+         * pool when it was created with node local queues, and 1 otherwise.
+         */
+        [[maybe_unused]] [[nodiscard]]
+        size_t nodeCount() const;
+
+        /**
+         * @brief The cpus each worker is allowed to run on (in the same order as getPoolWorkerIds()).
+         * Empty if the worker is not pinned or the pinning failed.
+         */
+        [[maybe_unused]] [[nodiscard]]
+        std::vector<std::vector<size_t>> getPoolWorkerCpus() const;
+
+        /**
+         * @brief Whether the pool was created with collectStats.
+         */
+        [[maybe_unused]] [[nodiscard]]
+        bool collectsStats() const;
+
+        /**
+         * @brief Current counters of every worker (in the same order as getPoolWorkerIds()).
+         * Empty if the pool doesn't collect stats.
+         */
+        [[maybe_unused]] [[nodiscard]]
+        std::vector<ThreadPoolWorkerStats> getWorkerStats() const;
+
+        /**
+         * @brief Table with the counters of every worker, in the same style as reportBlocks().
+         * Useful to size pools and to spot imbalance between workers.
+         */
+        [[maybe_unused]] [[nodiscard]]
+        std::string reportStats() const;
+
         [[maybe_unused]] [[nodiscard]]
         std::vector<std::thread::id> getPoolWorkerIds() const;
 
@@ -47,12 +142,21 @@ namespace TU
         void pushTask(F&& task, A&&... args)
         {
             std::function<void()> task_function = std::bind(std::forward<F>(task), std::forward<A>(args)...);
-            {
-                const std::scoped_lock tasks_lock(tasks_mutex_);
-                tasks_.push_back(task_function);
-            }
-            ++tasks_total_;
-            task_available_cv_.notify_one();
+            enqueue(nextQueue(), std::move(task_function));
+        }
+
+        /**
+         * @brief Same as pushTask, but the task goes to the queue of the given node, so it
+         * will be executed (unless stolen) by a worker running on that node. Without node local
+         * queues there is a single queue, and this is the same as pushTask.
+         *
+         * @param node The index of the node, in [0, nodeCount()).
+         */
+        template <typename F, typename... A>
+        void pushTaskOnNode(size_t node, F&& task, A&&... args)
+        {
+            std::function<void()> task_function = std::bind(std::forward<F>(task), std::forward<A>(args)...);
+            enqueue(node % queue_count_, std::move(task_function));
         }
 
         /**
@@ -98,6 +202,30 @@ namespace TU
             return task_promise->get_future();
         }
 
+        /**
+         * @brief Awaitable returned by schedule(). Suspending on it queues the coroutine in the
+         * pool, so it continues its execution on one of the workers.
+         */
+        struct ScheduleAwaiter
+        {
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> awaiting) { pool_.pushTask([awaiting] { awaiting.resume(); }); }
+            void await_resume() const noexcept {}
+
+            ThreadPool& pool_;
+        };
+
+        /**
+         * @brief To be used inside a coroutine (see TU::Task) as "co_await pool.schedule();". The
+         * coroutine is suspended and then resumed by a worker of the pool, so everything after that
+         * line runs on the pool without blocking the thread that was running it before. While
+         * the coroutine runs in the worker it counts as a task for waitForTasks().
+         */
+        [[nodiscard]] ScheduleAwaiter schedule()
+        {
+            return ScheduleAwaiter{*this};
+        }
+
         /**
          * @brief Wait for tasks_ to be completed. Normally, this function waits for all tasks, both
          * those that are currently running in the threads_ and those that are still waiting in the queue.
@@ -108,17 +236,149 @@ namespace TU
 
     private:
 
+        /**
+         * @brief A task waiting in a queue. The enqueue time is only taken when collecting stats.
+         */
+        struct QueuedTask
+        {
+            std::function<void()> function_;
+            int64_t enqueued_ns_;
+        };
+
+        /**
+         * @brief A queue of tasks, along with the synchronization required to use it. The pool
+         * has one per NUMA node when using node local queues, or a single one otherwise.
+         * Tasks go to a lock-free ring, and only when the ring is full they spill into an
+         * overflow vector protected by the mutex, so pushTask never blocks (a blocking push
+         * would deadlock tasks that push other tasks). The mutex is otherwise only used by
+         * workers to go to sleep when there's nothing to do.
+         */
+        struct WorkQueue
+        {
+            explicit WorkQueue(size_t capacity) : ring_(capacity) {}
+
+            /**
+             * @brief The ring of tasks_ to be executed by the threads_.
+             */
+            MPMCQueue<QueuedTask> ring_;
+
+            /**
+             * @brief Tasks that didn't fit in the ring.
+             */
+            std::vector<QueuedTask> overflow_ = {};
+
+            /**
+             * @brief Number of tasks in overflow_, to avoid taking the lock to check it.
+             */
+            std::atomic<size_t> overflow_size_ = 0;
+
+            /**
+             * @brief Number of tasks waiting in the queue (ring plus overflow). It goes up before
+             * the task is pushed, so a worker seeing it as zero can safely sleep.
+             */
+            std::atomic<int64_t> pending_ = 0;
+
+            /**
+             * @brief Number of workers sleeping on task_available_cv_.
+             */
+            std::atomic<size_t> sleepers_ = 0;
+
+            /**
+             * @brief Number of workers serving this queue.
+             */
+            size_t workers_ = 0;
+
+            /**
+             * @brief Set when a worker of this queue is woken up to steal from a queue with more
+             * tasks waiting than workers, so it leaves the condition variable with its own queue
+             * still empty.
+             */
+            std::atomic<bool> steal_wakeup_ = false;
+
+            /**
+             * @brief The largest number of tasks waiting in the queue at the same time. Only
+             * tracked when collecting stats.
+             */
+            std::atomic<size_t> peak_depth_ = 0;
+
+            /**
+             * @brief A mutex protecting the overflow and used to sleep on the condition variable.
+             */
+            std::mutex mutex_;
+
+            /**
+             * @brief A condition variable used to notify workers that a new task has become available.
+             */
+            std::condition_variable task_available_cv_;
+        };
+
+        /**
+         * @brief Counters of a single worker. Only the worker writes them, but they are atomic
+         * so they can be read at any time. Aligned to avoid false sharing between workers.
+         */
+        struct alignas(CACHE_LINE_SIZE) WorkerCounters
+        {
+            std::atomic<uint64_t> tasks_executed_ = 0;
+            std::atomic<uint64_t> busy_ns_ = 0;
+            std::atomic<uint64_t> idle_ns_ = 0;
+            std::atomic<uint64_t> steals_ = 0;
+            Histogram queue_wait_ns_;
+        };
+
+        /**
+         * @brief Where a worker runs: the queue it serves and the cpus it is pinned to.
+         */
+        struct WorkerPlacement
+        {
+            size_t queue_;
+            std::vector<size_t> cpus_;
+        };
+
+        /**
+         * @brief Adds a task to the given queue and wakes up one of its workers.
+         */
+        void enqueue(size_t queue, std::function<void()>&& task);
+
+        /**
+         * @brief Picks the queue for the next task without an explicit node, round robin.
+         */
+        size_t nextQueue();
+
+        /**
+         * @brief Tries to take a task from the other queues of the pool. Only used with
+         * node local queues, when the worker's own queue is empty, or when woken up by
+         * enqueue() because another queue has more tasks waiting than workers.
+         */
+        bool stealTask(size_t own_queue, QueuedTask& task);
+
+        /**
+         * @brief Wakes up a sleeping worker of a queue other than busy_queue, so it steals from it.
+         */
+        void wakeStealer(size_t busy_queue);
+
+        /**
+         * @brief Takes a task from the given queue without blocking, if there's any.
+         */
+        static bool tryTake(WorkQueue& queue, QueuedTask& task);
+
+        /**
+         * @brief Runs a task and does the bookkeeping to let waitForTasks() know about it. The
+         * counters are null when the pool doesn't collect stats.
+         */
+        void runTask(QueuedTask& task, WorkerCounters* counters);
+
         /**
          * @brief A worker function to be assigned to each thread in the pool. Waits until it is notified by
          * push_task() that a task is available, and then retrieves the task from the queue and executes it. Once
-         * the task finishes, the worker notifies waitForTasks() in case it is waiting_.
+         * the task finishes, the worker notifies waitForTasks() in case it is waiting_. It counts
+         * down started once it is pinned (or clears its cpus if the pinning failed).
          */
-        void workerFn();
+        void workerFn(size_t worker_index, std::latch& started);
 
         /**
-         * @brief A condition variable used to notify worker() that a new task has become available.
+         * @brief Decides the queue and cpus of every worker from the configuration.
          */
-        std::condition_variable task_available_cv_;
+        void computePlacement(const ThreadPoolConfig& config);
 
         /**
          * @brief A condition variable used to notify waitForTasks() that a tasks_ is done.
@@ -126,19 +386,34 @@ namespace TU
         std::condition_variable task_done_cv_;
 
         /**
-         * @brief A vector of tasks_ to be executed by the threads_.
+         * @brief The mutex used along task_done_cv_.
          */
-        std::vector<std::function<void()>> tasks_ = {};
+        std::mutex done_mutex_;
 
         /**
-         * @brief A mutex to synchronize access to the task queue by different threads_.
+         * @brief The number of threads_ in the pool.
          */
-        mutable std::mutex tasks_mutex_;
+        size_t thread_count_;
 
         /**
-         * @brief The number of threads_ in the pool.
+         * @brief The number of task queues in the pool.
          */
-        size_t thread_count_;
+        size_t queue_count_;
+
+        /**
+         * @brief The task queues. Workers only wait on their own queue.
+         */
+        std::vector<std::unique_ptr<WorkQueue>> queues_;
+
+        /**
+         * @brief Placement of each worker of the pool.
+         */
+        std::vector<WorkerPlacement> placement_;
+
+        /**
+         * @brief Counters of each worker, only allocated when collecting stats.
+         */
+        std::unique_ptr<WorkerCounters[]> counters_;
 
         /**
          * @brief A smart pointer to manage the memory allocated for the threads_.
@@ -151,6 +426,11 @@ namespace TU
          */
         std::atomic<size_t> tasks_total_;
 
+        /**
+         * @brief Round robin counter used to distribute tasks among queues.
+         */
+        std::atomic<size_t> next_queue_;
+
         /**
          * @brief An atomic variable indicating that waitForTasks() is active and expects to be
          * notified whenever a task is done.